@@ -55,6 +55,18 @@ public:
     void set_tokens(const formula_tokens_store_ptr_t& tokens);
 
     double get_value(formula_result_wait_policy_t policy) const;
+
+    /**
+     * Get the numeric result value, or the error of the result when the
+     * result is an error, without throwing an exception for it.
+     *
+     * @param policy policy on waiting for the result to become available.
+     * @param value numeric result value, set only when no error is returned.
+     *
+     * @return error of the result, or formula_error_t::no_error if the value
+     *         has been set.
+     */
+    formula_error_t get_value_or_error(formula_result_wait_policy_t policy, double& value) const;
     const std::string* get_string(formula_result_wait_policy_t policy) const;
 
     void interpret(iface::formula_model_access& context, const abs_address_t& pos);
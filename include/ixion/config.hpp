@@ -39,6 +39,23 @@ struct IXION_DLLPUBLIC config
      */
     int8_t output_precision;
 
+    /**
+     * Policy on which formula cells to calculate first during
+     * multi-threaded calculation.  By default the cells get calculated in
+     * the order they are sorted.
+     */
+    calc_priority_t calc_priority;
+
+    /**
+     * Minimum number of formula cells to calculate for multi-threaded
+     * calculation to take place.  Smaller sets of formula cells get
+     * calculated on the calling thread even when threads are requested, as
+     * dispatching them to the calculation threads would cost more than it
+     * saves.  Set it to 0 to always use the requested threads.  By default
+     * it's 64.
+     */
+    size_t min_cells_for_threads;
+
     config();
     config(const config& r);
 };
@@ -80,6 +80,18 @@ public:
 
     abs_range_set_t query_dirty_cells(const abs_range_t& modified_cell) const;
 
+    /**
+     * Query all formula cells or cell ranges that directly reference the
+     * specified cell or cell range.  Unlike query_dirty_cells(), it does
+     * not follow the chain of indirect dependencies.
+     *
+     * @param range cell or cell range to query the dependents of.
+     *
+     * @return collection of formula cells or cell ranges that directly
+     *         reference the specified range.
+     */
+    abs_range_set_t query_direct_dependents(const abs_range_t& range) const;
+
     abs_range_set_t query_dirty_cells(const abs_range_set_t& modified_cells) const;
 
     std::vector<abs_range_t> query_and_sort_dirty_cells(const abs_range_t& modified_cell) const;
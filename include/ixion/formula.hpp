@@ -171,9 +171,11 @@ IXION_DLLPUBLIC std::vector<abs_range_t> query_and_sort_dirty_cells(
  * @param thread_count number of calculation threads to use.  Note that
  *                     passing 0 will make the process use the main thread
  *                     only, while passing any number greater than 0 will
- *                     make the process spawn specified number of
- *                     calculation threads plus one additional thread to
- *                     manage the calculation threads.
+ *                     make the process use a pool of specified number
+ *                     of calculation threads.  The pool gets created on
+ *                     first use and is reused by subsequent calculations
+ *                     with the same thread count.  A small set of cells
+ *                     gets calculated on the main thread regardless.
  */
 void IXION_DLLPUBLIC calculate_sorted_cells(
     iface::formula_model_access& cxt, const std::vector<abs_range_t>& formula_cells, size_t thread_count);
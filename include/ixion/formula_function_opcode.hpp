@@ -338,6 +338,7 @@ enum class formula_function_t : uint16_t
     func_weekday,
     func_weeknum,
     func_weibull,
+    func_xlookup,
     func_xor,
     func_year,
     func_ztest,
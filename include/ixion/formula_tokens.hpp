@@ -17,6 +17,12 @@
 
 namespace ixion {
 
+namespace detail {
+
+class formula_tokens_store_access;
+
+}
+
 /**
  * Get a printable name for a formula opcode.  The printable name is to be
  * used only for informational purposes.
@@ -66,6 +72,7 @@ class IXION_DLLPUBLIC formula_tokens_store
 {
     friend void intrusive_ptr_add_ref(formula_tokens_store*);
     friend void intrusive_ptr_release(formula_tokens_store*);
+    friend class detail::formula_tokens_store_access;
 
     struct impl;
     std::unique_ptr<impl> mp_impl;
@@ -86,8 +93,17 @@ public:
 
     size_t get_reference_count() const;
 
-    formula_tokens_t& get();
     const formula_tokens_t& get() const;
+
+    /**
+     * Replace the stored tokens.  This discards the program compiled from
+     * the previous tokens, along with any cached expansion of their named
+     * expressions.  If the previous tokens have been compiled, the new
+     * tokens get compiled in their place.
+     *
+     * @param tokens new tokens to store.
+     */
+    void set(formula_tokens_t tokens);
 };
 
 inline void intrusive_ptr_add_ref(formula_tokens_store* p)
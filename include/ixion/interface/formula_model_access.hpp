@@ -9,6 +9,7 @@
 #define INCLUDED_IXION_INTERFACE_MODEL_CONTEXT_HPP
 
 #include "ixion/formula_tokens.hpp"
+#include "ixion/formula_function_opcode.hpp"
 #include "ixion/types.hpp"
 #include "ixion/exceptions.hpp"
 
@@ -31,6 +32,7 @@ namespace iface {
 
 class session_handler;
 class table_handler;
+class range_value_handler;
 
 /**
  * Interface for allowing access to the model mostly from ixion's formula
@@ -72,6 +74,22 @@ public:
      * @return numeric representation of the cell value.
      */
     virtual double get_numeric_value(const abs_address_t& addr) const = 0;
+
+    /**
+     * Get a numeric representation of the cell value at specified position
+     * the same way get_numeric_value() does, except that the error of a
+     * formula cell with an error result gets returned instead of thrown.
+     * The default implementation catches the error thrown from
+     * get_numeric_value().
+     *
+     * @param addr position of the cell.
+     * @param value numeric representation of the cell value, set only when
+     *              no error is returned.
+     *
+     * @return error of the cell, or formula_error_t::no_error if the value
+     *         has been set.
+     */
+    virtual formula_error_t get_numeric_value_or_error(const abs_address_t& addr, double& value) const;
     virtual bool get_boolean_value(const abs_address_t& addr) const = 0;
     virtual string_id_t get_string_identifier(const abs_address_t& addr) const = 0;
 
@@ -103,8 +121,53 @@ public:
      */
     virtual const named_expression_t* get_named_expression(sheet_t sheet, const std::string& name) const = 0;
 
+    /**
+     * Get the revision of the named expressions stored in the model.  The
+     * revision must change whenever a named expression gets added or
+     * modified, so that the interpreter can re-use its named expression
+     * expansions for as long as the revision stays the same.
+     *
+     * @return current revision of the named expressions, or 0 if the model
+     *         implementation doesn't track it, in which case named
+     *         expressions get expanded on each interpretation.
+     */
+    virtual size_t get_named_expressions_revision() const;
+
+    /**
+     * Set the number of threads requested for the calculation that is
+     * about to begin.  The functions that can split their work between
+     * threads use as many.  The default implementation doesn't store it.
+     *
+     * @param thread_count number of threads, or 0 for a single-threaded
+     *                     calculation and when the calculation ends.
+     */
+    virtual void set_calc_thread_count(size_t thread_count);
+
+    /**
+     * Get the number of threads requested for the current calculation.
+     *
+     * @return number of threads, or 0 if the calculation is single-threaded
+     *         or if the model implementation doesn't store it.
+     */
+    virtual size_t get_calc_thread_count() const;
+
     virtual double count_range(const abs_range_t& range, const values_t& values_type) const = 0;
 
+    /**
+     * Aggregate all numeric values in a range.  Boolean values are treated
+     * as numeric values, while empty cells, string cells and formula cells
+     * with string results are skipped.  The default implementation
+     * aggregates the values passed from walk_range() on each sheet.
+     *
+     * @param range absolute range address.
+     *
+     * @return aggregate values of the range.
+     *
+     * @exception formula_error when the range contains a formula cell with
+     *            an error result.
+     */
+    virtual numeric_summary_t summarize_range(const abs_range_t& range) const;
+
     /**
      * Obtain range value in matrix form.  Multi-sheet ranges are not
      * supported.  If the specified range consists of multiple sheets, it
@@ -117,6 +180,111 @@ public:
      */
     virtual matrix get_range_value(const abs_range_t& range) const = 0;
 
+    /**
+     * Pass the values of all cells in a range to a handler, without
+     * copying them into a matrix first.  Multi-sheet ranges are not
+     * supported.  Whole-column and whole-row ranges get clipped to the
+     * sheet size.  The default implementation walks the matrix returned
+     * from get_range_value().
+     *
+     * @param range absolute, single-sheet range address.
+     * @param handler handler to receive the cell values.
+     */
+    virtual void walk_range(const abs_range_t& range, range_value_handler& handler) const;
+
+    /**
+     * Look up the result of a function called with a single range argument,
+     * which has been stored earlier during the current calculation.  The
+     * default implementation doesn't store any results.
+     *
+     * @param func opcode of the function.
+     * @param range absolute range passed to the function.
+     * @param value result of the function, set only when found.
+     *
+     * @return true if the result has been found, false otherwise.
+     */
+    virtual bool get_range_result(formula_function_t func, const abs_range_t& range, double& value) const;
+
+    /**
+     * Store the result of a function called with a single range argument,
+     * so that other cells calling the same function with the same range can
+     * re-use it for the rest of the current calculation.  The stored
+     * results must be discarded when the calculation ends.  This may be
+     * called concurrently from multiple threads.
+     *
+     * @param func opcode of the function.
+     * @param range absolute range passed to the function.
+     * @param value result of the function.
+     */
+    virtual void set_range_result(formula_function_t func, const abs_range_t& range, double value);
+
+    /**
+     * Check whether the result of a function called with a single range
+     * argument has been marked as unavailable earlier during the current
+     * calculation, in which case it should be computed directly rather than
+     * looked up.  The default implementation doesn't store any markers.
+     *
+     * @param func opcode of the function.
+     * @param range absolute range passed to the function.
+     *
+     * @return true if the result has been marked as unavailable, false
+     *         otherwise.
+     */
+    virtual bool is_range_result_unavailable(formula_function_t func, const abs_range_t& range) const;
+
+    /**
+     * Mark the result of a function called with a single range argument as
+     * one that cannot be derived from the results of other cells, so that
+     * the cell calling the function doesn't attempt it again.  The markers
+     * must be discarded when the calculation ends.  This may be called
+     * concurrently from multiple threads.
+     *
+     * @param func opcode of the function.
+     * @param range absolute range passed to the function.
+     */
+    virtual void set_range_result_unavailable(formula_function_t func, const abs_range_t& range);
+
+    /**
+     * Find the position of a numeric value in a single-row or single-column
+     * range, as the lookup functions do.  Only numeric cells, including
+     * formula cells with numeric results, can match.  The default
+     * implementation scans the values passed from walk_range() on each
+     * call.
+     *
+     * @param range absolute, single-sheet range consisting of either a
+     *              single row or a single column.
+     * @param value value to look up.
+     * @param match type of match to look for.
+     * @param search which cell to pick when multiple cells match.
+     * @param pos offset of the matching cell from the first cell of the
+     *            range, set only when found.
+     *
+     * @return true if a matching cell has been found, false otherwise.
+     */
+    virtual bool find_in_range(
+        const abs_range_t& range, double value, lookup_match_t match, lookup_search_t search, size_t& pos) const;
+
+    /**
+     * Find the position of a string value in a single-row or single-column
+     * range, as the lookup functions do.  Only string cells, including
+     * formula cells with string results, can match, and the strings are
+     * compared case-insensitively.  The default implementation scans the
+     * values passed from walk_range() on each call.
+     *
+     * @param range absolute, single-sheet range consisting of either a
+     *              single row or a single column.
+     * @param value value to look up.
+     * @param match type of match to look for.
+     * @param search which cell to pick when multiple cells match.
+     * @param pos offset of the matching cell from the first cell of the
+     *            range, set only when found.
+     *
+     * @return true if a matching cell has been found, false otherwise.
+     */
+    virtual bool find_in_range(
+        const abs_range_t& range, const std::string& value, lookup_match_t match, lookup_search_t search,
+        size_t& pos) const;
+
     /**
      * Session handler instance receives various events from the formula
      * interpretation run, in order to respond to those events.  This is
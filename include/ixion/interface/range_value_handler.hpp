@@ -0,0 +1,64 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_INTERFACE_RANGE_VALUE_HANDLER_HPP
+#define INCLUDED_IXION_INTERFACE_RANGE_VALUE_HANDLER_HPP
+
+#include "ixion/types.hpp"
+
+#include <string>
+
+namespace ixion {
+
+struct abs_address_t;
+
+namespace iface {
+
+/**
+ * Handler that receives the values of a range as they are read from the
+ * model storage.  The values are passed column by column, and from top to
+ * bottom within each column.  Consecutive cells of the same type may be
+ * passed in a single call when the storage permits it.  Formula cells pass
+ * their results.
+ *
+ * All callbacks do nothing by default, so that each handler only needs to
+ * override the ones it is interested in.
+ */
+class IXION_DLLPUBLIC range_value_handler
+{
+public:
+    virtual ~range_value_handler();
+
+    /**
+     * Receive consecutive numeric values in a column.
+     *
+     * @param pos position of the first cell.
+     * @param p pointer to the first value.
+     * @param n number of values, which is always greater than zero.
+     */
+    virtual void numeric(const abs_address_t& pos, const double* p, size_t n);
+
+    virtual void boolean(const abs_address_t& pos, bool val);
+
+    virtual void string(const abs_address_t& pos, const std::string& str);
+
+    virtual void error(const abs_address_t& pos, formula_error_t err);
+
+    /**
+     * Receive consecutive empty cells in a column.
+     *
+     * @param pos position of the first cell.
+     * @param n number of empty cells, which is always greater than zero.
+     */
+    virtual void empty(const abs_address_t& pos, size_t n);
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -74,6 +74,18 @@ public:
     void set(size_t row, size_t col, const std::string& str);
     void set(size_t row, size_t col, formula_error_t val);
 
+    /**
+     * Set an array of numeric values to consecutive elements of a column,
+     * starting at the specified position.  The values must not extend
+     * beyond the last row of the matrix.
+     *
+     * @param row row position of the first element.
+     * @param col column position of the elements.
+     * @param p pointer to the first value in the array.
+     * @param n number of values in the array.
+     */
+    void set(size_t row, size_t col, const double* p, size_t n);
+
     element get(size_t row, size_t col) const;
 
     size_t row_size() const;
@@ -110,8 +122,43 @@ public:
 
     size_t row_size() const;
     size_t col_size() const;
+
+    /**
+     * @return pointer to the first element of the underlying array.  The
+     *         elements are stored in column-major order.
+     */
+    double* data();
+
+    /**
+     * @return pointer to the first element of the underlying array.  The
+     *         elements are stored in column-major order.
+     */
+    const double* data() const;
 };
 
+/**
+ * Multiply two numeric matrices.  The multiplication is blocked so that the
+ * working set of the inner loops stays in cache, and the work can be split
+ * across multiple threads for large matrices.  The result is the same
+ * regardless of the number of threads used.
+ *
+ * @param left left-hand matrix.
+ * @param right right-hand matrix.  Its row size must equal the column size
+ *              of the left-hand matrix.
+ * @param thread_count maximum number of threads to use.  The calling thread
+ *                     does all the work when this is 0 or 1, when the
+ *                     matrices are too small to benefit from threads, or
+ *                     when called from a worker thread of a threaded
+ *                     calculation.
+ *
+ * @return product of the two matrices.
+ *
+ * @exception std::invalid_argument when the sizes of the matrices don't
+ *            allow multiplication.
+ */
+IXION_DLLPUBLIC numeric_matrix multiply(
+    const numeric_matrix& left, const numeric_matrix& right, size_t thread_count = 0);
+
 }
 
 #endif
@@ -105,6 +105,7 @@ public:
     virtual bool is_empty(const abs_address_t& addr) const override;
     virtual celltype_t get_celltype(const abs_address_t& addr) const override;
     virtual double get_numeric_value(const abs_address_t& addr) const override;
+    virtual formula_error_t get_numeric_value_or_error(const abs_address_t& addr, double& value) const override;
     virtual bool get_boolean_value(const abs_address_t& addr) const override;
     virtual string_id_t get_string_identifier(const abs_address_t& addr) const override;
     virtual const std::string* get_string_value(const abs_address_t& addr) const override;
@@ -114,9 +115,24 @@ public:
     virtual formula_result get_formula_result(const abs_address_t& addr) const override;
 
     virtual const named_expression_t* get_named_expression(sheet_t sheet, const std::string& name) const override;
+    virtual size_t get_named_expressions_revision() const override;
+    virtual void set_calc_thread_count(size_t thread_count) override;
+    virtual size_t get_calc_thread_count() const override;
 
     virtual double count_range(const abs_range_t& range, const values_t& values_type) const override;
+    virtual numeric_summary_t summarize_range(const abs_range_t& range) const override;
     virtual matrix get_range_value(const abs_range_t& range) const override;
+    virtual void walk_range(const abs_range_t& range, iface::range_value_handler& handler) const override;
+    virtual bool get_range_result(formula_function_t func, const abs_range_t& range, double& value) const override;
+    virtual void set_range_result(formula_function_t func, const abs_range_t& range, double value) override;
+    virtual bool is_range_result_unavailable(formula_function_t func, const abs_range_t& range) const override;
+    virtual void set_range_result_unavailable(formula_function_t func, const abs_range_t& range) override;
+    virtual bool find_in_range(
+        const abs_range_t& range, double value, lookup_match_t match, lookup_search_t search,
+        size_t& pos) const override;
+    virtual bool find_in_range(
+        const abs_range_t& range, const std::string& value, lookup_match_t match, lookup_search_t search,
+        size_t& pos) const override;
     virtual std::unique_ptr<iface::session_handler> create_session_handler() override;
     virtual iface::table_handler* get_table_handler() override;
     virtual const iface::table_handler* get_table_handler() const override;
@@ -153,7 +169,12 @@ public:
     void fill_down_cells(const abs_address_t& src, size_t n_dst);
 
     /**
-     * Set a formula cell at a specified address.
+     * Set a formula cell at a specified address.  The tokens get shared
+     * with any other formula cell previously set by this method with
+     * identical tokens, which is the case for the formula cells that have
+     * the same formula in R1C1 notation.  Each formula cell still has its
+     * own tokens store, and getting the tokens of the store for
+     * modification gives the cell its own copy of the tokens first.
      *
      * @param addr address at which to set a formula cell.
      * @param tokens formula tokens to put into the formula cell.
@@ -191,6 +212,29 @@ public:
 
     void set_grouped_formula_cells(const abs_range_t& group_range, formula_tokens_t tokens, formula_result result);
 
+    /**
+     * Convert each vertical run of adjacent formula cells that have the same
+     * formula in R1C1 notation into a group of formula cells, so that the
+     * run gets calculated in one go.  Only the runs whose formula consists
+     * of arithmetic and comparison operators on values and cell references,
+     * and doesn't refer to any cell of the run itself, get converted.
+     *
+     * The converted formula cells are unregistered, and each group gets
+     * registered in their place.  The cached results of the converted cells
+     * are discarded, so the returned groups need to be calculated again.
+     *
+     * @return ranges of the groups of formula cells that have been created.
+     */
+    abs_range_set_t compact_formula_groups();
+
+    /**
+     * Get the statistics of the formula tokens shared between the formula
+     * cells set with their own tokens.
+     *
+     * @return statistics of the shared formula tokens.
+     */
+    formula_tokens_sharing_t get_formula_tokens_sharing() const;
+
     abs_range_t get_data_range(sheet_t sheet) const;
 
     /**
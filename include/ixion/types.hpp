@@ -188,6 +188,7 @@ enum class formula_error_t : uint8_t
     name_not_found           = 4,
     no_range_intersection    = 5,
     invalid_value_type       = 6,
+    no_value_available       = 7,
 
     no_result_error          = 253, // internal only error
     stack_error              = 254, // internal only error
@@ -204,6 +205,21 @@ enum class formula_result_wait_policy_t
     throw_exception,
 };
 
+/**
+ * Type of policy on which formula cells to calculate first when more than
+ * one cell is ready to be calculated during multi-threaded calculation.
+ */
+enum class calc_priority_t
+{
+    /** Calculate the cells in the order they are sorted. */
+    sorted_order,
+    /**
+     * Calculate first the cells with the longest chain of dependent cells
+     * that follows them.
+     */
+    critical_path,
+};
+
 enum class formula_event_t
 {
     calculation_begins,
@@ -262,6 +278,88 @@ struct IXION_DLLPUBLIC formula_group_t
     formula_group_t& operator= (const formula_group_t& other);
 };
 
+/**
+ * This structure stores aggregate values of all numeric values found in a
+ * range of cells.  Boolean values are counted as numeric values of either
+ * 1 or 0.
+ */
+struct IXION_DLLPUBLIC numeric_summary_t
+{
+    /** Sum of all numeric values. */
+    double sum;
+    /** Smallest numeric value, or 0 if no numeric values are found. */
+    double min;
+    /** Largest numeric value, or 0 if no numeric values are found. */
+    double max;
+    /** Number of numeric values. */
+    size_t count;
+
+    numeric_summary_t();
+
+    /**
+     * Add an array of numeric values to the summary.
+     *
+     * @param p pointer to the first value.
+     * @param n number of values.
+     */
+    void add(const double* p, size_t n);
+
+    /**
+     * Add a single numeric value to the summary.
+     *
+     * @param v value to add.
+     */
+    void add(double v);
+
+    /**
+     * Merge another summary into this summary.
+     *
+     * @param other summary to merge.
+     */
+    void add(const numeric_summary_t& other);
+};
+
+/**
+ * Statistics of the formula tokens shared between formula cells that have
+ * been set with identical tokens.
+ */
+struct IXION_DLLPUBLIC formula_tokens_sharing_t
+{
+    /** Number of distinct sets of tokens in use by formula cells. */
+    size_t stores;
+    /** Number of formula cells that have reused a stored set of tokens. */
+    size_t reused;
+    /** Number of tokens discarded by reusing a stored set of tokens. */
+    size_t tokens_saved;
+
+    formula_tokens_sharing_t();
+};
+
+/**
+ * Type of match to look for when looking up a value in a range.
+ */
+enum class lookup_match_t
+{
+    /** Only match values that equal the lookup value. */
+    exact,
+    /** Match the largest value that is less than or equal to the lookup value. */
+    exact_or_smaller,
+    /** Match the smallest value that is greater than or equal to the lookup value. */
+    exact_or_larger,
+};
+
+/**
+ * Which cell to pick when multiple cells in a range equally match the
+ * lookup value.
+ */
+enum class lookup_search_t
+{
+    /** Pick the first matching cell. */
+    first,
+    /** Pick the last matching cell. */
+    last,
+};
+
 /**
  * Get a string representation of a formula error type.
  *
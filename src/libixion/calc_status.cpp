@@ -9,9 +9,12 @@
 
 namespace ixion {
 
-calc_status::calc_status() : result(nullptr), circular_safe(false), refcount(0) {}
+calc_status::calc_status() :
+    state(calc_state_t::not_started), waiters(0), result(nullptr), circular_safe(false), refcount(0) {}
+
 calc_status::calc_status(const rc_size_t& _group_size) :
-    result(nullptr), group_size(_group_size), circular_safe(false), refcount(0) {}
+    state(calc_state_t::not_started), waiters(0), result(nullptr),
+    group_size(_group_size), circular_safe(false), refcount(0) {}
 
 void calc_status::add_ref()
 {
@@ -24,6 +27,57 @@ void calc_status::release_ref()
         delete this;
 }
 
+bool calc_status::is_done() const
+{
+    return state.load(std::memory_order_acquire) == calc_state_t::done;
+}
+
+bool calc_status::begin_calc()
+{
+    calc_state_t expected = calc_state_t::not_started;
+    return state.compare_exchange_strong(expected, calc_state_t::running, std::memory_order_acq_rel);
+}
+
+void calc_status::end_calc(std::unique_ptr<formula_result> res)
+{
+    result = std::move(res);
+    state.store(calc_state_t::done);
+
+    if (waiters.load())
+    {
+        // Someone is waiting.  Taking the lock ensures that the waiting
+        // thread is either still before its check of the state or already
+        // asleep.
+        std::lock_guard<std::mutex> lock(mtx);
+        cond.notify_all();
+    }
+}
+
+void calc_status::set_result(std::unique_ptr<formula_result> res)
+{
+    end_calc(std::move(res));
+}
+
+void calc_status::wait_for_result()
+{
+    if (is_done())
+        return;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    ++waiters;
+
+    while (state.load() != calc_state_t::done)
+        cond.wait(lock);
+
+    --waiters;
+}
+
+void calc_status::reset()
+{
+    result.reset();
+    state.store(calc_state_t::not_started, std::memory_order_release);
+}
+
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -12,16 +12,34 @@
 
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
 #include <boost/intrusive_ptr.hpp>
 
 namespace ixion {
 
+enum class calc_state_t
+{
+    not_started = 0,
+    running,
+    done
+};
+
+/**
+ * Calculation status of a formula cell, shared among all cells of the same
+ * group.  The result is written only by the thread that has moved the
+ * state from not_started to running, and becomes visible to other threads
+ * once the state is set to done.  The mutex and the condition variable are
+ * only used by threads that need to wait for the result.
+ */
 struct calc_status
 {
     calc_status(const calc_status&) = delete;
     calc_status& operator=(const calc_status&) = delete;
 
+    std::atomic<calc_state_t> state;
+    std::atomic<size_t> waiters;
+
     std::mutex mtx;
     std::condition_variable cond;
     std::unique_ptr<formula_result> result;
@@ -36,6 +54,41 @@ struct calc_status
 
     void add_ref();
     void release_ref();
+
+    bool is_done() const;
+
+    /**
+     * Claim the calculation of the cell.
+     *
+     * @return true if the calling thread is to calculate the cell, or false
+     *         if the cell is already being calculated or has its result
+     *         available.
+     */
+    bool begin_calc();
+
+    /**
+     * Publish the result, and wake up the threads waiting for it.
+     *
+     * @param res result to publish.
+     */
+    void end_calc(std::unique_ptr<formula_result> res);
+
+    /**
+     * Set the result outside of calculation, and mark it available.
+     *
+     * @param res result to set.
+     */
+    void set_result(std::unique_ptr<formula_result> res);
+
+    /**
+     * Block until the result becomes available.
+     */
+    void wait_for_result();
+
+    /**
+     * Clear the result and bring the state back to not_started.
+     */
+    void reset();
 };
 
 inline void intrusive_ptr_add_ref(calc_status* p)
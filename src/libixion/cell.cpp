@@ -50,6 +50,29 @@ std::string gen_trace_output(const formula_cell& fc, const iface::formula_model_
 
 #endif
 
+/**
+ * Interpreter kept by each thread and reused across the cells it
+ * interprets, so that its buffers only get allocated once per thread.
+ */
+thread_local std::unique_ptr<formula_interpreter> tl_interpreter;
+
+/**
+ * Take the interpreter of the current thread for interpreting a cell.  A
+ * new one gets created when the thread has none for the model, or when it
+ * is already in use.
+ */
+std::unique_ptr<formula_interpreter> acquire_interpreter(
+    const formula_cell* cell, iface::formula_model_access& cxt)
+{
+    std::unique_ptr<formula_interpreter> fin = std::move(tl_interpreter);
+    if (fin && &fin->get_context() == &cxt)
+        fin->reset(cell);
+    else
+        fin = std::make_unique<formula_interpreter>(cell, cxt);
+
+    return fin;
+}
+
 }
 
 struct formula_cell::impl
@@ -70,18 +93,11 @@ struct formula_cell::impl
 
     /**
      * Block until the result becomes available.
-     *
-     * @param lock mutex lock associated with the result cache data.
      */
-    void wait_for_interpreted_result(std::unique_lock<std::mutex>& lock) const
+    void wait_for_interpreted_result() const
     {
         IXION_TRACE("Wait for the interpreted result");
-
-        while (!m_calc_status->result)
-        {
-            IXION_TRACE("Waiting...");
-            m_calc_status->cond.wait(lock);
-        }
+        m_calc_status->wait_for_result();
     }
 
     void reset_flag()
@@ -107,29 +123,38 @@ struct formula_cell::impl
             // Circular dependency detected !!
             IXION_DEBUG("Circular dependency detected !!");
             assert(!m_calc_status->result);
-            m_calc_status->result =
-                std::make_unique<formula_result>(formula_error_t::ref_result_not_available);
+            m_calc_status->set_result(
+                std::make_unique<formula_result>(formula_error_t::ref_result_not_available));
 
             return false;
         }
         return true;
     }
 
-    void check_calc_status_or_throw() const
+    formula_error_t get_calc_status_error() const
     {
-        if (!m_calc_status->result)
+        if (!m_calc_status->is_done())
         {
             // Result not cached yet.  Reference error.
             IXION_DEBUG("Result not cached yet. This is a reference error.");
-            throw formula_error(formula_error_t::ref_result_not_available);
+            return formula_error_t::ref_result_not_available;
         }
 
         if (m_calc_status->result->get_type() == formula_result::result_type::error)
         {
             // Error condition.
             IXION_DEBUG("Error in result.");
-            throw formula_error(m_calc_status->result->get_error());
+            return m_calc_status->result->get_error();
         }
+
+        return formula_error_t::no_error;
+    }
+
+    void check_calc_status_or_throw() const
+    {
+        formula_error_t err = get_calc_status_error();
+        if (err != formula_error_t::no_error)
+            throw formula_error(err);
     }
 
     double fetch_value_from_result() const
@@ -312,11 +337,12 @@ struct formula_cell::impl
                     throw std::logic_error("setting a cached result of matrix value directly is not yet supported.");
             }
 
+            m_calc_status->state.store(calc_state_t::done);
+            m_calc_status->cond.notify_all();
             return;
         }
 
-        std::unique_lock<std::mutex> lock(m_calc_status->mtx);
-        m_calc_status->result = std::make_unique<formula_result>(std::move(result));
+        m_calc_status->set_result(std::make_unique<formula_result>(std::move(result)));
     }
 };
 
@@ -347,17 +373,27 @@ void formula_cell::set_tokens(const formula_tokens_store_ptr_t& tokens)
 
 double formula_cell::get_value(formula_result_wait_policy_t policy) const
 {
-    std::unique_lock<std::mutex> lock(mp_impl->m_calc_status->mtx);
     if (policy == formula_result_wait_policy_t::block_until_done)
-        mp_impl->wait_for_interpreted_result(lock);
+        mp_impl->wait_for_interpreted_result();
     return mp_impl->fetch_value_from_result();
 }
 
+formula_error_t formula_cell::get_value_or_error(formula_result_wait_policy_t policy, double& value) const
+{
+    if (policy == formula_result_wait_policy_t::block_until_done)
+        mp_impl->wait_for_interpreted_result();
+
+    formula_error_t err = mp_impl->get_calc_status_error();
+    if (err == formula_error_t::no_error)
+        value = mp_impl->fetch_value_from_result();
+
+    return err;
+}
+
 const std::string* formula_cell::get_string(formula_result_wait_policy_t policy) const
 {
-    std::unique_lock<std::mutex> lock(mp_impl->m_calc_status->mtx);
     if (policy == formula_result_wait_policy_t::block_until_done)
-        mp_impl->wait_for_interpreted_result(lock);
+        mp_impl->wait_for_interpreted_result();
     return mp_impl->fetch_string_from_result();
 }
 
@@ -370,43 +406,52 @@ void formula_cell::interpret(iface::formula_model_access& context, const abs_add
 
     calc_status& status = *mp_impl->m_calc_status;
 
+    if (!status.begin_calc())
     {
-        std::lock_guard<std::mutex> lock(status.mtx);
-
-        if (mp_impl->m_calc_status->result)
+        // When the result is already cached before the cell is interpreted,
+        // it can mean the cell has circular dependency.
+        if (status.is_done() && status.result->get_type() == formula_result::result_type::error)
         {
-            // When the result is already cached before the cell is interpreted,
-            // it can mean the cell has circular dependency.
-            if (status.result->get_type() == formula_result::result_type::error)
+            auto handler = context.create_session_handler();
+            if (handler)
             {
-                auto handler = context.create_session_handler();
-                if (handler)
-                {
-                    handler->begin_cell_interpret(pos);
-                    const char* msg = get_formula_error_name(status.result->get_error());
-                    handler->set_formula_error(msg);
-                    handler->end_cell_interpret();
-                }
+                handler->begin_cell_interpret(pos);
+                const char* msg = get_formula_error_name(status.result->get_error());
+                handler->set_formula_error(msg);
+                handler->end_cell_interpret();
             }
-            return;
         }
+        return;
+    }
+
+    // The result is not visible to other threads until it gets published,
+    // so there is no need to hold the lock during the interpretation.
+    std::unique_ptr<formula_interpreter> fin = acquire_interpreter(this, context);
+    fin->set_origin(pos);
+    auto result = std::make_unique<formula_result>();
 
-        formula_interpreter fin(this, context);
-        fin.set_origin(pos);
-        status.result = std::make_unique<formula_result>();
-        if (fin.interpret())
+    try
+    {
+        if (fin->interpret())
         {
             // Successful interpretation.
-            *status.result = fin.transfer_result();
+            *result = fin->transfer_result();
         }
         else
         {
             // Interpretation ended with an error condition.
-            status.result->set_error(fin.get_error());
+            result->set_error(fin->get_error());
         }
     }
+    catch (...)
+    {
+        // Don't leave other threads waiting for the result forever.
+        status.end_calc(std::move(result));
+        throw;
+    }
 
-    status.cond.notify_all();
+    status.end_calc(std::move(result));
+    tl_interpreter = std::move(fin);
 }
 
 void formula_cell::check_circular(const iface::formula_model_access& cxt, const abs_address_t& pos)
@@ -479,8 +524,7 @@ void formula_cell::check_circular(const iface::formula_model_access& cxt, const
 
 void formula_cell::reset()
 {
-    std::lock_guard<std::mutex> lock(mp_impl->m_calc_status->mtx);
-    mp_impl->m_calc_status->result.reset();
+    mp_impl->m_calc_status->reset();
     mp_impl->reset_flag();
 }
 
@@ -524,12 +568,10 @@ std::vector<const formula_token*> formula_cell::get_ref_tokens(
 
 const formula_result& formula_cell::get_raw_result_cache(formula_result_wait_policy_t policy) const
 {
-    std::unique_lock<std::mutex> lock(mp_impl->m_calc_status->mtx);
-
     if (policy == formula_result_wait_policy_t::block_until_done)
-        mp_impl->wait_for_interpreted_result(lock);
+        mp_impl->wait_for_interpreted_result();
 
-    if (!mp_impl->m_calc_status->result)
+    if (!mp_impl->m_calc_status->is_done())
     {
         IXION_DEBUG("Result not yet available.");
         throw formula_error(formula_error_t::ref_result_not_available);
@@ -8,13 +8,19 @@
 #include "cell_queue_manager.hpp"
 #include "queue_entry.hpp"
 #include "ixion/cell.hpp"
+#include "ixion/dirty_cell_tracker.hpp"
+#include "ixion/formula_tokens.hpp"
+#include "ixion/config.hpp"
 
 #include "ixion/interface/formula_model_access.hpp"
 
+#include "thread_pool.hpp"
+
 #include <cassert>
-#include <queue>
-#include <future>
+#include <atomic>
+#include <unordered_map>
 #include <algorithm>
+#include <exception>
 
 #if !IXION_THREADS
 #error "This file is not to be compiled when the threads are disabled."
@@ -24,113 +30,284 @@ namespace ixion {
 
 namespace {
 
-class scoped_guard
-{
-    std::thread m_thread;
-public:
-    scoped_guard(std::thread thread) : m_thread(std::move(thread)) {}
-    scoped_guard(scoped_guard&& other) : m_thread(std::move(other.m_thread)) {}
-
-    scoped_guard(const scoped_guard&) = delete;
-    scoped_guard& operator= (const scoped_guard&) = delete;
+/**
+ * Upper limit of the estimated cost of a single chunk of cells.  Cells are
+ * batched into chunks so that cheap cells don't pay the dispatch cost one
+ * by one.
+ */
+constexpr size_t max_chunk_cost = 256;
 
-    ~scoped_guard()
-    {
-        m_thread.join();
-    }
-};
+}
 
-class interpreter_queue
+struct formula_cell_queue::impl
 {
-    using future_type = std::future<void>;
-
     iface::formula_model_access& m_context;
+    std::vector<queue_entry> m_cells;
+    size_t m_thread_count;
 
-    std::queue<future_type> m_futures;
-    std::mutex m_mtx;
-    std::condition_variable m_cond;
+    /** Dependent cells of each cell, stored as positions in m_cells. */
+    std::vector<std::vector<size_t>> m_dependents;
 
-    size_t m_max_queue;
+    /** Number of precedent cells of each cell. */
+    std::vector<size_t> m_precedent_counts;
 
-    void interpret(formula_cell* p, const abs_address_t& pos)
-    {
-        p->interpret(m_context, pos);
-    }
+    /**
+     * Chunks of cells that get dispatched as single tasks.  Cells in the
+     * same chunk are at the same topological level, hence independent of
+     * each other.
+     */
+    std::vector<std::vector<size_t>> m_chunks;
 
-public:
-    interpreter_queue(iface::formula_model_access& cxt, size_t max_queue) :
-        m_context(cxt), m_max_queue(max_queue) {}
+    /** Chunk that each cell belongs to. */
+    std::vector<size_t> m_cell_chunks;
+
+    /** Number of precedent cells yet to be calculated for each chunk. */
+    std::vector<std::atomic<size_t>> m_pending;
 
     /**
-     * Push one formula cell to the interpreter queue for future
-     * intepretation.
-     *
-     * @param p pointer to formula cell instance.
-     * @param pos position of the formual cell.
+     * Estimated cost of the longest chain of cells that starts at each
+     * chunk.  It's empty unless the chunks get prioritized.
      */
-    void push(formula_cell* p, const abs_address_t& pos)
-    {
-        std::unique_lock<std::mutex> lock(m_mtx);
+    std::vector<size_t> m_priorities;
 
-        while (m_futures.size() >= m_max_queue)
-            m_cond.wait(lock);
-
-        future_type f = std::async(
-            std::launch::async, &interpreter_queue::interpret, this, p, pos);
-        m_futures.push(std::move(f));
-        lock.unlock();
+    impl(iface::formula_model_access& cxt, std::vector<queue_entry>&& cells, size_t thread_count) :
+        m_context(cxt),
+        m_cells(std::move(cells)),
+        m_thread_count(thread_count),
+        m_dependents(m_cells.size()),
+        m_precedent_counts(m_cells.size(), 0),
+        m_cell_chunks(m_cells.size(), 0)
+    {
+        build_graph();
+        build_chunks();
 
-        m_cond.notify_one();
+        if (m_context.get_config().calc_priority == calc_priority_t::critical_path)
+            compute_priorities();
     }
 
     /**
-     * Wait for one formula cell to finish its interpretation.
+     * Estimate the cost of calculating a cell by its number of formula
+     * tokens.
      */
-    void wait_one()
+    size_t cell_cost(size_t i) const
     {
-        std::unique_lock<std::mutex> lock(m_mtx);
-
-        while (m_futures.empty())
-            m_cond.wait(lock);
-
-        future_type ret = std::move(m_futures.front());
-        m_futures.pop();
-        lock.unlock();
+        const formula_tokens_store_ptr_t& ts = m_cells[i].p->get_tokens();
+        size_t cost = ts ? ts->get().size() : 1;
+        return std::max<size_t>(cost, 1);
+    }
 
-        ret.get();  // This may throw if an exception was thrown on the thread.
+    /**
+     * Build the precedent-dependent relationships among the cells to be
+     * calculated, using the relationships stored in the dirty cell tracker.
+     * Only the relationships that agree with the order of the cells are
+     * kept, which also discards those that form circular dependencies.
+     */
+    void build_graph()
+    {
+        using index_map_type = std::unordered_map<abs_range_t, size_t, abs_range_t::hash>;
+
+        index_map_type cell_index;
+        std::vector<abs_range_t> ranges;
+        ranges.reserve(m_cells.size());
+
+        for (size_t i = 0; i < m_cells.size(); ++i)
+        {
+            const queue_entry& e = m_cells[i];
+
+            // Grouped formula cells are tracked as a whole range.
+            abs_range_t range = e.pos;
+            formula_group_t fg_props = e.p->get_group_properties();
+            if (fg_props.grouped)
+            {
+                range.last.column += fg_props.size.column - 1;
+                range.last.row += fg_props.size.row - 1;
+            }
+
+            cell_index.emplace(range, i);
+            ranges.push_back(range);
+        }
+
+        const dirty_cell_tracker& tracker = m_context.get_cell_tracker();
+
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            for (const abs_range_t& dep : tracker.query_direct_dependents(ranges[i]))
+            {
+                auto it = cell_index.find(dep);
+                if (it == cell_index.end() || it->second <= i)
+                    continue;
+
+                m_dependents[i].push_back(it->second);
+                ++m_precedent_counts[it->second];
+            }
+        }
+    }
 
-        m_cond.notify_one();
+    /**
+     * Group the cells at the same topological level into chunks.  The
+     * chunk size adapts to the total cost of each level so that each level
+     * still gets spread over all threads.
+     */
+    void build_chunks()
+    {
+        // Since all dependents of a cell come after it, a single forward
+        // pass is enough to determine the levels.
+        std::vector<size_t> levels(m_cells.size(), 0);
+        size_t max_level = 0;
+
+        for (size_t i = 0; i < m_cells.size(); ++i)
+        {
+            for (size_t dep : m_dependents[i])
+                levels[dep] = std::max(levels[dep], levels[i] + 1);
+
+            max_level = std::max(max_level, levels[i]);
+        }
+
+        std::vector<std::vector<size_t>> cells_by_level(m_cells.empty() ? 0 : max_level + 1);
+        for (size_t i = 0; i < m_cells.size(); ++i)
+            cells_by_level[levels[i]].push_back(i);
+
+        for (const std::vector<size_t>& cells : cells_by_level)
+        {
+            size_t level_cost = 0;
+            for (size_t i : cells)
+                level_cost += cell_cost(i);
+
+            size_t target_cost = level_cost / m_thread_count;
+            target_cost = std::max<size_t>(std::min(target_cost, max_chunk_cost), 1);
+
+            // Start a new chunk at the first cell of each level.
+            size_t chunk_cost = target_cost;
+
+            for (size_t i : cells)
+            {
+                if (chunk_cost >= target_cost)
+                {
+                    m_chunks.emplace_back();
+                    chunk_cost = 0;
+                }
+
+                m_chunks.back().push_back(i);
+                m_cell_chunks[i] = m_chunks.size() - 1;
+                chunk_cost += cell_cost(i);
+            }
+        }
+
+        std::vector<std::atomic<size_t>> pending(m_chunks.size());
+        for (size_t i = 0; i < m_cells.size(); ++i)
+            pending[m_cell_chunks[i]] += m_precedent_counts[i];
+
+        m_pending.swap(pending);
     }
-};
 
-}
+    /**
+     * Compute the cost of the longest chain of dependent cells for each
+     * chunk.  Since all dependents of a cell come after it, a single
+     * backward pass is enough.
+     */
+    void compute_priorities()
+    {
+        std::vector<size_t> cell_priorities(m_cells.size(), 0);
+
+        for (size_t i = m_cells.size(); i-- > 0; )
+        {
+            size_t chain = 0;
+            for (size_t dep : m_dependents[i])
+                chain = std::max(chain, cell_priorities[dep]);
+
+            cell_priorities[i] = chain + cell_cost(i);
+        }
+
+        m_priorities.assign(m_chunks.size(), 0);
+        for (size_t i = 0; i < m_cells.size(); ++i)
+        {
+            size_t& priority = m_priorities[m_cell_chunks[i]];
+            priority = std::max(priority, cell_priorities[i]);
+        }
+    }
 
-struct formula_cell_queue::impl
-{
-    iface::formula_model_access& m_context;
-    std::vector<queue_entry> m_cells;
-    size_t m_thread_count;
+    /**
+     * Sort the chunks in descending order of priority.  It's a no-op when
+     * the chunks are not prioritized.
+     */
+    void sort_by_priority(std::vector<size_t>& chunks) const
+    {
+        if (m_priorities.empty())
+            return;
+
+        std::stable_sort(chunks.begin(), chunks.end(),
+            [this](size_t left, size_t right)
+            {
+                return m_priorities[left] > m_priorities[right];
+            }
+        );
+    }
 
-    impl(iface::formula_model_access& cxt, std::vector<queue_entry>&& cells, size_t thread_count) :
-        m_context(cxt),
-        m_cells(cells),
-        m_thread_count(thread_count) {}
+    void interpret(thread_pool& pool, size_t chunk)
+    {
+        std::exception_ptr ex;
+
+        for (size_t i : m_chunks[chunk])
+        {
+            try
+            {
+                queue_entry& e = m_cells[i];
+                e.p->interpret(m_context, e.pos);
+            }
+            catch (...)
+            {
+                if (!ex)
+                    ex = std::current_exception();
+            }
+        }
+
+        release_dependents(pool, chunk);
+
+        if (ex)
+            std::rethrow_exception(ex);
+    }
 
-    void thread_launch(interpreter_queue* queue)
+    void release_dependents(thread_pool& pool, size_t chunk)
     {
-        for (queue_entry& e : m_cells)
-            queue->push(e.p, e.pos);
+        std::vector<size_t> ready;
+
+        for (size_t i : m_chunks[chunk])
+        {
+            for (size_t dep : m_dependents[i])
+            {
+                size_t dep_chunk = m_cell_chunks[dep];
+                if (m_pending[dep_chunk].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    // All precedents of this chunk are done.
+                    ready.push_back(dep_chunk);
+            }
+        }
+
+        // Each queued chunk goes in front of the previously queued ones, so
+        // queue the most important chunk last.
+        sort_by_priority(ready);
+        for (auto it = ready.rbegin(); it != ready.rend(); ++it)
+            pool.queue(*it);
     }
 
     void run()
     {
-        interpreter_queue queue(m_context, m_thread_count);
-
-        std::thread t(&formula_cell_queue::impl::thread_launch, this, &queue);
-        scoped_guard guard(std::move(t));
-
-        for (size_t i = 0, n = m_cells.size(); i < n; ++i)
-            queue.wait_one();
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < m_pending.size(); ++i)
+        {
+            if (!m_pending[i].load(std::memory_order_relaxed))
+                ready.push_back(i);
+        }
+
+        sort_by_priority(ready);
+
+        thread_pool& pool = thread_pool::get(m_thread_count);
+
+        pool.run(m_chunks.size(), ready,
+            [this, &pool](size_t i)
+            {
+                interpret(pool, i);
+            }
+        );
     }
 };
 
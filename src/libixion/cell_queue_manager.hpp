@@ -25,7 +25,9 @@ class formula_model_access;
 }
 
 /**
- * Class that manages multi-threaded calculation of formula cells.
+ * Class that manages multi-threaded calculation of formula cells.  Each
+ * cell gets dispatched only after all of its precedent cells, as recorded
+ * in the dirty cell tracker, have been calculated.
  */
 class formula_cell_queue
 {
@@ -0,0 +1,135 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "column_summary_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace ixion { namespace detail {
+
+column_summary_index::column_summary_index(const column_store_t& column) :
+    m_column(column),
+    m_chunk_count((column.size() + chunk_size - 1) / chunk_size),
+    m_leaf_offset(1)
+{
+    while (m_leaf_offset < m_chunk_count)
+        m_leaf_offset *= 2;
+
+    m_tree.resize(m_leaf_offset * 2);
+
+    for (size_t i = 0; i < m_chunk_count; ++i)
+        m_tree[m_leaf_offset + i] = summarize_chunk(i);
+
+    for (size_t i = m_leaf_offset - 1; i > 0; --i)
+    {
+        m_tree[i] = m_tree[i*2];
+        m_tree[i].add(m_tree[i*2+1]);
+    }
+}
+
+numeric_summary_t column_summary_index::summarize_cells(size_t row1, size_t row2) const
+{
+    numeric_summary_t ret;
+
+    column_store_t::const_position_type pos = m_column.position(row1);
+    column_store_t::const_iterator itb = pos.first;
+    column_store_t::const_iterator itb_end = m_column.end();
+    size_t offset = pos.second;
+    size_t row = row1;
+
+    for (; itb != itb_end && row <= row2; ++itb, offset = 0)
+    {
+        size_t len = std::min<size_t>(itb->size - offset, row2 - row + 1);
+        row += len;
+
+        switch (itb->type)
+        {
+            case element_type_numeric:
+                ret.add(&numeric_element_block::at(*itb->data, offset), len);
+                break;
+            case element_type_boolean:
+            {
+                auto it = boolean_element_block::cbegin(*itb->data);
+                std::advance(it, offset);
+                for (auto it_end = it + len; it != it_end; ++it)
+                    ret.add(*it ? 1.0 : 0.0);
+                break;
+            }
+            default:
+                ;
+        }
+    }
+
+    return ret;
+}
+
+numeric_summary_t column_summary_index::summarize_chunk(size_t chunk) const
+{
+    size_t row1 = chunk * chunk_size;
+    size_t row2 = std::min(row1 + chunk_size, m_column.size()) - 1;
+    return summarize_cells(row1, row2);
+}
+
+void column_summary_index::update(size_t row)
+{
+    assert(m_column.size() <= m_chunk_count * chunk_size);
+
+    size_t chunk = row / chunk_size;
+    size_t i = m_leaf_offset + chunk;
+    m_tree[i] = summarize_chunk(chunk);
+
+    for (i /= 2; i > 0; i /= 2)
+    {
+        m_tree[i] = m_tree[i*2];
+        m_tree[i].add(m_tree[i*2+1]);
+    }
+}
+
+numeric_summary_t column_summary_index::query(size_t row1, size_t row2) const
+{
+    assert(row1 <= row2 && row2 < m_column.size());
+
+    size_t chunk1 = row1 / chunk_size;
+    size_t chunk2 = row2 / chunk_size;
+
+    if (chunk1 == chunk2)
+        return summarize_cells(row1, row2);
+
+    numeric_summary_t ret;
+
+    // Scan the partially covered chunks at both ends.
+    if (row1 % chunk_size)
+    {
+        ret.add(summarize_cells(row1, (chunk1 + 1) * chunk_size - 1));
+        ++chunk1;
+    }
+
+    if (row2 % chunk_size != chunk_size - 1 && row2 != m_column.size() - 1)
+    {
+        ret.add(summarize_cells(chunk2 * chunk_size, row2));
+        --chunk2;
+    }
+
+    // Combine the fully covered chunks in [chunk1, chunk2].
+    size_t lo = m_leaf_offset + chunk1;
+    size_t hi = m_leaf_offset + chunk2 + 1;
+
+    for (; lo < hi; lo /= 2, hi /= 2)
+    {
+        if (lo & 1)
+            ret.add(m_tree[lo++]);
+        if (hi & 1)
+            ret.add(m_tree[--hi]);
+    }
+
+    return ret;
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
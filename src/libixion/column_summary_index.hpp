@@ -0,0 +1,76 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_COLUMN_SUMMARY_INDEX_HPP
+#define INCLUDED_IXION_COLUMN_SUMMARY_INDEX_HPP
+
+#include "ixion/types.hpp"
+#include "column_store_type.hpp"
+
+#include <vector>
+
+namespace ixion { namespace detail {
+
+/**
+ * Index of the aggregate values of the numeric and boolean cells in a
+ * column, for summarizing large row intervals without visiting each cell.
+ * The rows are divided into chunks of a fixed size, and the summary of each
+ * chunk is stored in a segment tree.  A row interval is summarized by
+ * scanning the cells of the partially covered chunks at both ends, and
+ * combining the summaries of the fully covered chunks in between in
+ * logarithmic time.
+ *
+ * Formula cells are not covered by the index, since their results change
+ * during calculation.
+ */
+class column_summary_index
+{
+    const column_store_t& m_column;
+    size_t m_chunk_count;
+    size_t m_leaf_offset;
+
+    /** Segment tree whose leaves store the summaries of the chunks. */
+    std::vector<numeric_summary_t> m_tree;
+
+    numeric_summary_t summarize_cells(size_t row1, size_t row2) const;
+    numeric_summary_t summarize_chunk(size_t chunk) const;
+
+public:
+    /** Number of rows in each chunk. */
+    static constexpr size_t chunk_size = 1024;
+
+    /**
+     * Build an index for a column.
+     *
+     * @param column column to index.  It must outlive the index.
+     */
+    column_summary_index(const column_store_t& column);
+
+    /**
+     * Update the index after the value of a cell has changed.  The number
+     * of rows in the column must not change.
+     *
+     * @param row row position of the cell.
+     */
+    void update(size_t row);
+
+    /**
+     * Summarize the numeric and boolean cells in a row interval.
+     *
+     * @param row1 first row of the interval.
+     * @param row2 last row of the interval.
+     *
+     * @return summary of the numeric and boolean values in the interval.
+     */
+    numeric_summary_t query(size_t row1, size_t row2) const;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
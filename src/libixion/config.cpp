@@ -13,14 +13,18 @@ config::config() :
     sep_function_arg(','),
     sep_matrix_column(','),
     sep_matrix_row(';'),
-    output_precision(-1)
+    output_precision(-1),
+    calc_priority(calc_priority_t::sorted_order),
+    min_cells_for_threads(64)
 {}
 
 config::config(const config& r) :
     sep_function_arg(r.sep_function_arg),
     sep_matrix_column(r.sep_matrix_column),
     sep_matrix_row(r.sep_matrix_row),
-    output_precision(r.output_precision) {}
+    output_precision(r.output_precision),
+    calc_priority(r.calc_priority),
+    min_cells_for_threads(r.min_cells_for_threads) {}
 
 }
 
@@ -0,0 +1,440 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "criteria.hpp"
+#include "range_view.hpp"
+
+#include "ixion/address.hpp"
+#include "ixion/exceptions.hpp"
+#include "ixion/interface/range_value_handler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+char to_lower(char c)
+{
+    return std::tolower(static_cast<unsigned char>(c));
+}
+
+std::string to_lower(const std::string& str)
+{
+    std::string ret = str;
+    std::transform(ret.begin(), ret.end(), ret.begin(), [](char c) { return to_lower(c); });
+    return ret;
+}
+
+/**
+ * Convert a criterion operand to a number.  Only a plain decimal number
+ * with an optional sign and exponent qualifies; std::strtod alone would
+ * also accept leading white spaces, hexadecimal numbers, infinity and NaN.
+ *
+ * @param str operand to convert.
+ * @param value converted number, set only on success.
+ *
+ * @return true if the operand has been converted, false otherwise.
+ */
+bool to_decimal(const std::string& str, double& value)
+{
+    if (str.empty())
+        return false;
+
+    for (char c : str)
+    {
+        bool valid = std::isdigit(static_cast<unsigned char>(c)) ||
+            c == '.' || c == '+' || c == '-' || c == 'e' || c == 'E';
+
+        if (!valid)
+            return false;
+    }
+
+    const char* p = str.c_str();
+    char* p_end = nullptr;
+    double v = std::strtod(p, &p_end);
+    if (p_end != p + str.size() || !std::isfinite(v))
+        return false;
+
+    value = v;
+    return true;
+}
+
+/**
+ * Clear the flag of each value that fails a predicate.  The loop has no
+ * branches nor dependencies between iterations, so that the compiler can
+ * vectorize it.
+ */
+template<typename Pred>
+void match_values(const double* p, size_t n, char* flags, Pred pred)
+{
+    for (size_t i = 0; i < n; ++i)
+        flags[i] &= pred(p[i]);
+}
+
+class mask_builder : public iface::range_value_handler
+{
+    const criterion& m_criterion;
+    char* mp_flags;
+    abs_address_t m_origin;
+    size_t m_rows;
+
+    char* get_dest(const abs_address_t& pos) const
+    {
+        return mp_flags + m_rows * (pos.column - m_origin.column) + pos.row - m_origin.row;
+    }
+
+public:
+    mask_builder(const criterion& crit, char* flags, const abs_address_t& origin, size_t rows) :
+        m_criterion(crit), mp_flags(flags), m_origin(origin), m_rows(rows) {}
+
+    virtual void numeric(const abs_address_t& pos, const double* p, size_t n) override
+    {
+        m_criterion.match(p, n, get_dest(pos));
+    }
+
+    virtual void boolean(const abs_address_t& pos, bool val) override
+    {
+        *get_dest(pos) &= m_criterion.match(val);
+    }
+
+    virtual void string(const abs_address_t& pos, const std::string& str) override
+    {
+        *get_dest(pos) &= m_criterion.match(str);
+    }
+
+    virtual void error(const abs_address_t& pos, formula_error_t /*err*/) override
+    {
+        *get_dest(pos) &= m_criterion.match_error();
+    }
+
+    virtual void empty(const abs_address_t& pos, size_t n) override
+    {
+        if (!m_criterion.match_empty())
+            std::fill_n(get_dest(pos), n, 0);
+    }
+};
+
+class masked_summer : public iface::range_value_handler
+{
+    const char* mp_flags;
+    abs_address_t m_origin;
+    size_t m_rows;
+    double m_sum;
+    size_t m_count;
+
+    const char* get_flags(const abs_address_t& pos) const
+    {
+        return mp_flags + m_rows * (pos.column - m_origin.column) + pos.row - m_origin.row;
+    }
+
+public:
+    masked_summer(const char* flags, const abs_address_t& origin, size_t rows) :
+        mp_flags(flags), m_origin(origin), m_rows(rows), m_sum(0.0), m_count(0) {}
+
+    virtual void numeric(const abs_address_t& pos, const double* p, size_t n) override
+    {
+        const char* flags = get_flags(pos);
+
+        double sum = 0.0;
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            sum += flags[i] ? p[i] : 0.0;
+            count += flags[i];
+        }
+
+        m_sum += sum;
+        m_count += count;
+    }
+
+    virtual void error(const abs_address_t& pos, formula_error_t err) override
+    {
+        if (*get_flags(pos))
+            throw formula_error(err);
+    }
+
+    double get_sum() const { return m_sum; }
+    size_t get_count() const { return m_count; }
+};
+
+}
+
+criterion::criterion(double val) :
+    m_op(op_t::equal), m_type(operand_t::numeric), m_value(val), m_wildcard(false)
+{
+}
+
+criterion::criterion(const std::string& str) :
+    m_op(op_t::equal), m_type(operand_t::string), m_value(0.0), m_wildcard(false)
+{
+    struct prefix { const char* str; op_t op; };
+
+    // Longer operators must come before their own prefixes.
+    static const prefix prefixes[] = {
+        { ">=", op_t::greater_equal },
+        { "<=", op_t::less_equal },
+        { "<>", op_t::not_equal },
+        { ">", op_t::greater },
+        { "<", op_t::less },
+        { "=", op_t::equal },
+    };
+
+    size_t pos = 0;
+    for (const prefix& pf : prefixes)
+    {
+        size_t n = std::strlen(pf.str);
+        if (!str.compare(0, n, pf.str))
+        {
+            m_op = pf.op;
+            pos = n;
+            break;
+        }
+    }
+
+    std::string operand = str.substr(pos);
+
+    double v = 0.0;
+    if (to_decimal(operand, v))
+    {
+        m_type = operand_t::numeric;
+        m_value = v;
+        return;
+    }
+
+    m_str = to_lower(operand);
+
+    if (m_str == "true" || m_str == "false")
+    {
+        m_type = operand_t::boolean;
+        m_value = m_str == "true" ? 1.0 : 0.0;
+        return;
+    }
+
+    if (m_op == op_t::equal || m_op == op_t::not_equal)
+        m_wildcard = m_str.find_first_of("*?~") != std::string::npos;
+}
+
+bool criterion::compare(int cmp) const
+{
+    switch (m_op)
+    {
+        case op_t::equal:
+            return cmp == 0;
+        case op_t::not_equal:
+            return cmp != 0;
+        case op_t::less:
+            return cmp < 0;
+        case op_t::less_equal:
+            return cmp <= 0;
+        case op_t::greater:
+            return cmp > 0;
+        case op_t::greater_equal:
+            return cmp >= 0;
+    }
+
+    return false;
+}
+
+bool criterion::match_pattern(const std::string& str) const
+{
+    const std::string& pat = m_str;
+    size_t n = str.size(), m = pat.size();
+
+    if (!m_wildcard)
+    {
+        if (n != m)
+            return false;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (to_lower(str[i]) != pat[i])
+                return false;
+        }
+
+        return true;
+    }
+
+    // Position in the pattern right after the last *, and the position in
+    // the string it has been matched up to, for backtracking.
+    size_t star_p = std::string::npos, star_s = 0;
+    size_t s = 0, p = 0;
+
+    while (s < n)
+    {
+        if (p < m)
+        {
+            char c = pat[p];
+            if (c == '*')
+            {
+                star_p = ++p;
+                star_s = s;
+                continue;
+            }
+
+            if (c == '~' && p + 1 < m)
+            {
+                // escaped wildcard character.
+                if (pat[p+1] == to_lower(str[s]))
+                {
+                    p += 2;
+                    ++s;
+                    continue;
+                }
+            }
+            else if (c == '?' || c == to_lower(str[s]))
+            {
+                ++p;
+                ++s;
+                continue;
+            }
+        }
+
+        if (star_p == std::string::npos)
+            return false;
+
+        // Let the last * absorb one more character, and retry.
+        p = star_p;
+        s = ++star_s;
+    }
+
+    while (p < m && pat[p] == '*')
+        ++p;
+
+    return p == m;
+}
+
+bool criterion::match(double val) const
+{
+    if (m_type != operand_t::numeric)
+        return m_op == op_t::not_equal;
+
+    return compare(val < m_value ? -1 : (val > m_value ? 1 : 0));
+}
+
+bool criterion::match(bool val) const
+{
+    if (m_type != operand_t::boolean)
+        return m_op == op_t::not_equal;
+
+    double v = val ? 1.0 : 0.0;
+    return compare(v < m_value ? -1 : (v > m_value ? 1 : 0));
+}
+
+bool criterion::match(const std::string& str) const
+{
+    if (m_type != operand_t::string)
+        return m_op == op_t::not_equal;
+
+    switch (m_op)
+    {
+        case op_t::equal:
+            return match_pattern(str);
+        case op_t::not_equal:
+            return !match_pattern(str);
+        default:
+            ;
+    }
+
+    return compare(to_lower(str).compare(m_str));
+}
+
+bool criterion::match_empty() const
+{
+    if (m_type == operand_t::string && m_str.empty())
+        // "=" or an empty criterion matches empty cells, while "<>" matches
+        // all non-empty cells.
+        return m_op == op_t::equal;
+
+    return m_op == op_t::not_equal;
+}
+
+bool criterion::match_error() const
+{
+    return m_op == op_t::not_equal;
+}
+
+void criterion::match(const double* p, size_t n, char* flags) const
+{
+    if (m_type != operand_t::numeric)
+    {
+        if (m_op != op_t::not_equal)
+            std::fill_n(flags, n, 0);
+        return;
+    }
+
+    double v = m_value;
+
+    switch (m_op)
+    {
+        case op_t::equal:
+            match_values(p, n, flags, [v](double x) { return x == v; });
+            break;
+        case op_t::not_equal:
+            match_values(p, n, flags, [v](double x) { return x != v; });
+            break;
+        case op_t::less:
+            match_values(p, n, flags, [v](double x) { return x < v; });
+            break;
+        case op_t::less_equal:
+            match_values(p, n, flags, [v](double x) { return x <= v; });
+            break;
+        case op_t::greater:
+            match_values(p, n, flags, [v](double x) { return x > v; });
+            break;
+        case op_t::greater_equal:
+            match_values(p, n, flags, [v](double x) { return x >= v; });
+            break;
+    }
+}
+
+criteria_mask::criteria_mask(size_t rows, size_t cols) :
+    m_rows(rows), m_cols(cols), m_flags(rows * cols, 1)
+{
+}
+
+size_t criteria_mask::row_size() const
+{
+    return m_rows;
+}
+
+size_t criteria_mask::col_size() const
+{
+    return m_cols;
+}
+
+void criteria_mask::apply(const range_view& range, const criterion& crit)
+{
+    assert(range.row_size() == m_rows && range.col_size() == m_cols);
+
+    mask_builder builder(crit, m_flags.data(), range.get_range().first, m_rows);
+    range.walk(builder);
+}
+
+size_t criteria_mask::count() const
+{
+    return std::count(m_flags.begin(), m_flags.end(), 1);
+}
+
+void criteria_mask::sum(const range_view& range, double& sum, size_t& count) const
+{
+    assert(range.row_size() <= m_rows && range.col_size() <= m_cols);
+
+    masked_summer summer(m_flags.data(), range.get_range().first, m_rows);
+    range.walk(summer);
+    sum = summer.get_sum();
+    count = summer.get_count();
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
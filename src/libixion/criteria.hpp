@@ -0,0 +1,132 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_CRITERIA_HPP
+#define INCLUDED_IXION_CRITERIA_HPP
+
+#include "ixion/types.hpp"
+
+#include <string>
+#include <vector>
+
+namespace ixion {
+
+class range_view;
+
+namespace detail {
+
+/**
+ * Criterion of the conditional functions such as SUMIF and COUNTIF,
+ * compiled once from its string form such as ">=5", "<>foo" or "foo*"
+ * into a typed predicate that gets applied to each cell.
+ *
+ * A criterion whose operand is a number only matches numeric cells, one
+ * whose operand is either TRUE or FALSE only matches boolean cells, and any
+ * other criterion only matches string cells, except that a "<>" criterion
+ * matches all cells that don't equal its operand, including empty cells.
+ * String comparisons are case-insensitive, and the "=" and "<>" criteria
+ * support the * and ? wildcards, which can be escaped with ~.
+ */
+class criterion
+{
+public:
+    enum class op_t { equal, not_equal, less, less_equal, greater, greater_equal };
+
+    /**
+     * Compile a criterion that matches numeric cells of a value.
+     */
+    explicit criterion(double val);
+
+    /**
+     * Compile a criterion from its string form.
+     */
+    explicit criterion(const std::string& str);
+
+    bool match(double val) const;
+    bool match(bool val) const;
+    bool match(const std::string& str) const;
+    bool match_empty() const;
+    bool match_error() const;
+
+    /**
+     * Match an array of numeric values, and clear the flag of each value
+     * that doesn't match.
+     *
+     * @param p pointer to the first value.
+     * @param n number of values.
+     * @param flags pointer to the flag of the first value.
+     */
+    void match(const double* p, size_t n, char* flags) const;
+
+private:
+    enum class operand_t { numeric, boolean, string };
+
+    bool compare(int cmp) const;
+    bool match_pattern(const std::string& str) const;
+
+    op_t m_op;
+    operand_t m_type;
+    double m_value;
+    std::string m_str; ///< lower-cased string operand.
+    bool m_wildcard;
+};
+
+/**
+ * Flags of the cells of one or more ranges of the same size that match all
+ * of the criteria applied so far.  The flags are stored in column-major
+ * order.
+ */
+class criteria_mask
+{
+    size_t m_rows;
+    size_t m_cols;
+    std::vector<char> m_flags;
+
+public:
+    /**
+     * Create a mask with all cells flagged as matching.
+     *
+     * @param rows number of rows.
+     * @param cols number of columns.
+     */
+    criteria_mask(size_t rows, size_t cols);
+
+    size_t row_size() const;
+    size_t col_size() const;
+
+    /**
+     * Clear the flags of the cells whose values don't match a criterion.
+     *
+     * @param range range whose values to match.  It must be the same size
+     *              as the mask.
+     * @param crit criterion to match.
+     */
+    void apply(const range_view& range, const criterion& crit);
+
+    /**
+     * @return number of cells that match.
+     */
+    size_t count() const;
+
+    /**
+     * Sum the numeric values of the cells that match.
+     *
+     * @param range range whose values to sum.  It may be smaller than the
+     *              mask, in which case the remaining cells are ignored.
+     * @param sum sum of the values.
+     * @param count number of numeric values summed.
+     *
+     * @exception formula_error when a matching cell contains an error.
+     */
+    void sum(const range_view& range, double& sum, size_t& count) const;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -376,6 +376,36 @@ void test_listen_to_3d_range()
     assert(tracker.empty());
 }
 
+void test_direct_dependents()
+{
+    cout << "--" << endl << __FUNCTION__ << endl;
+
+    dirty_cell_tracker tracker;
+
+    abs_address_t A1(0, 0, 0), A2(0, 1, 0), A3(0, 2, 0), B1(0, 0, 1);
+    abs_range_t C1_C3(0, 0, 2, 3, 1);
+
+    // A2 listens to A1, A3 listens to A2, and B1 listens to A1:A3 range.
+    tracker.add(A2, A1);
+    tracker.add(A3, A2);
+    tracker.add(B1, abs_range_t(0, 0, 0, 3, 1));
+
+    abs_range_set_t res = tracker.query_direct_dependents(A1);
+    assert(res.size() == 2);
+    assert(res.count(A2) > 0);
+    assert(res.count(B1) > 0);
+
+    // A3 only indirectly depends on A1.
+    assert(res.count(A3) == 0);
+
+    res = tracker.query_direct_dependents(A3);
+    assert(res.size() == 1);
+    assert(res.count(B1) > 0);
+
+    res = tracker.query_direct_dependents(C1_C3);
+    assert(res.empty());
+}
+
 int main()
 {
     test_empty_query();
@@ -387,6 +417,7 @@ int main()
     test_recursive_tracking();
     test_listen_to_cell_in_range();
     test_listen_to_3d_range();
+    test_direct_dependents();
 
     return EXIT_SUCCESS;
 }
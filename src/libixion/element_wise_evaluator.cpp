@@ -0,0 +1,353 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "element_wise_evaluator.hpp"
+#include "formula_program.hpp"
+#include "range_view.hpp"
+
+#include "ixion/exceptions.hpp"
+#include "ixion/formula_result.hpp"
+#include "ixion/interface/formula_model_access.hpp"
+
+#include <cassert>
+#include <cmath>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+bool intersects(const abs_range_t& r1, const abs_range_t& r2)
+{
+    if (r1.first.sheet > r2.last.sheet || r2.first.sheet > r1.last.sheet)
+        return false;
+
+    if (r1.first.row > r2.last.row || r2.first.row > r1.last.row)
+        return false;
+
+    if (r1.first.column > r2.last.column || r2.first.column > r1.last.column)
+        return false;
+
+    return true;
+}
+
+}
+
+element_wise_evaluator::element_wise_evaluator(
+    const iface::formula_model_access& cxt, const abs_address_t& pos, const rc_size_t& size) :
+    m_context(cxt),
+    m_pos(pos),
+    m_group_range(pos, size.row, size.column),
+    m_rows(size.row),
+    m_cols(size.column)
+{
+}
+
+bool element_wise_evaluator::push_single_ref(const abs_address_t& addr)
+{
+    if (addr == m_pos)
+        // self-referencing is not permitted.
+        throw formula_error(formula_error_t::ref_result_not_available);
+
+    if (m_group_range.contains(addr))
+        return false;
+
+    operand v;
+
+    switch (m_context.get_celltype(addr))
+    {
+        case celltype_t::empty:
+            break;
+        case celltype_t::numeric:
+        case celltype_t::boolean:
+            v.scalar = m_context.get_numeric_value(addr);
+            break;
+        case celltype_t::formula:
+        {
+            formula_result res = m_context.get_formula_result(addr);
+            if (res.get_type() != formula_result::result_type::value)
+                return false;
+
+            v.scalar = res.get_value();
+            break;
+        }
+        default:
+            // Strings need to be handled by the normal evaluation.
+            return false;
+    }
+
+    m_stack.push_back(std::move(v));
+    return true;
+}
+
+bool element_wise_evaluator::push_range_ref(const abs_range_t& range)
+{
+    if (range.contains(m_pos))
+        throw formula_error(formula_error_t::ref_result_not_available);
+
+    if (range.first.sheet != range.last.sheet || range.all_rows() || range.all_columns())
+        return false;
+
+    if (intersects(range, m_group_range))
+        return false;
+
+    size_t rows = range.last.row - range.first.row + 1;
+    size_t cols = range.last.column - range.first.column + 1;
+
+    if ((rows != m_rows && rows != 1) || (cols != m_cols && cols != 1))
+        // The range doesn't map onto the group.
+        return false;
+
+    range_view view(m_context, range);
+    operand v;
+
+    if (rows == m_rows && cols == m_cols)
+    {
+        // Strings and errors need to be handled by the normal evaluation.
+        if (!view.get_numeric_array(v.values))
+            return false;
+    }
+    else
+    {
+        std::vector<double> src;
+        if (!view.get_numeric_array(src))
+            return false;
+
+        if (rows == 1 && cols == 1)
+            v.scalar = src[0];
+        else
+        {
+            // Broadcast the single row or column over the group.
+            v.values.reserve(m_rows * m_cols);
+
+            for (size_t col = 0; col < m_cols; ++col)
+            {
+                for (size_t row = 0; row < m_rows; ++row)
+                    v.values.push_back(src[rows * (cols == 1 ? 0 : col) + (rows == 1 ? 0 : row)]);
+            }
+        }
+    }
+
+    m_stack.push_back(std::move(v));
+    return true;
+}
+
+void element_wise_evaluator::expand(operand& v) const
+{
+    if (v.is_scalar())
+        v.values.assign(m_rows * m_cols, v.scalar);
+}
+
+void element_wise_evaluator::merge_errors(operand& dest, const operand& src) const
+{
+    if (src.errors.empty())
+        return;
+
+    if (dest.errors.empty())
+    {
+        dest.errors = src.errors;
+        return;
+    }
+
+    for (size_t i = 0, n = dest.errors.size(); i < n; ++i)
+    {
+        if (dest.errors[i] == formula_error_t::no_error)
+            dest.errors[i] = src.errors[i];
+    }
+}
+
+template<typename Func>
+void element_wise_evaluator::apply(Func func)
+{
+    assert(m_stack.size() >= 2);
+
+    operand rhs = std::move(m_stack.back());
+    m_stack.pop_back();
+    operand& lhs = m_stack.back();
+
+    if (lhs.is_scalar() && rhs.is_scalar())
+    {
+        lhs.scalar = func(lhs.scalar, rhs.scalar);
+        return;
+    }
+
+    expand(lhs);
+    double* p = lhs.values.data();
+    size_t n = lhs.values.size();
+
+    if (rhs.is_scalar())
+    {
+        const double v = rhs.scalar;
+        for (size_t i = 0; i < n; ++i)
+            p[i] = func(p[i], v);
+    }
+    else
+    {
+        const double* p2 = rhs.values.data();
+        for (size_t i = 0; i < n; ++i)
+            p[i] = func(p[i], p2[i]);
+    }
+
+    merge_errors(lhs, rhs);
+}
+
+void element_wise_evaluator::divide()
+{
+    const operand& rhs = m_stack.back();
+
+    if (rhs.is_scalar())
+    {
+        if (rhs.scalar == 0.0)
+            throw formula_error(formula_error_t::division_by_zero);
+
+        apply([](double v1, double v2) { return v1 / v2; });
+        return;
+    }
+
+    // Record the division by zero of individual elements before the
+    // divisors get consumed.
+    std::vector<formula_error_t> errors;
+    for (size_t i = 0, n = rhs.values.size(); i < n; ++i)
+    {
+        if (rhs.values[i] == 0.0)
+        {
+            if (errors.empty())
+                errors.resize(n, formula_error_t::no_error);
+
+            errors[i] = formula_error_t::division_by_zero;
+        }
+    }
+
+    apply([](double v1, double v2) { return v2 == 0.0 ? 0.0 : v1 / v2; });
+
+    if (!errors.empty())
+    {
+        operand err;
+        err.errors = std::move(errors);
+        merge_errors(m_stack.back(), err);
+    }
+}
+
+bool element_wise_evaluator::run(const formula_program& program)
+{
+    assert(program.is_element_wise());
+
+    m_stack.clear();
+
+    for (const formula_instruction& inst : program.instructions())
+    {
+        switch (inst.op)
+        {
+            case formula_op_t::push_value:
+            {
+                operand v;
+                v.scalar = inst.value;
+                m_stack.push_back(std::move(v));
+                break;
+            }
+            case formula_op_t::push_single_ref:
+                if (!push_single_ref(program.get_address(inst.index).to_abs(m_pos)))
+                    return false;
+                break;
+            case formula_op_t::push_range_ref:
+            {
+                abs_range_t range = program.get_range(inst.index).to_abs(m_pos);
+                range.reorder();
+                if (!push_range_ref(range))
+                    return false;
+                break;
+            }
+            case formula_op_t::negate:
+            {
+                operand& v = m_stack.back();
+                v.scalar = -v.scalar;
+                for (double& e : v.values)
+                    e = -e;
+                break;
+            }
+            case formula_op_t::to_value:
+            case formula_op_t::to_value_or_string:
+                // All operands are numeric.
+                break;
+            case formula_op_t::expression:
+            {
+                switch (inst.opcode)
+                {
+                    case fop_plus:
+                        apply([](double v1, double v2) { return v1 + v2; });
+                        break;
+                    case fop_minus:
+                        apply([](double v1, double v2) { return v1 - v2; });
+                        break;
+                    case fop_equal:
+                        apply([](double v1, double v2) { return double(v1 == v2); });
+                        break;
+                    case fop_not_equal:
+                        apply([](double v1, double v2) { return double(v1 != v2); });
+                        break;
+                    case fop_less:
+                        apply([](double v1, double v2) { return double(v1 < v2); });
+                        break;
+                    case fop_less_equal:
+                        apply([](double v1, double v2) { return double(v1 <= v2); });
+                        break;
+                    case fop_greater:
+                        apply([](double v1, double v2) { return double(v1 > v2); });
+                        break;
+                    case fop_greater_equal:
+                        apply([](double v1, double v2) { return double(v1 >= v2); });
+                        break;
+                    default:
+                        return false;
+                }
+                break;
+            }
+            case formula_op_t::multiply:
+                apply([](double v1, double v2) { return v1 * v2; });
+                break;
+            case formula_op_t::divide:
+                divide();
+                break;
+            case formula_op_t::exponent:
+                apply([](double v1, double v2) { return std::pow(v1, v2); });
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return m_stack.size() == 1;
+}
+
+matrix element_wise_evaluator::get_result() const
+{
+    assert(m_stack.size() == 1);
+    const operand& v = m_stack.back();
+
+    if (v.is_scalar())
+        return matrix(m_rows, m_cols, v.scalar);
+
+    matrix mx(numeric_matrix(v.values, m_rows, m_cols));
+
+    if (!v.errors.empty())
+    {
+        for (size_t col = 0; col < m_cols; ++col)
+        {
+            for (size_t row = 0; row < m_rows; ++row)
+            {
+                formula_error_t err = v.errors[col * m_rows + row];
+                if (err != formula_error_t::no_error)
+                    mx.set(row, col, err);
+            }
+        }
+    }
+
+    return mx;
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,105 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_ELEMENT_WISE_EVALUATOR_HPP
+#define INCLUDED_IXION_ELEMENT_WISE_EVALUATOR_HPP
+
+#include "ixion/address.hpp"
+#include "ixion/types.hpp"
+#include "ixion/matrix.hpp"
+
+#include <vector>
+
+namespace ixion {
+
+namespace iface {
+
+class formula_model_access;
+
+}
+
+namespace detail {
+
+class formula_program;
+
+/**
+ * Evaluates a grouped formula over all cells of its group in a single run.
+ * Each range reference whose dimension matches the group dimension (or is
+ * 1 in that direction) supplies one value per group cell, while all the
+ * other operands apply to all cells alike.  The operations get applied over
+ * whole arrays of values at once, producing the result matrix of the group
+ * directly.
+ */
+class element_wise_evaluator
+{
+    /**
+     * Operand of the evaluation; either a single value for all cells or one
+     * value per cell stored in column-major order.
+     */
+    struct operand
+    {
+        double scalar = 0.0;
+        std::vector<double> values;
+        std::vector<formula_error_t> errors; ///< empty when there is no error.
+
+        bool is_scalar() const { return values.empty(); }
+    };
+
+    const iface::formula_model_access& m_context;
+    abs_address_t m_pos;
+    abs_range_t m_group_range;
+    size_t m_rows;
+    size_t m_cols;
+
+    std::vector<operand> m_stack;
+
+    bool push_single_ref(const abs_address_t& addr);
+    bool push_range_ref(const abs_range_t& range);
+
+    void expand(operand& v) const;
+    void merge_errors(operand& dest, const operand& src) const;
+
+    template<typename Func>
+    void apply(Func func);
+
+    void divide();
+
+public:
+    /**
+     * @param cxt model to fetch the cell values from.
+     * @param pos position of the top-left cell of the group.
+     * @param size size of the group.
+     */
+    element_wise_evaluator(
+        const iface::formula_model_access& cxt, const abs_address_t& pos, const rc_size_t& size);
+
+    /**
+     * Evaluate a compiled formula over the group.
+     *
+     * @param program program to evaluate.  It must be element-wise
+     *                evaluable.
+     *
+     * @return true if the program has been evaluated, or false if any of
+     *         its operands is not suitable for element-wise evaluation, in
+     *         which case the program should be evaluated normally.
+     *
+     * @exception formula_error when the evaluation fails as a whole, in the
+     *            same way it would if evaluated normally.
+     */
+    bool run(const formula_program& program);
+
+    /**
+     * @return result matrix whose size equals the size of the group.
+     */
+    matrix get_result() const;
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -9,6 +9,8 @@
 #include "ixion/address.hpp"
 #include "ixion/cell.hpp"
 #include "ixion/formula_name_resolver.hpp"
+#include "ixion/config.hpp"
+#include "ixion/interface/formula_model_access.hpp"
 
 #include "queue_entry.hpp"
 #include "debug.hpp"
@@ -27,14 +29,16 @@ class calc_scope
 {
     iface::formula_model_access& m_cxt;
 public:
-    calc_scope(iface::formula_model_access& cxt) : m_cxt(cxt)
+    calc_scope(iface::formula_model_access& cxt, size_t thread_count) : m_cxt(cxt)
     {
+        m_cxt.set_calc_thread_count(thread_count);
         m_cxt.notify(formula_event_t::calculation_begins);
     }
 
     ~calc_scope()
     {
         m_cxt.notify(formula_event_t::calculation_ends);
+        m_cxt.set_calc_thread_count(0);
     }
 };
 
@@ -47,7 +51,7 @@ void calculate_sorted_cells(
     thread_count = 0;  // threads are disabled thus not to be used.
 #endif
 
-    calc_scope cs(cxt);
+    calc_scope cs(cxt, thread_count);
 
     std::vector<queue_entry> entries;
     entries.reserve(formula_cells.size());
@@ -67,6 +71,9 @@ void calculate_sorted_cells(
     for (queue_entry& e : entries)
         e.p->check_circular(cxt, e.pos);
 
+    if (entries.size() < cxt.get_config().min_cells_for_threads)
+        thread_count = 0;
+
     if (!thread_count)
     {
         // Interpret cells using just a single thread.
@@ -6,12 +6,15 @@
  */
 
 #include "formula_functions.hpp"
+#include "criteria.hpp"
 #include "debug.hpp"
 
 #include "ixion/formula_tokens.hpp"
 #include "ixion/matrix.hpp"
+#include "ixion/formula_result.hpp"
 #include "ixion/mem_str_buf.hpp"
 #include "ixion/interface/formula_model_access.hpp"
+#include "ixion/interface/range_value_handler.hpp"
 #include "ixion/macros.hpp"
 
 #ifdef max
@@ -27,6 +30,7 @@
 #include <thread>
 #include <chrono>
 #include <cmath>
+#include <algorithm>
 
 #include <mdds/sorted_string_map.hpp>
 
@@ -363,6 +367,7 @@ const std::vector<map_type::entry> entries =
     { IXION_ASCII("WEEKDAY"), formula_function_t::func_weekday },
     { IXION_ASCII("WEEKNUM"), formula_function_t::func_weeknum },
     { IXION_ASCII("WEIBULL"), formula_function_t::func_weibull },
+    { IXION_ASCII("XLOOKUP"), formula_function_t::func_xlookup },
     { IXION_ASCII("XOR"), formula_function_t::func_xor },
     { IXION_ASCII("YEAR"), formula_function_t::func_year },
     { IXION_ASCII("ZTEST"), formula_function_t::func_ztest },
@@ -379,48 +384,87 @@ const map_type& get()
 const char* unknown_func_name = "unknown";
 
 /**
- * Traverse all elements of a passed matrix to sum up their values.
+ * Finds the position of the first or last string cell that matches a
+ * wildcard pattern in a single-row or single-column range.
  */
-double sum_matrix_elements(const matrix& mx)
+class wildcard_finder : public iface::range_value_handler
 {
-    double sum = 0.0;
-    size_t rows = mx.row_size();
-    size_t cols = mx.col_size();
-    for (size_t row = 0; row < rows; ++row)
-        for (size_t col = 0; col < cols; ++col)
-            sum += mx.get_numeric(row, col);
+    detail::criterion m_criterion;
+    abs_address_t m_origin;
+    lookup_search_t m_search;
+    bool m_found;
+    size_t m_pos;
 
-    return sum;
-}
+public:
+    wildcard_finder(const std::string& pattern, const abs_address_t& origin, lookup_search_t search) :
+        m_criterion("=" + pattern), m_origin(origin), m_search(search), m_found(false), m_pos(0) {}
 
-numeric_matrix multiply_matrices(const matrix& left, const matrix& right)
-{
-    // The column size of the left matrix must equal the row size of the right
-    // matrix.
+    virtual void string(const abs_address_t& pos, const std::string& str) override
+    {
+        if (m_found && m_search == lookup_search_t::first)
+            return;
 
-    size_t n = left.col_size();
+        if (m_criterion.match(str))
+        {
+            m_found = true;
+            m_pos = (pos.row - m_origin.row) + (pos.column - m_origin.column);
+        }
+    }
 
-    if (n != right.row_size())
-        throw formula_error(formula_error_t::invalid_expression);
+    bool get_pos(size_t& pos) const
+    {
+        if (m_found)
+            pos = m_pos;
+        return m_found;
+    }
+};
 
-    numeric_matrix left_nm = left.as_numeric();
-    numeric_matrix right_nm = right.as_numeric();
+/**
+ * Counts the true and false values in a range for AND and OR.  String and
+ * empty cells are ignored.
+ */
+class logical_counter : public iface::range_value_handler
+{
+    size_t m_true;
+    size_t m_false;
 
-    numeric_matrix output(left_nm.row_size(), right_nm.col_size());
+public:
+    logical_counter() : m_true(0), m_false(0) {}
 
-    for (size_t row = 0; row < output.row_size(); ++row)
+    virtual void numeric(const abs_address_t& /*pos*/, const double* p, size_t n) override
     {
-        for (size_t col = 0; col < output.col_size(); ++col)
-        {
-            double v = 0.0;
-            for (size_t i = 0; i < n; ++i)
-                v += left_nm(row, i) * right_nm(i, col);
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+            count += p[i] != 0.0;
 
-            output(row, col) = v;
-        }
+        m_true += count;
+        m_false += n - count;
+    }
+
+    virtual void boolean(const abs_address_t& /*pos*/, bool val) override
+    {
+        ++(val ? m_true : m_false);
+    }
+
+    virtual void error(const abs_address_t& /*pos*/, formula_error_t err) override
+    {
+        throw formula_error(err);
     }
 
-    return output;
+    size_t get_true_count() const { return m_true; }
+    size_t get_false_count() const { return m_false; }
+};
+
+/**
+ * Discard all arguments but one, which becomes the result as is.
+ */
+void keep_arg(formula_value_stack& args, size_t pos)
+{
+    formula_value_stack::iterator it = args.begin();
+    std::advance(it, pos);
+    formula_value_stack::value_type v = args.release(it);
+    args.clear();
+    args.push_back(std::move(v));
 }
 
 }
@@ -475,22 +519,90 @@ formula_functions::~formula_functions()
 {
 }
 
+bool formula_functions::is_range_aggregate(formula_function_t oc)
+{
+    switch (oc)
+    {
+        case formula_function_t::func_average:
+        case formula_function_t::func_count:
+        case formula_function_t::func_counta:
+        case formula_function_t::func_max:
+        case formula_function_t::func_min:
+        case formula_function_t::func_sum:
+            return true;
+        default:
+            ;
+    }
+
+    return false;
+}
+
 void formula_functions::interpret(formula_function_t oc, formula_value_stack& args)
 {
+    // Aggregating the same large range in many cells is common.  Re-use the
+    // result from another cell when possible.
+    bool cache_result = is_range_aggregate(oc) && args.size() == 1 && args.get_type() == stack_value_t::range_ref;
+    abs_range_t range;
+
+    if (cache_result)
+    {
+        range = args.back().get_range();
+        double v;
+        if (m_context.get_range_result(oc, range, v))
+        {
+            args.clear();
+            args.push_value(v);
+            return;
+        }
+    }
+
     switch (oc)
     {
+        case formula_function_t::func_and:
+            fnc_and(args);
+            break;
         case formula_function_t::func_average:
             fnc_average(args);
             break;
+        case formula_function_t::func_averageif:
+            fnc_averageif(args);
+            break;
+        case formula_function_t::func_averageifs:
+            fnc_averageifs(args);
+            break;
+        case formula_function_t::func_choose:
+            fnc_choose(args);
+            break;
         case formula_function_t::func_concatenate:
             fnc_concatenate(args);
             break;
+        case formula_function_t::func_count:
+            fnc_count(args);
+            break;
         case formula_function_t::func_counta:
             fnc_counta(args);
             break;
+        case formula_function_t::func_countif:
+            fnc_countif(args);
+            break;
+        case formula_function_t::func_countifs:
+            fnc_countifs(args);
+            break;
+        case formula_function_t::func_hlookup:
+            fnc_hlookup(args);
+            break;
         case formula_function_t::func_if:
             fnc_if(args);
             break;
+        case formula_function_t::func_iferror:
+            fnc_iferror(args);
+            break;
+        case formula_function_t::func_ifna:
+            fnc_ifna(args);
+            break;
+        case formula_function_t::func_index:
+            fnc_index(args);
+            break;
         case formula_function_t::func_int:
             fnc_int(args);
             break;
@@ -500,6 +612,9 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
         case formula_function_t::func_len:
             fnc_len(args);
             break;
+        case formula_function_t::func_match:
+            fnc_match(args);
+            break;
         case formula_function_t::func_max:
             fnc_max(args);
             break;
@@ -512,6 +627,9 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
         case formula_function_t::func_now:
             fnc_now(args);
             break;
+        case formula_function_t::func_or:
+            fnc_or(args);
+            break;
         case formula_function_t::func_pi:
             fnc_pi(args);
             break;
@@ -521,9 +639,21 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
         case formula_function_t::func_sum:
             fnc_sum(args);
             break;
+        case formula_function_t::func_sumif:
+            fnc_sumif(args);
+            break;
+        case formula_function_t::func_sumifs:
+            fnc_sumifs(args);
+            break;
+        case formula_function_t::func_vlookup:
+            fnc_vlookup(args);
+            break;
         case formula_function_t::func_wait:
             fnc_wait(args);
             break;
+        case formula_function_t::func_xlookup:
+            fnc_xlookup(args);
+            break;
         case formula_function_t::func_unknown:
         default:
         {
@@ -534,21 +664,41 @@ void formula_functions::interpret(formula_function_t oc, formula_value_stack& ar
             throw not_implemented_error(os.str());
         }
     }
+
+    if (cache_result && args.get_type() == stack_value_t::value)
+        m_context.set_range_result(oc, range, args.back().get_value());
 }
 
-void formula_functions::fnc_max(formula_value_stack& args) const
+numeric_summary_t formula_functions::summarize_args(formula_value_stack& args) const
 {
-    if (args.empty())
-        throw formula_functions::invalid_arg("MAX requires one or more arguments.");
+    numeric_summary_t ret;
 
-    double ret = args.pop_value();
     while (!args.empty())
     {
-        double v = args.pop_value();
-        if (v > ret)
-            ret = v;
+        switch (args.get_type())
+        {
+            case stack_value_t::range_ref:
+            {
+                ret.add(m_context.summarize_range(args.pop_range_ref()));
+                break;
+            }
+            case stack_value_t::single_ref:
+            case stack_value_t::string:
+            case stack_value_t::value:
+            default:
+                ret.add(args.pop_value());
+        }
     }
-    args.push_value(ret);
+
+    return ret;
+}
+
+void formula_functions::fnc_max(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("MAX requires one or more arguments.");
+
+    args.push_value(summarize_args(args).max);
 }
 
 void formula_functions::fnc_min(formula_value_stack& args) const
@@ -556,14 +706,7 @@ void formula_functions::fnc_min(formula_value_stack& args) const
     if (args.empty())
         throw formula_functions::invalid_arg("MIN requires one or more arguments.");
 
-    double ret = args.pop_value();
-    while (!args.empty())
-    {
-        double v = args.pop_value();
-        if (v < ret)
-            ret = v;
-    }
-    args.push_value(ret);
+    args.push_value(summarize_args(args).min);
 }
 
 void formula_functions::fnc_sum(formula_value_stack& args) const
@@ -573,25 +716,49 @@ void formula_functions::fnc_sum(formula_value_stack& args) const
     if (args.empty())
         throw formula_functions::invalid_arg("SUM requires one or more arguments.");
 
+    double ret = summarize_args(args).sum;
+    args.push_value(ret);
+
+    IXION_TRACE("function: sum end (result=" << ret << ")");
+}
+
+void formula_functions::fnc_count(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("COUNT requires one or more arguments.");
+
     double ret = 0;
     while (!args.empty())
     {
         switch (args.get_type())
         {
+            case stack_value_t::value:
+                args.pop_value();
+                ++ret;
+            break;
             case stack_value_t::range_ref:
-                ret += sum_matrix_elements(args.pop_range_value());
+            {
+                abs_range_t range = args.pop_range_ref();
+                ret += m_context.count_range(range, value_numeric);
+            }
             break;
             case stack_value_t::single_ref:
+            {
+                abs_address_t pos = args.pop_single_ref();
+                abs_range_t range;
+                range.first = range.last = pos;
+                ret += m_context.count_range(range, value_numeric);
+            }
+            break;
             case stack_value_t::string:
-            case stack_value_t::value:
+                args.pop_string();
+            break;
             default:
-                ret += args.pop_value();
+                args.pop_value();
         }
     }
 
     args.push_value(ret);
-
-    IXION_TRACE("function: sum end (result=" << ret << ")");
 }
 
 void formula_functions::fnc_counta(formula_value_stack& args) const
@@ -637,48 +804,218 @@ void formula_functions::fnc_average(formula_value_stack& args) const
     if (args.empty())
         throw formula_functions::invalid_arg("AVERAGE requires one or more arguments.");
 
-    double ret = 0;
-    double count = 0.0;
-    while (!args.empty())
+    numeric_summary_t summary = summarize_args(args);
+    if (!summary.count)
+        throw formula_error(formula_error_t::division_by_zero);
+
+    args.push_value(summary.sum/summary.count);
+}
+
+range_view formula_functions::pop_range_arg(formula_value_stack& args) const
+{
+    switch (args.get_type())
     {
-        switch (args.get_type())
+        case stack_value_t::range_ref:
+            return args.pop_range_view();
+        case stack_value_t::single_ref:
+            return range_view(m_context, abs_range_t(args.pop_single_ref()));
+        default:
+            throw formula_error(formula_error_t::invalid_value_type);
+    }
+}
+
+detail::criterion formula_functions::pop_criterion(formula_value_stack& args) const
+{
+    switch (args.get_type())
+    {
+        case stack_value_t::value:
+            return detail::criterion(args.pop_value());
+        case stack_value_t::string:
+            return detail::criterion(args.pop_string());
+        case stack_value_t::single_ref:
         {
-            case stack_value_t::range_ref:
-            {
-                matrix mx = args.pop_range_value();
-                size_t rows = mx.row_size();
-                size_t cols = mx.col_size();
+            abs_address_t addr = args.pop_single_ref();
 
-                for (size_t r = 0; r < rows; ++r)
+            switch (m_context.get_celltype(addr))
+            {
+                case celltype_t::empty:
+                    // An empty cell is treated as 0.
+                    return detail::criterion(0.0);
+                case celltype_t::numeric:
+                    return detail::criterion(m_context.get_numeric_value(addr));
+                case celltype_t::boolean:
+                    return detail::criterion(std::string(m_context.get_boolean_value(addr) ? "TRUE" : "FALSE"));
+                case celltype_t::string:
                 {
-                    for (size_t c = 0; c < cols; ++c)
-                    {
-                        if (!mx.is_numeric(r, c))
-                            continue;
+                    const std::string* p = m_context.get_string_value(addr);
+                    return detail::criterion(p ? *p : std::string());
+                }
+                case celltype_t::formula:
+                {
+                    formula_result res = m_context.get_formula_result(addr);
 
-                        ret += mx.get_numeric(r, c);
-                        ++count;
+                    switch (res.get_type())
+                    {
+                        case formula_result::result_type::value:
+                            return detail::criterion(res.get_value());
+                        case formula_result::result_type::string:
+                            return detail::criterion(res.get_string());
+                        case formula_result::result_type::error:
+                            throw formula_error(res.get_error());
+                        default:
+                            ;
                     }
+                    break;
                 }
+                default:
+                    ;
             }
             break;
-            case stack_value_t::single_ref:
-            case stack_value_t::string:
-            case stack_value_t::value:
-            default:
-                ret += args.pop_value();
-                ++count;
         }
+        default:
+            ;
+    }
+
+    throw formula_error(formula_error_t::invalid_value_type);
+}
+
+detail::criteria_mask formula_functions::pop_criteria(formula_value_stack& args, size_t pair_count) const
+{
+    assert(pair_count > 0);
+
+    // NB : the stack is LIFO i.e. the pairs get popped from the last one.
+    detail::criterion crit = pop_criterion(args);
+    range_view range = pop_range_arg(args);
+
+    detail::criteria_mask mask(range.row_size(), range.col_size());
+    mask.apply(range, crit);
+
+    for (size_t i = 1; i < pair_count; ++i)
+    {
+        crit = pop_criterion(args);
+        range_view range2 = pop_range_arg(args);
+
+        if (range2.row_size() != mask.row_size() || range2.col_size() != mask.col_size())
+            throw formula_error(formula_error_t::invalid_value_type);
+
+        mask.apply(range2, crit);
+    }
+
+    return mask;
+}
+
+void formula_functions::sum_if(formula_value_stack& args, const char* name, double& sum, size_t& count) const
+{
+    if (args.size() != 2 && args.size() != 3)
+    {
+        std::ostringstream os;
+        os << name << " requires 2 or 3 arguments.";
+        throw formula_functions::invalid_arg(os.str());
+    }
+
+    abs_range_t sum_range(abs_range_t::invalid);
+    if (args.size() == 3)
+        sum_range = pop_range_arg(args).get_range();
+
+    detail::criterion crit = pop_criterion(args);
+    range_view range = pop_range_arg(args);
+
+    detail::criteria_mask mask(range.row_size(), range.col_size());
+    mask.apply(range, crit);
+
+    if (!sum_range.valid())
+    {
+        mask.sum(range, sum, count);
+        return;
+    }
+
+    // The sum range takes the size of the criteria range, starting from its
+    // top-left cell.
+    rc_size_t sheet_size = m_context.get_sheet_size();
+    sum_range.last = sum_range.first;
+    sum_range.last.row = std::min<row_t>(sum_range.first.row + mask.row_size(), sheet_size.row) - 1;
+    sum_range.last.column = std::min<col_t>(sum_range.first.column + mask.col_size(), sheet_size.column) - 1;
+
+    mask.sum(range_view(m_context, sum_range), sum, count);
+}
+
+void formula_functions::sum_ifs(formula_value_stack& args, const char* name, double& sum, size_t& count) const
+{
+    if (args.size() < 3 || args.size() % 2 == 0)
+    {
+        std::ostringstream os;
+        os << name << " requires a range followed by one or more pairs of a range and a criterion.";
+        throw formula_functions::invalid_arg(os.str());
     }
 
-    args.push_value(ret/count);
+    detail::criteria_mask mask = pop_criteria(args, args.size() / 2);
+    range_view range = pop_range_arg(args);
+
+    if (range.row_size() != mask.row_size() || range.col_size() != mask.col_size())
+        throw formula_error(formula_error_t::invalid_value_type);
+
+    mask.sum(range, sum, count);
+}
+
+void formula_functions::fnc_sumif(formula_value_stack& args) const
+{
+    double sum = 0.0;
+    size_t count = 0;
+    sum_if(args, "SUMIF", sum, count);
+    args.push_value(sum);
+}
+
+void formula_functions::fnc_sumifs(formula_value_stack& args) const
+{
+    double sum = 0.0;
+    size_t count = 0;
+    sum_ifs(args, "SUMIFS", sum, count);
+    args.push_value(sum);
+}
+
+void formula_functions::fnc_countif(formula_value_stack& args) const
+{
+    if (args.size() != 2)
+        throw formula_functions::invalid_arg("COUNTIF requires exactly 2 arguments.");
+
+    args.push_value(pop_criteria(args, 1).count());
+}
+
+void formula_functions::fnc_countifs(formula_value_stack& args) const
+{
+    if (args.empty() || args.size() % 2)
+        throw formula_functions::invalid_arg("COUNTIFS requires one or more pairs of a range and a criterion.");
+
+    args.push_value(pop_criteria(args, args.size() / 2).count());
+}
+
+void formula_functions::fnc_averageif(formula_value_stack& args) const
+{
+    double sum = 0.0;
+    size_t count = 0;
+    sum_if(args, "AVERAGEIF", sum, count);
+    if (!count)
+        throw formula_error(formula_error_t::division_by_zero);
+
+    args.push_value(sum/count);
+}
+
+void formula_functions::fnc_averageifs(formula_value_stack& args) const
+{
+    double sum = 0.0;
+    size_t count = 0;
+    sum_ifs(args, "AVERAGEIFS", sum, count);
+    if (!count)
+        throw formula_error(formula_error_t::division_by_zero);
+
+    args.push_value(sum/count);
 }
 
 void formula_functions::fnc_mmult(formula_value_stack& args) const
 {
-    matrix mx[2];
-    matrix* mxp = mx;
-    const matrix* mxp_end = mxp + 2;
+    numeric_matrix mx[2];
+    numeric_matrix* mxp = mx;
+    const numeric_matrix* mxp_end = mxp + 2;
 
     bool is_arg_invalid = false;
 
@@ -697,8 +1034,33 @@ void formula_functions::fnc_mmult(formula_value_stack& args) const
                     break;
                 }
 
-                matrix m = args.pop_range_value();
-                mxp->swap(m);
+                // Read the range values straight into a numeric array.
+                range_view view = args.pop_range_view();
+                std::vector<double> values;
+                if (view.get_numeric_array(values))
+                {
+                    numeric_matrix m(std::move(values), view.row_size(), view.col_size());
+                    mxp->swap(m);
+                }
+                else
+                {
+                    // The range contains a string or an error value.  The
+                    // first error becomes the result, and strings are
+                    // treated as zeros.
+                    matrix m = m_context.get_range_value(view.get_range());
+                    for (size_t col = 0; col < m.col_size(); ++col)
+                    {
+                        for (size_t row = 0; row < m.row_size(); ++row)
+                        {
+                            matrix::element e = m.get(row, col);
+                            if (e.type == matrix::element_type::error)
+                                throw formula_error(e.error);
+                        }
+                    }
+
+                    numeric_matrix nm = m.as_numeric();
+                    mxp->swap(nm);
+                }
                 ++mxp;
                 break;
             }
@@ -718,11 +1080,12 @@ void formula_functions::fnc_mmult(formula_value_stack& args) const
 
     mx[0].swap(mx[1]); // Make it so that 0 -> left and 1 -> right.
 
-    if (!mx[0].is_numeric() || !mx[1].is_numeric())
-        throw formula_functions::invalid_arg(
-            "MMULT requires two numeric ranges. At least one range is not numeric.");
+    // The column size of the left matrix must equal the row size of the right
+    // matrix.
+    if (mx[0].col_size() != mx[1].row_size())
+        throw formula_error(formula_error_t::invalid_expression);
 
-    numeric_matrix ans = multiply_matrices(mx[0], mx[1]);
+    numeric_matrix ans = multiply(mx[0], mx[1], m_context.get_calc_thread_count());
 
     args.push_matrix(ans);
 }
@@ -761,6 +1124,449 @@ void formula_functions::fnc_if(formula_value_stack& args) const
     args.swap(ret);
 }
 
+void formula_functions::fnc_choose(formula_value_stack& args) const
+{
+    if (args.size() < 2)
+        throw formula_functions::invalid_arg("CHOOSE requires 2 or more arguments.");
+
+    double choice = std::trunc(args.get_value(0));
+    if (choice < 1.0 || choice >= args.size())
+        throw formula_error(formula_error_t::invalid_value_type);
+
+    keep_arg(args, choice);
+}
+
+void formula_functions::fnc_iferror(formula_value_stack& args) const
+{
+    if (args.size() != 2)
+        throw formula_functions::invalid_arg("IFERROR requires exactly 2 arguments.");
+
+    // Errors raised while evaluating the first argument get caught by the
+    // interpreter, which skips this call.  Here the first argument may only
+    // refer to an error.
+    keep_arg(args, args.get_error(0) == formula_error_t::no_error ? 0 : 1);
+}
+
+void formula_functions::fnc_ifna(formula_value_stack& args) const
+{
+    if (args.size() != 2)
+        throw formula_functions::invalid_arg("IFNA requires exactly 2 arguments.");
+
+    keep_arg(args, args.get_error(0) == formula_error_t::no_value_available ? 1 : 0);
+}
+
+void formula_functions::count_logical_values(
+    formula_value_stack& args, size_t& true_count, size_t& false_count) const
+{
+    true_count = 0;
+    false_count = 0;
+
+    auto count = [&](bool v) { ++(v ? true_count : false_count); };
+
+    for (stack_value& v : args)
+    {
+        switch (v.get_type())
+        {
+            case stack_value_t::value:
+                count(v.get_value() != 0.0);
+                break;
+            case stack_value_t::single_ref:
+            {
+                const abs_address_t& addr = v.get_address();
+
+                switch (m_context.get_celltype(addr))
+                {
+                    case celltype_t::numeric:
+                    case celltype_t::boolean:
+                        count(m_context.get_numeric_value(addr) != 0.0);
+                        break;
+                    case celltype_t::formula:
+                    {
+                        formula_result res = m_context.get_formula_result(addr);
+
+                        switch (res.get_type())
+                        {
+                            case formula_result::result_type::value:
+                                count(res.get_value() != 0.0);
+                                break;
+                            case formula_result::result_type::error:
+                                throw formula_error(res.get_error());
+                            default:
+                                ;
+                        }
+                        break;
+                    }
+                    default:
+                        // String and empty cells are ignored.
+                        ;
+                }
+                break;
+            }
+            case stack_value_t::range_ref:
+            {
+                logical_counter counter;
+                range_view(m_context, v.get_range()).walk(counter);
+                true_count += counter.get_true_count();
+                false_count += counter.get_false_count();
+                break;
+            }
+            case stack_value_t::matrix:
+            {
+                matrix mx = v.pop_matrix();
+
+                for (size_t col = 0; col < mx.col_size(); ++col)
+                {
+                    for (size_t row = 0; row < mx.row_size(); ++row)
+                    {
+                        matrix::element e = mx.get(row, col);
+
+                        switch (e.type)
+                        {
+                            case matrix::element_type::numeric:
+                                count(e.numeric != 0.0);
+                                break;
+                            case matrix::element_type::boolean:
+                                count(e.boolean);
+                                break;
+                            case matrix::element_type::error:
+                                throw formula_error(e.error);
+                            default:
+                                ;
+                        }
+                    }
+                }
+                break;
+            }
+            default:
+                throw formula_error(formula_error_t::invalid_value_type);
+        }
+    }
+
+    if (!true_count && !false_count)
+        throw formula_error(formula_error_t::invalid_value_type);
+}
+
+void formula_functions::fnc_and(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("AND requires one or more arguments.");
+
+    size_t true_count, false_count;
+    count_logical_values(args, true_count, false_count);
+
+    args.clear();
+    args.push_value(false_count ? 0.0 : 1.0);
+}
+
+void formula_functions::fnc_or(formula_value_stack& args) const
+{
+    if (args.empty())
+        throw formula_functions::invalid_arg("OR requires one or more arguments.");
+
+    size_t true_count, false_count;
+    count_logical_values(args, true_count, false_count);
+
+    args.clear();
+    args.push_value(true_count ? 1.0 : 0.0);
+}
+
+formula_functions::lookup_key formula_functions::pop_lookup_key(formula_value_stack& args) const
+{
+    lookup_key key;
+
+    switch (args.get_type())
+    {
+        case stack_value_t::value:
+            key.value = args.pop_value();
+            return key;
+        case stack_value_t::string:
+            key.is_string = true;
+            key.str = args.pop_string();
+            return key;
+        case stack_value_t::single_ref:
+        {
+            abs_address_t addr = args.pop_single_ref();
+
+            switch (m_context.get_celltype(addr))
+            {
+                case celltype_t::numeric:
+                case celltype_t::boolean:
+                    key.value = m_context.get_numeric_value(addr);
+                    return key;
+                case celltype_t::string:
+                {
+                    const std::string* p = m_context.get_string_value(addr);
+                    key.is_string = true;
+                    key.str = p ? *p : std::string();
+                    return key;
+                }
+                case celltype_t::formula:
+                {
+                    formula_result res = m_context.get_formula_result(addr);
+
+                    switch (res.get_type())
+                    {
+                        case formula_result::result_type::value:
+                            key.value = res.get_value();
+                            return key;
+                        case formula_result::result_type::string:
+                            key.is_string = true;
+                            key.str = res.get_string();
+                            return key;
+                        case formula_result::result_type::error:
+                            throw formula_error(res.get_error());
+                        default:
+                            ;
+                    }
+                    break;
+                }
+                default:
+                    // An empty cell never matches.
+                    throw formula_error(formula_error_t::no_value_available);
+            }
+            break;
+        }
+        default:
+            ;
+    }
+
+    throw formula_error(formula_error_t::invalid_value_type);
+}
+
+bool formula_functions::find_in_vector(
+    const abs_range_t& range, const lookup_key& key, lookup_match_t match, lookup_search_t search,
+    bool wildcard, size_t& pos) const
+{
+    if (!key.is_string)
+        return m_context.find_in_range(range, key.value, match, search, pos);
+
+    if (wildcard && match == lookup_match_t::exact && key.str.find_first_of("*?~") != std::string::npos)
+    {
+        // Wildcard patterns can't be looked up in the index.
+        wildcard_finder finder(key.str, range.first, search);
+        m_context.walk_range(range, finder);
+        return finder.get_pos(pos);
+    }
+
+    return m_context.find_in_range(range, key.str, match, search, pos);
+}
+
+void formula_functions::lookup_table(formula_value_stack& args, const char* name, bool vertical) const
+{
+    if (args.size() != 3 && args.size() != 4)
+    {
+        std::ostringstream os;
+        os << name << " requires 3 or 4 arguments.";
+        throw formula_functions::invalid_arg(os.str());
+    }
+
+    bool approx = true;
+    if (args.size() == 4)
+        approx = args.pop_value() != 0.0;
+
+    double index = std::trunc(args.pop_value());
+    range_view table = pop_range_arg(args);
+    lookup_key key = pop_lookup_key(args);
+
+    if (index < 1.0)
+        throw formula_error(formula_error_t::invalid_value_type);
+
+    size_t offset = index - 1.0;
+    if (offset >= (vertical ? table.col_size() : table.row_size()))
+        throw formula_error(formula_error_t::ref_result_not_available);
+
+    // The value is looked up in the first column for VLOOKUP, or in the
+    // first row for HLOOKUP.
+    abs_range_t vector = table.get_range();
+    if (vertical)
+        vector.last.column = vector.first.column;
+    else
+        vector.last.row = vector.first.row;
+
+    // An approximate match assumes that the values are sorted in ascending
+    // order, and picks the last one of equal values.
+    size_t pos;
+    bool found = approx ?
+        find_in_vector(vector, key, lookup_match_t::exact_or_smaller, lookup_search_t::last, false, pos) :
+        find_in_vector(vector, key, lookup_match_t::exact, lookup_search_t::first, true, pos);
+
+    if (!found)
+    {
+        args.push_error(formula_error_t::no_value_available);
+        return;
+    }
+
+    abs_address_t addr = vector.first;
+    if (vertical)
+    {
+        addr.row += pos;
+        addr.column += offset;
+    }
+    else
+    {
+        addr.row += offset;
+        addr.column += pos;
+    }
+
+    args.push_single_ref(addr);
+}
+
+void formula_functions::fnc_vlookup(formula_value_stack& args) const
+{
+    lookup_table(args, "VLOOKUP", true);
+}
+
+void formula_functions::fnc_hlookup(formula_value_stack& args) const
+{
+    lookup_table(args, "HLOOKUP", false);
+}
+
+void formula_functions::fnc_match(formula_value_stack& args) const
+{
+    if (args.size() != 2 && args.size() != 3)
+        throw formula_functions::invalid_arg("MATCH requires 2 or 3 arguments.");
+
+    double type = 1.0;
+    if (args.size() == 3)
+        type = args.pop_value();
+
+    range_view vector = pop_range_arg(args);
+    lookup_key key = pop_lookup_key(args);
+
+    if (vector.row_size() != 1 && vector.col_size() != 1)
+        throw formula_error(formula_error_t::no_value_available);
+
+    // Type 1 assumes the values to be sorted in ascending order, and type -1
+    // in descending order.
+    size_t pos;
+    bool found = false;
+    if (type > 0.0)
+        found = find_in_vector(vector.get_range(), key, lookup_match_t::exact_or_smaller, lookup_search_t::last, false, pos);
+    else if (type < 0.0)
+        found = find_in_vector(vector.get_range(), key, lookup_match_t::exact_or_larger, lookup_search_t::last, false, pos);
+    else
+        found = find_in_vector(vector.get_range(), key, lookup_match_t::exact, lookup_search_t::first, true, pos);
+
+    if (!found)
+    {
+        args.push_error(formula_error_t::no_value_available);
+        return;
+    }
+
+    args.push_value(pos + 1);
+}
+
+void formula_functions::fnc_index(formula_value_stack& args) const
+{
+    if (args.size() != 2 && args.size() != 3)
+        throw formula_functions::invalid_arg("INDEX requires 2 or 3 arguments.");
+
+    bool has_col = args.size() == 3;
+    double col = has_col ? std::trunc(args.pop_value()) : 0.0;
+    double row = std::trunc(args.pop_value());
+    range_view ref = pop_range_arg(args);
+
+    if (!has_col)
+    {
+        // A single index picks a cell from a single row or column.
+        if (ref.row_size() == 1)
+        {
+            col = row;
+            row = 1.0;
+        }
+        else if (ref.col_size() == 1)
+            col = 1.0;
+    }
+
+    if (row < 0.0 || col < 0.0)
+        throw formula_error(formula_error_t::invalid_value_type);
+
+    if (row > ref.row_size() || col > ref.col_size())
+        throw formula_error(formula_error_t::ref_result_not_available);
+
+    // An index of 0 picks the whole column or row.
+    abs_range_t range = ref.get_range();
+    if (row > 0.0)
+    {
+        range.first.row += row - 1.0;
+        range.last.row = range.first.row;
+    }
+    if (col > 0.0)
+    {
+        range.first.column += col - 1.0;
+        range.last.column = range.first.column;
+    }
+
+    if (range.first == range.last)
+        args.push_single_ref(range.first);
+    else
+        args.push_range_ref(range);
+}
+
+void formula_functions::fnc_xlookup(formula_value_stack& args) const
+{
+    if (args.size() < 3 || args.size() > 6)
+        throw formula_functions::invalid_arg("XLOOKUP requires 3 to 6 arguments.");
+
+    double search_mode = args.size() == 6 ? args.pop_value() : 1.0;
+    double match_mode = args.size() == 5 ? args.pop_value() : 0.0;
+
+    std::unique_ptr<stack_value> if_not_found;
+    if (args.size() == 4)
+        if_not_found = std::make_unique<stack_value>(args.release_back());
+
+    range_view returned = pop_range_arg(args);
+    range_view vector = pop_range_arg(args);
+    lookup_key key = pop_lookup_key(args);
+
+    bool vertical = vector.col_size() == 1;
+    if (!vertical && vector.row_size() != 1)
+        throw formula_error(formula_error_t::invalid_value_type);
+
+    if (vertical ? returned.row_size() != vector.row_size() : returned.col_size() != vector.col_size())
+        throw formula_error(formula_error_t::invalid_value_type);
+
+    lookup_match_t match = lookup_match_t::exact;
+    if (match_mode == -1.0)
+        match = lookup_match_t::exact_or_smaller;
+    else if (match_mode == 1.0)
+        match = lookup_match_t::exact_or_larger;
+    else if (match_mode != 0.0 && match_mode != 2.0)
+        throw formula_error(formula_error_t::invalid_value_type);
+
+    // Binary search modes are handled the same as linear search, since the
+    // index doesn't depend on the order of the values.
+    lookup_search_t search = search_mode < 0.0 ? lookup_search_t::last : lookup_search_t::first;
+
+    size_t pos;
+    if (!find_in_vector(vector.get_range(), key, match, search, match_mode == 2.0, pos))
+    {
+        if (!if_not_found)
+            args.push_error(formula_error_t::no_value_available);
+        else
+            args.push_back(std::move(*if_not_found));
+        return;
+    }
+
+    // Return the row or column of the return range at the matching position.
+    abs_range_t range = returned.get_range();
+    if (vertical)
+    {
+        range.first.row += pos;
+        range.last.row = range.first.row;
+    }
+    else
+    {
+        range.first.column += pos;
+        range.last.column = range.first.column;
+    }
+
+    if (range.first == range.last)
+        args.push_single_ref(range.first);
+    else
+        args.push_range_ref(range);
+}
+
 void formula_functions::fnc_len(formula_value_stack& args) const
 {
     if (args.size() != 1)
@@ -829,8 +1635,7 @@ void formula_functions::fnc_subtotal(formula_value_stack& args) const
         case 109:
         {
             // SUM
-            matrix mx = m_context.get_range_value(range);
-            args.push_value(sum_matrix_elements(mx));
+            args.push_value(m_context.summarize_range(range).sum);
             break;
         }
         default:
@@ -27,6 +27,15 @@ class formula_model_access;
 
 }
 
+class range_view;
+
+namespace detail {
+
+class criterion;
+class criteria_mask;
+
+}
+
 /**
  * Collection of built-in cell function implementations.  Note that those
  * functions that return a string result <i>may</i> modify the state of the
@@ -52,16 +61,128 @@ public:
     void interpret(formula_function_t oc, formula_value_stack& args);
 
 private:
+    /**
+     * Check whether a function only aggregates the values of its arguments,
+     * in which case its result solely depends on the values of the range
+     * when called with a single range.
+     */
+    static bool is_range_aggregate(formula_function_t oc);
+
+    /**
+     * Pop all arguments off the stack and aggregate their numeric values.
+     */
+    numeric_summary_t summarize_args(formula_value_stack& args) const;
+
+    /**
+     * Pop a range argument, which may also be a single cell reference.
+     */
+    range_view pop_range_arg(formula_value_stack& args) const;
+
+    /**
+     * Pop a criterion argument of the conditional functions.
+     */
+    detail::criterion pop_criterion(formula_value_stack& args) const;
+
+    /**
+     * Pop pairs of a criteria range and a criterion, and flag the cells
+     * that match all the criteria.
+     *
+     * @param args argument stack.
+     * @param pair_count number of pairs to pop.
+     */
+    detail::criteria_mask pop_criteria(formula_value_stack& args, size_t pair_count) const;
+
+    /**
+     * Pop the arguments of SUMIF or AVERAGEIF, and sum the values that
+     * match the criterion.
+     */
+    void sum_if(formula_value_stack& args, const char* name, double& sum, size_t& count) const;
+
+    /**
+     * Pop the arguments of SUMIFS or AVERAGEIFS, and sum the values that
+     * match all the criteria.
+     */
+    void sum_ifs(formula_value_stack& args, const char* name, double& sum, size_t& count) const;
+
+    /**
+     * Value to look up with the lookup functions.
+     */
+    struct lookup_key
+    {
+        bool is_string = false;
+        double value = 0.0;
+        std::string str;
+    };
+
+    /**
+     * Pop the value to look up with a lookup function.
+     */
+    lookup_key pop_lookup_key(formula_value_stack& args) const;
+
+    /**
+     * Find the position of a value in a single-row or single-column range.
+     *
+     * @param range range to look up the value in.
+     * @param key value to look up.
+     * @param match type of match to look for.
+     * @param search which position to pick when multiple cells match.
+     * @param wildcard whether to treat the * and ? characters in a string
+     *                 value as wildcards when looking for an exact match.
+     * @param pos offset of the matching cell from the first cell of the
+     *            range, set only when found.
+     *
+     * @return true if a matching cell has been found, false otherwise.
+     */
+    bool find_in_vector(
+        const abs_range_t& range, const lookup_key& key, lookup_match_t match, lookup_search_t search,
+        bool wildcard, size_t& pos) const;
+
+    /**
+     * Pop the arguments of VLOOKUP or HLOOKUP, and push the reference to
+     * the matching cell.
+     *
+     * @param vertical true for VLOOKUP, or false for HLOOKUP.
+     */
+    void lookup_table(formula_value_stack& args, const char* name, bool vertical) const;
+
+    /**
+     * Count the true and false values of the arguments of AND and OR.
+     * Strings in references are ignored.
+     *
+     * @exception formula_error when an argument is or contains an error,
+     *            when an argument is a string, or when there are no values
+     *            to count at all.
+     */
+    void count_logical_values(formula_value_stack& args, size_t& true_count, size_t& false_count) const;
+
     void fnc_max(formula_value_stack& args) const;
     void fnc_min(formula_value_stack& args) const;
     void fnc_sum(formula_value_stack& args) const;
+    void fnc_count(formula_value_stack& args) const;
     void fnc_counta(formula_value_stack& args) const;
     void fnc_average(formula_value_stack& args) const;
+    void fnc_sumif(formula_value_stack& args) const;
+    void fnc_sumifs(formula_value_stack& args) const;
+    void fnc_countif(formula_value_stack& args) const;
+    void fnc_countifs(formula_value_stack& args) const;
+    void fnc_averageif(formula_value_stack& args) const;
+    void fnc_averageifs(formula_value_stack& args) const;
     void fnc_mmult(formula_value_stack& args) const;
     void fnc_pi(formula_value_stack& args) const;
     void fnc_int(formula_value_stack& args) const;
 
     void fnc_if(formula_value_stack& args) const;
+    void fnc_choose(formula_value_stack& args) const;
+    void fnc_iferror(formula_value_stack& args) const;
+    void fnc_ifna(formula_value_stack& args) const;
+    void fnc_and(formula_value_stack& args) const;
+    void fnc_or(formula_value_stack& args) const;
+
+    void fnc_vlookup(formula_value_stack& args) const;
+    void fnc_hlookup(formula_value_stack& args) const;
+    void fnc_match(formula_value_stack& args) const;
+    void fnc_index(formula_value_stack& args) const;
+    void fnc_xlookup(formula_value_stack& args) const;
 
     void fnc_len(formula_value_stack& args) const;
     void fnc_concatenate(formula_value_stack& args) const;
@@ -7,6 +7,9 @@
 
 #include "formula_interpreter.hpp"
 #include "formula_functions.hpp"
+#include "formula_program.hpp"
+#include "element_wise_evaluator.hpp"
+#include "sliding_window_evaluator.hpp"
 #include "concrete_formula_tokens.hpp"
 #include "debug.hpp"
 
@@ -45,7 +48,9 @@ opcode_token paren_close = opcode_token(fop_close);
 formula_interpreter::formula_interpreter(const formula_cell* cell, iface::formula_model_access& cxt) :
     m_parent_cell(cell),
     m_context(cxt),
-    m_error(formula_error_t::no_error)
+    m_funcs(cxt),
+    m_error(formula_error_t::no_error),
+    mp_element(nullptr)
 {
 }
 
@@ -53,6 +58,21 @@ formula_interpreter::~formula_interpreter()
 {
 }
 
+void formula_interpreter::reset(const formula_cell* cell)
+{
+    m_parent_cell = cell;
+    mp_handler.reset();
+    m_stacks.clear();
+    m_tokens.clear();
+    m_result = formula_result(); // the previous result may have been moved out.
+    m_error = formula_error_t::no_error;
+}
+
+const iface::formula_model_access& formula_interpreter::get_context() const
+{
+    return m_context;
+}
+
 void formula_interpreter::set_origin(const abs_address_t& pos)
 {
     m_pos = pos;
@@ -61,34 +81,104 @@ void formula_interpreter::set_origin(const abs_address_t& pos)
 bool formula_interpreter::interpret()
 {
     mp_handler = m_context.create_session_handler();
+    bool ret = interpret_cell();
+
+    // Neither the handler nor the stacks are needed past the interpretation
+    // of the cell.  Releasing the stacks here also hands their buffers back
+    // to the pool before the interpreter gets stored for reuse.
+    mp_handler.reset();
+    m_stacks.clear();
+    return ret;
+}
+
+bool formula_interpreter::interpret_cell()
+{
     if (mp_handler)
         mp_handler->begin_cell_interpret(m_pos);
 
     try
     {
-        init_tokens();
+        const formula_tokens_store_ptr_t& ts = m_parent_cell->get_tokens();
+        const detail::formula_program* program =
+            ts ? detail::formula_tokens_store_access::get_program(*ts) : nullptr;
+        std::shared_ptr<const detail::expanded_formula_tokens> expanded;
 
-        if (m_tokens.empty())
+        if (ts && !program)
         {
-            IXION_DEBUG("interpreter has no tokens to interpret");
-            return false;
+            // The tokens may contain named expressions.
+            expanded = get_expanded_tokens(*ts);
+            if (expanded)
+                program = expanded->program.get();
         }
 
-        m_cur_token_itr = m_tokens.begin();
-        m_error = formula_error_t::no_error;
-        m_result.reset();
+        if (program)
+        {
+            clear_stacks();
+            m_error = formula_error_t::no_error;
+            m_result.reset();
 
-        expression();
+            if (mp_handler)
+            {
+                if (expanded)
+                {
+                    for (const formula_token* t : expanded->tokens)
+                        push_token_to_handler(*t);
+                }
+                else
+                {
+                    for (const std::unique_ptr<formula_token>& t : ts->get())
+                        push_token_to_handler(*t);
+                }
+            }
 
-        if (m_cur_token_itr != m_tokens.end())
+            if (!run_program_on_group(*program) && !run_program_on_window(*program))
+                run_program(*program);
+        }
+        else
         {
-            if (mp_handler)
-                mp_handler->set_invalid_expression("formula token interpretation ended prematurely.");
-            return false;
+            if (expanded)
+            {
+                clear_stacks();
+                m_tokens = expanded->tokens;
+                m_end_token_pos = m_tokens.end();
+            }
+            else
+                init_tokens();
+
+            if (m_tokens.empty())
+            {
+                IXION_DEBUG("interpreter has no tokens to interpret");
+                return false;
+            }
+
+            m_cur_token_itr = m_tokens.begin();
+            m_error = formula_error_t::no_error;
+            m_result.reset();
+
+            expression();
+
+            if (m_cur_token_itr != m_tokens.end())
+            {
+                if (mp_handler)
+                    mp_handler->set_invalid_expression("formula token interpretation ended prematurely.");
+                return false;
+            }
         }
 
         pop_result();
 
+        if (m_error != formula_error_t::no_error)
+        {
+            // The expression has evaluated to an error value.
+            if (mp_handler)
+            {
+                mp_handler->set_formula_error(get_formula_error_name(m_error));
+                mp_handler->end_cell_interpret();
+            }
+
+            return false;
+        }
+
         IXION_TRACE("interpretation successfully finished");
 
         if (mp_handler)
@@ -161,6 +251,31 @@ void formula_interpreter::init_tokens()
     m_end_token_pos = m_tokens.end();
 }
 
+std::shared_ptr<const detail::expanded_formula_tokens> formula_interpreter::get_expanded_tokens(
+    const formula_tokens_store& ts)
+{
+    size_t revision = m_context.get_named_expressions_revision();
+    if (!revision)
+        return nullptr;
+
+    std::shared_ptr<const detail::expanded_formula_tokens> cached =
+        detail::formula_tokens_store_access::get_expanded_tokens(ts, m_pos.sheet, revision);
+
+    if (cached)
+        return cached;
+
+    // This throws in case the expansion fails, in which case nothing gets
+    // cached.
+    init_tokens();
+
+    auto expanded = std::make_shared<detail::expanded_formula_tokens>();
+    expanded->tokens = m_tokens;
+    expanded->program = detail::formula_program::compile(expanded->tokens);
+    detail::formula_tokens_store_access::set_expanded_tokens(ts, m_pos.sheet, revision, expanded);
+
+    return expanded;
+}
+
 namespace {
 
 void get_result_from_cell(const iface::formula_model_access& cxt, const abs_address_t& addr, formula_result& res)
@@ -192,6 +307,56 @@ void get_result_from_cell(const iface::formula_model_access& cxt, const abs_addr
     }
 }
 
+/**
+ * Store the value at the top of a stack as an element of a matrix.
+ */
+void set_matrix_element(
+    const iface::formula_model_access& cxt, const formula_value_stack& vs, matrix& mx, size_t row, size_t col)
+{
+    if (vs.size() != 1)
+        throw formula_error(formula_error_t::stack_error);
+
+    formula_result res;
+    const stack_value& v = vs.back();
+
+    switch (v.get_type())
+    {
+        case stack_value_t::single_ref:
+            get_result_from_cell(cxt, v.get_address(), res);
+            break;
+        case stack_value_t::range_ref:
+            get_result_from_cell(cxt, v.get_range().first, res);
+            break;
+        case stack_value_t::string:
+            res.set_string_value(v.get_string());
+            break;
+        case stack_value_t::value:
+            res.set_value(v.get_value());
+            break;
+        case stack_value_t::error:
+            res.set_error(v.get_error());
+            break;
+        default:
+            res.set_error(formula_error_t::invalid_value_type);
+    }
+
+    switch (res.get_type())
+    {
+        case formula_result::result_type::value:
+            mx.set(row, col, res.get_value());
+            break;
+        case formula_result::result_type::string:
+            mx.set(row, col, res.get_string());
+            break;
+        case formula_result::result_type::error:
+            mx.set(row, col, res.get_error());
+            break;
+        case formula_result::result_type::matrix:
+            mx.set(row, col, formula_error_t::invalid_value_type);
+            break;
+    }
+}
+
 }
 
 void formula_interpreter::pop_result()
@@ -224,6 +389,9 @@ void formula_interpreter::pop_result()
         case stack_value_t::matrix:
             m_result.set_matrix(res.pop_matrix());
             break;
+        case stack_value_t::error:
+            m_error = res.get_error();
+            break;
         default:
             ;
     }
@@ -317,12 +485,21 @@ bool valid_expression_op(fopcode_t oc)
     return false;
 }
 
-bool pop_stack_value_or_string(const iface::formula_model_access& cxt,
+/**
+ * Pop a value off the stack as either a numeric value or a string.
+ *
+ * @return error of the value, formula_error_t::general_error if the value
+ *         can't be resolved to either type, or formula_error_t::no_error on
+ *         success.
+ */
+formula_error_t pop_stack_value_or_string(const iface::formula_model_access& cxt,
     formula_value_stack& stack, stack_value_t& vt, double& val, string& str)
 {
     vt = stack.get_type();
     switch (vt)
     {
+        case stack_value_t::error:
+            return stack.release_back().get_error();
         case stack_value_t::value:
             val = stack.pop_value();
             break;
@@ -340,7 +517,7 @@ bool pop_stack_value_or_string(const iface::formula_model_access& cxt,
                     // empty cell has a value of 0.
                     vt = stack_value_t::value;
                     val = 0.0;
-                    return true;
+                    return formula_error_t::no_error;
                 }
                 case celltype_t::boolean:
                     // TODO : Decide whether we need to treat this as a
@@ -350,7 +527,7 @@ bool pop_stack_value_or_string(const iface::formula_model_access& cxt,
                 {
                     vt = stack_value_t::value;
                     val = cxt.get_numeric_value(addr);
-                    return true;
+                    return formula_error_t::no_error;
                 }
                 case celltype_t::string:
                 {
@@ -358,9 +535,9 @@ bool pop_stack_value_or_string(const iface::formula_model_access& cxt,
                     size_t strid = cxt.get_string_identifier(addr);
                     const string* ps = cxt.get_string(strid);
                     if (!ps)
-                        return false;
+                        return formula_error_t::general_error;
                     str = *ps;
-                    return true;
+                    return formula_error_t::no_error;
                 }
                 case celltype_t::formula:
                 {
@@ -372,29 +549,30 @@ bool pop_stack_value_or_string(const iface::formula_model_access& cxt,
                         {
                             vt = stack_value_t::value;
                             val = res.get_value();
-                            return true;
+                            return formula_error_t::no_error;
                         }
                         case formula_result::result_type::string:
                         {
                             vt = stack_value_t::string;
                             str = res.get_string();
-                            return true;
+                            return formula_error_t::no_error;
                         }
                         case formula_result::result_type::error:
+                            return res.get_error();
                         default:
-                            return false;
+                            return formula_error_t::general_error;
                     }
                 }
                 default:
-                    return false;
+                    return formula_error_t::general_error;
             }
             break;
         }
         case stack_value_t::range_ref:
         default:
-            return false;
+            return formula_error_t::general_error;
     }
-    return true;
+    return formula_error_t::no_error;
 }
 
 void compare_values(formula_value_stack& vs, fopcode_t oc, double val1, double val2)
@@ -520,6 +698,539 @@ void compare_string_to_value(
     }
 }
 
+void apply_expression_op(
+    formula_value_stack& vs, fopcode_t oc,
+    bool is_val1, double val1, const std::string& str1,
+    bool is_val2, double val2, const std::string& str2)
+{
+    if (is_val1)
+    {
+        if (is_val2)
+        {
+            // Both are numeric values.
+            compare_values(vs, oc, val1, val2);
+        }
+        else
+        {
+            compare_value_to_string(vs, oc, val1, str2);
+        }
+    }
+    else
+    {
+        if (is_val2)
+        {
+            // Value 1 is string while value 2 is numeric.
+            compare_string_to_value(vs, oc, str1, val2);
+        }
+        else
+        {
+            // Both are strings.
+            compare_strings(vs, oc, str1, str2);
+        }
+    }
+}
+
+abs_range_t get_table_range(
+    const iface::formula_model_access& cxt, const abs_address_t& pos, const table_t& table)
+{
+    const iface::table_handler* table_hdl = cxt.get_table_handler();
+    if (!table_hdl)
+    {
+        IXION_DEBUG("failed to get a table_handler instance.");
+        throw formula_error(formula_error_t::ref_result_not_available);
+    }
+
+    if (table.name != empty_string_id)
+        return table_hdl->get_range(table.name, table.column_first, table.column_last, table.areas);
+
+    // Table name is not given.  Use the current cell position to infer
+    // which table to use.
+    return table_hdl->get_range(pos, table.column_first, table.column_last, table.areas);
+}
+
+/**
+ * Get the logical value of a stack value, but only when it's a numeric
+ * value or a reference to a cell with one, such that it can be determined
+ * without raising an error.
+ *
+ * @return true if the logical value has been determined, false otherwise.
+ */
+bool get_logical_scalar(const iface::formula_model_access& cxt, const stack_value& v, bool& result)
+{
+    switch (v.get_type())
+    {
+        case stack_value_t::value:
+            result = v.get_value() != 0.0;
+            return true;
+        case stack_value_t::single_ref:
+        {
+            const abs_address_t& addr = v.get_address();
+
+            switch (cxt.get_celltype(addr))
+            {
+                case celltype_t::numeric:
+                case celltype_t::boolean:
+                    result = cxt.get_numeric_value(addr) != 0.0;
+                    return true;
+                case celltype_t::formula:
+                {
+                    formula_result res = cxt.get_formula_result(addr);
+                    if (res.get_type() != formula_result::result_type::value)
+                        return false;
+
+                    result = res.get_value() != 0.0;
+                    return true;
+                }
+                default:
+                    ;
+            }
+            break;
+        }
+        default:
+            ;
+    }
+
+    return false;
+}
+
+}
+
+void formula_interpreter::run_program(const detail::formula_program& program)
+{
+    const detail::formula_program::instructions_type& insts = program.instructions();
+    error_handlers_type handlers;
+    size_t pc = 0;
+
+    while (pc < insts.size())
+    {
+        try
+        {
+            run_instructions(program, pc, handlers);
+        }
+        catch (const formula_error& e)
+        {
+            if (!catch_error(e.get_error(), pc, handlers))
+                throw;
+        }
+    }
+}
+
+bool formula_interpreter::catch_error(formula_error_t err, size_t& pc, error_handlers_type& handlers)
+{
+    // Unwind to the innermost handler that catches this error.
+    while (!handlers.empty() && handlers.back().na_only && err != formula_error_t::no_value_available)
+        handlers.pop_back();
+
+    if (handlers.empty())
+        return false;
+
+    error_handler h = handlers.back();
+    handlers.pop_back();
+    restore_stacks(h.stack_count, h.stack_size);
+    pc = h.target;
+    return true;
+}
+
+void formula_interpreter::raise_error(
+    const detail::formula_program& program, formula_error_t err, size_t& pc, error_handlers_type& handlers)
+{
+    if (catch_error(err, pc, handlers))
+        return;
+
+    // Nothing catches the error.  It becomes the result of the program.
+    clear_stacks();
+    get_stack().push_error(err);
+    pc = program.instructions().size();
+}
+
+void formula_interpreter::run_instructions(
+    const detail::formula_program& program, size_t& pc, error_handlers_type& handlers)
+{
+    using detail::formula_op_t;
+
+    const detail::formula_program::instructions_type& insts = program.instructions();
+
+    while (pc < insts.size())
+    {
+        const detail::formula_instruction& inst = insts[pc++];
+
+        switch (inst.op)
+        {
+            case formula_op_t::push_value:
+                get_stack().push_value(inst.value);
+                break;
+            case formula_op_t::push_string:
+            {
+                const std::string* p = m_context.get_string(inst.index);
+                if (!p)
+                    throw general_error("no string found for the specified string ID.");
+
+                get_stack().push_string(*p);
+                break;
+            }
+            case formula_op_t::push_single_ref:
+            {
+                abs_address_t abs_addr = program.get_address(inst.index).to_abs(m_pos);
+                if (abs_addr == m_pos)
+                {
+                    // self-referencing is not permitted.
+                    raise_error(program, formula_error_t::ref_result_not_available, pc, handlers);
+                    break;
+                }
+
+                get_stack().push_single_ref(abs_addr);
+                break;
+            }
+            case formula_op_t::push_range_ref:
+            {
+                abs_range_t abs_range = program.get_range(inst.index).to_abs(m_pos);
+                abs_range.reorder();
+                if (abs_range.contains(m_pos))
+                {
+                    raise_error(program, formula_error_t::ref_result_not_available, pc, handlers);
+                    break;
+                }
+
+                abs_address_t abs_addr;
+                if (mp_element && map_range_to_element(abs_range, abs_addr))
+                {
+                    if (abs_range_t(m_pos, mp_element->group_size.row, mp_element->group_size.column).contains(abs_addr))
+                    {
+                        // The cell belongs to the same group.
+                        raise_error(program, formula_error_t::ref_result_not_available, pc, handlers);
+                        break;
+                    }
+
+                    get_stack().push_single_ref(abs_addr);
+                    break;
+                }
+
+                get_stack().push_range_ref(abs_range);
+                break;
+            }
+            case formula_op_t::push_table_ref:
+                get_stack().push_range_ref(get_table_range(m_context, m_pos, program.get_table(inst.index)));
+                break;
+            case formula_op_t::negate:
+            case formula_op_t::to_value:
+            {
+                double val = 0.0;
+                formula_error_t err = get_stack().pop_value_or_error(val);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                get_stack().push_value(inst.op == formula_op_t::negate ? val * -1.0 : val);
+                break;
+            }
+            case formula_op_t::to_string:
+            {
+                formula_error_t err = get_stack().find_error(get_stack().size() - 1);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                get_stack().push_string(get_stack().pop_string());
+                break;
+            }
+            case formula_op_t::to_value_or_string:
+            {
+                double val = 0.0;
+                string str;
+                stack_value_t vt;
+                formula_error_t err = pop_stack_value_or_string(m_context, get_stack(), vt, val, str);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                if (vt == stack_value_t::value)
+                    get_stack().push_value(val);
+                else
+                    get_stack().push_string(std::move(str));
+                break;
+            }
+            case formula_op_t::expression:
+            {
+                double val1 = 0.0, val2 = 0.0;
+                string str1, str2;
+                stack_value_t vt;
+
+                formula_error_t err = pop_stack_value_or_string(m_context, get_stack(), vt, val2, str2);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+                bool is_val2 = vt == stack_value_t::value;
+
+                // The left operand has already been resolved.
+                pop_stack_value_or_string(m_context, get_stack(), vt, val1, str1);
+                bool is_val1 = vt == stack_value_t::value;
+
+                apply_expression_op(get_stack(), inst.opcode, is_val1, val1, str1, is_val2, val2, str2);
+                break;
+            }
+            case formula_op_t::multiply:
+            case formula_op_t::divide:
+            case formula_op_t::exponent:
+            {
+                double val1 = 0.0, val2 = 0.0;
+                formula_error_t err2 = get_stack().pop_value_or_error(val2);
+                formula_error_t err = get_stack().pop_value_or_error(val1);
+
+                // The error of the left operand comes first.
+                if (err == formula_error_t::no_error)
+                    err = err2;
+
+                if (err == formula_error_t::no_error && inst.op == formula_op_t::divide && val2 == 0.0)
+                    err = formula_error_t::division_by_zero;
+
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                switch (inst.op)
+                {
+                    case formula_op_t::multiply:
+                        get_stack().push_value(val1*val2);
+                        break;
+                    case formula_op_t::divide:
+                        get_stack().push_value(val1/val2);
+                        break;
+                    default:
+                        get_stack().push_value(std::pow(val1, val2));
+                }
+                break;
+            }
+            case formula_op_t::concat:
+            {
+                formula_error_t err = get_stack().find_error(get_stack().size() - 2);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                std::string s2 = get_stack().pop_string();
+                std::string s1 = get_stack().pop_string();
+                get_stack().push_string(s1 + s2);
+                break;
+            }
+            case formula_op_t::begin_function:
+                push_stack();
+                break;
+            case formula_op_t::call_function:
+            {
+                // An error value passed as an argument becomes the result.
+                formula_error_t err = get_stack().find_error(0);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                // Function call pops all stack values pushed onto the stack
+                // since the matching begin_function, and pushes the result.
+                m_funcs.interpret(inst.func, get_stack());
+                assert(get_stack().size() == 1);
+                pop_stack();
+                break;
+            }
+            case formula_op_t::jump:
+                pc = inst.index;
+                break;
+            case formula_op_t::jump_if_false:
+            {
+                double val = 0.0;
+                formula_error_t err = get_stack().pop_value_or_error(val);
+                if (err != formula_error_t::no_error)
+                    raise_error(program, err, pc, handlers);
+                else if (val == 0.0)
+                    pc = inst.index;
+                break;
+            }
+            case formula_op_t::choose:
+            {
+                double val = 0.0;
+                formula_error_t err = get_stack().pop_value_or_error(val);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                double choice = std::trunc(val);
+                if (choice < 1.0 || choice > inst.index)
+                {
+                    raise_error(program, formula_error_t::invalid_value_type, pc, handlers);
+                    break;
+                }
+
+                // Move to the jump to the chosen argument.
+                pc += static_cast<size_t>(choice) - 1;
+                break;
+            }
+            case formula_op_t::catch_error:
+            case formula_op_t::catch_na:
+                handlers.push_back(
+                    { inst.index, inst.op == formula_op_t::catch_na, m_stacks.size(), get_stack().size() });
+                break;
+            case formula_op_t::end_catch:
+            {
+                formula_error_t err = get_stack().get_error(get_stack().size() - 1);
+                if (err != formula_error_t::no_error)
+                {
+                    raise_error(program, err, pc, handlers);
+                    break;
+                }
+
+                handlers.pop_back();
+                pc = inst.index;
+                break;
+            }
+            case formula_op_t::end_function_if_false:
+            case formula_op_t::end_function_if_true:
+            {
+                bool end_value = inst.op == formula_op_t::end_function_if_true;
+                bool v;
+                if (get_logical_scalar(m_context, get_stack().back(), v) && v == end_value)
+                {
+                    // The remaining arguments can't change the result.
+                    get_stack().clear();
+                    get_stack().push_value(v ? 1.0 : 0.0);
+                    pop_stack();
+                    pc = inst.index;
+                }
+                break;
+            }
+        }
+    }
+}
+
+bool formula_interpreter::run_program_on_group(const detail::formula_program& program)
+{
+    if (!program.is_element_wise())
+        return false;
+
+    formula_group_t group = m_parent_cell->get_group_properties();
+    if (!group.grouped || (group.size.row == 1 && group.size.column == 1))
+        return false;
+
+    detail::element_wise_evaluator evaluator(m_context, m_pos, group.size);
+    if (evaluator.run(program))
+    {
+        get_stack().push_matrix(evaluator.get_result());
+        return true;
+    }
+
+    // Operands such as strings and errors need to be evaluated one cell at
+    // a time.
+    matrix mx = run_program_per_element(program, group.size);
+    get_stack().push_matrix(std::move(mx));
+    return true;
+}
+
+matrix formula_interpreter::run_program_per_element(
+    const detail::formula_program& program, const rc_size_t& group_size)
+{
+    matrix mx(group_size.row, group_size.column);
+    group_element element{m_pos, group_size};
+
+    for (col_t col = 0; col < group_size.column; ++col)
+    {
+        for (row_t row = 0; row < group_size.row; ++row)
+        {
+            element.pos = abs_address_t(m_pos.sheet, m_pos.row + row, m_pos.column + col);
+            mp_element = &element;
+            clear_stacks();
+
+            try
+            {
+                run_program(program);
+                set_matrix_element(m_context, get_stack(), mx, row, col);
+            }
+            catch (const formula_error& e)
+            {
+                mx.set(row, col, e.get_error());
+            }
+
+            mp_element = nullptr;
+        }
+    }
+
+    clear_stacks();
+    return mx;
+}
+
+bool formula_interpreter::map_range_to_element(const abs_range_t& range, abs_address_t& addr) const
+{
+    assert(mp_element);
+    const rc_size_t& size = mp_element->group_size;
+
+    row_t rows = range.last.row - range.first.row + 1;
+    col_t cols = range.last.column - range.first.column + 1;
+
+    if ((rows != size.row && rows != 1) || (cols != size.column && cols != 1))
+        return false;
+
+    addr = range.first;
+    if (rows != 1)
+        addr.row += mp_element->pos.row - m_pos.row;
+    if (cols != 1)
+        addr.column += mp_element->pos.column - m_pos.column;
+
+    return true;
+}
+
+bool formula_interpreter::run_program_on_window(const detail::formula_program& program)
+{
+    if (m_parent_cell->get_group_properties().grouped)
+        return false;
+
+    detail::sliding_window_evaluator evaluator(m_context, m_pos);
+    double value;
+    if (!evaluator.run(program, value))
+        return false;
+
+    get_stack().push_value(value);
+    return true;
+}
+
+void formula_interpreter::push_token_to_handler(const formula_token& t)
+{
+    fopcode_t oc = t.get_opcode();
+
+    switch (oc)
+    {
+        case fop_single_ref:
+            mp_handler->push_single_ref(t.get_single_ref(), m_pos);
+            break;
+        case fop_range_ref:
+            mp_handler->push_range_ref(t.get_range_ref(), m_pos);
+            break;
+        case fop_table_ref:
+            mp_handler->push_table_ref(t.get_table_ref());
+            break;
+        case fop_value:
+            mp_handler->push_value(t.get_value());
+            break;
+        case fop_string:
+            mp_handler->push_string(t.get_index());
+            break;
+        case fop_function:
+            mp_handler->push_function(formula_functions::get_function_opcode(t));
+            break;
+        default:
+            mp_handler->push_token(oc);
+    }
 }
 
 void formula_interpreter::expression()
@@ -539,8 +1250,9 @@ void formula_interpreter::expression()
         bool is_val1 = true, is_val2 = true;
 
         stack_value_t vt;
-        if (!pop_stack_value_or_string(m_context, get_stack(), vt, val1, str1))
-            throw formula_error(formula_error_t::general_error);
+        formula_error_t err = pop_stack_value_or_string(m_context, get_stack(), vt, val1, str1);
+        if (err != formula_error_t::no_error)
+            throw formula_error(err);
         is_val1 = vt == stack_value_t::value;
 
         if (mp_handler)
@@ -549,35 +1261,12 @@ void formula_interpreter::expression()
         next();
         term();
 
-        if (!pop_stack_value_or_string(m_context, get_stack(), vt, val2, str2))
-            throw formula_error(formula_error_t::general_error);
+        err = pop_stack_value_or_string(m_context, get_stack(), vt, val2, str2);
+        if (err != formula_error_t::no_error)
+            throw formula_error(err);
         is_val2 = vt == stack_value_t::value;
 
-        if (is_val1)
-        {
-            if (is_val2)
-            {
-                // Both are numeric values.
-                compare_values(get_stack(), oc, val1, val2);
-            }
-            else
-            {
-                compare_value_to_string(get_stack(), oc, val1, str2);
-            }
-        }
-        else
-        {
-            if (is_val2)
-            {
-                // Value 1 is string while value 2 is numeric.
-                compare_string_to_value(get_stack(), oc, str1, val2);
-            }
-            else
-            {
-                // Both are strings.
-                compare_strings(get_stack(), oc, str1, str2);
-            }
-        }
+        apply_expression_op(get_stack(), oc, is_val1, val1, str1, is_val2, val2, str2);
     }
 }
 
@@ -790,31 +1479,12 @@ void formula_interpreter::range_ref()
 
 void formula_interpreter::table_ref()
 {
-    const iface::table_handler* table_hdl = m_context.get_table_handler();
-    if (!table_hdl)
-    {
-        IXION_DEBUG("failed to get a table_handler instance.");
-        throw formula_error(formula_error_t::ref_result_not_available);
-    }
-
     table_t table = token().get_table_ref();
 
     if (mp_handler)
         mp_handler->push_table_ref(table);
 
-    abs_range_t range(abs_range_t::invalid);
-    if (table.name != empty_string_id)
-    {
-        range = table_hdl->get_range(table.name, table.column_first, table.column_last, table.areas);
-    }
-    else
-    {
-        // Table name is not given.  Use the current cell position to infer
-        // which table to use.
-        range = table_hdl->get_range(m_pos, table.column_first, table.column_last, table.areas);
-    }
-
-    get_stack().push_range_ref(range);
+    get_stack().push_range_ref(get_table_range(m_context, m_pos, table));
     next();
 }
 
@@ -849,10 +1519,7 @@ void formula_interpreter::function()
     if (mp_handler)
         mp_handler->push_function(func_oc);
 
-    push_stack();
-
     IXION_TRACE("function='" << get_formula_function_name(func_oc) << "'");
-    assert(get_stack().empty());
 
     if (next_token().get_opcode() != fop_open)
         throw invalid_expression("expecting a '(' after a function name.");
@@ -860,6 +1527,17 @@ void formula_interpreter::function()
     if (mp_handler)
         mp_handler->push_token(fop_open);
 
+    size_t arg_count = detail::count_function_arguments(m_cur_token_itr, m_end_token_pos);
+    if (detail::is_control_flow_call(func_oc, arg_count))
+    {
+        next();
+        control_flow_function(func_oc, arg_count);
+        return;
+    }
+
+    push_stack();
+    assert(get_stack().empty());
+
     fopcode_t oc = next_token().get_opcode();
     bool expect_sep = false;
     while (oc != fop_close)
@@ -887,14 +1565,196 @@ void formula_interpreter::function()
 
     next();
 
+    // An error value passed as an argument becomes the result.
+    formula_error_t err = get_stack().find_error(0);
+    if (err != formula_error_t::no_error)
+        throw formula_error(err);
+
     // Function call pops all stack values pushed onto the stack this far, and
     // pushes the result onto the stack.
-    formula_functions(m_context).interpret(func_oc, get_stack());
+    m_funcs.interpret(func_oc, get_stack());
     assert(get_stack().size() == 1);
 
     pop_stack();
 }
 
+void formula_interpreter::control_flow_function(formula_function_t func_oc, size_t arg_count)
+{
+    switch (func_oc)
+    {
+        case formula_function_t::func_if:
+        {
+            expression();
+            argument_end(false);
+
+            if (get_stack().pop_value() != 0.0)
+            {
+                expression();
+                argument_end(false);
+                skip_argument();
+            }
+            else
+            {
+                skip_argument();
+                argument_end(false);
+                expression();
+            }
+            argument_end(true);
+            break;
+        }
+        case formula_function_t::func_choose:
+        {
+            expression();
+            argument_end(false);
+
+            size_t choice_count = arg_count - 1;
+            double choice = std::trunc(get_stack().pop_value());
+            if (choice < 1.0 || choice > choice_count)
+                throw formula_error(formula_error_t::invalid_value_type);
+
+            for (size_t i = 1; i <= choice_count; ++i)
+            {
+                if (i == choice)
+                    expression();
+                else
+                    skip_argument();
+
+                argument_end(i == choice_count);
+            }
+            break;
+        }
+        case formula_function_t::func_iferror:
+        case formula_function_t::func_ifna:
+        {
+            local_tokens_type::const_iterator arg_end = find_argument_end();
+            size_t stack_count = m_stacks.size();
+            size_t stack_size = get_stack().size();
+            bool caught = false;
+
+            try
+            {
+                expression();
+
+                formula_error_t err = get_stack().get_error(get_stack().size() - 1);
+                if (err != formula_error_t::no_error)
+                    throw formula_error(err);
+            }
+            catch (const formula_error& e)
+            {
+                if (func_oc == formula_function_t::func_ifna && e.get_error() != formula_error_t::no_value_available)
+                    throw;
+
+                restore_stacks(stack_count, stack_size);
+                skip_to(arg_end);
+                caught = true;
+            }
+
+            argument_end(false);
+
+            if (caught)
+                expression();
+            else
+                skip_argument();
+
+            argument_end(true);
+            break;
+        }
+        case formula_function_t::func_and:
+        case formula_function_t::func_or:
+        {
+            bool end_value = func_oc == formula_function_t::func_or;
+            push_stack();
+
+            for (size_t i = 0; i < arg_count; ++i)
+            {
+                expression();
+
+                bool v;
+                if (get_logical_scalar(m_context, get_stack().back(), v) && v == end_value)
+                {
+                    // The remaining arguments can't change the result.
+                    for (++i; i < arg_count; ++i)
+                    {
+                        argument_end(false);
+                        skip_argument();
+                    }
+                    argument_end(true);
+
+                    get_stack().clear();
+                    get_stack().push_value(v ? 1.0 : 0.0);
+                    pop_stack();
+                    return;
+                }
+
+                argument_end(i == arg_count - 1);
+            }
+
+            m_funcs.interpret(func_oc, get_stack());
+            assert(get_stack().size() == 1);
+            pop_stack();
+            break;
+        }
+        default:
+            throw invalid_expression("function does not control the evaluation of its arguments.");
+    }
+}
+
+void formula_interpreter::argument_end(bool last)
+{
+    fopcode_t oc = token_or_throw().get_opcode();
+
+    if (oc != (last ? fop_close : fop_sep))
+        throw invalid_expression("argument separator is expected, but not found.");
+
+    if (mp_handler)
+        mp_handler->push_token(oc);
+
+    next();
+}
+
+formula_interpreter::local_tokens_type::const_iterator formula_interpreter::find_argument_end() const
+{
+    size_t depth = 0;
+
+    for (auto it = m_cur_token_itr; it != m_end_token_pos; ++it)
+    {
+        switch ((*it)->get_opcode())
+        {
+            case fop_open:
+                ++depth;
+                break;
+            case fop_close:
+                if (!depth)
+                    return it;
+                --depth;
+                break;
+            case fop_sep:
+                if (!depth)
+                    return it;
+                break;
+            default:
+                ;
+        }
+    }
+
+    return m_end_token_pos;
+}
+
+void formula_interpreter::skip_argument()
+{
+    skip_to(find_argument_end());
+}
+
+void formula_interpreter::skip_to(local_tokens_type::const_iterator pos)
+{
+    // The session handler still gets to see the skipped tokens.
+    for (; m_cur_token_itr != pos; ++m_cur_token_itr)
+    {
+        if (mp_handler)
+            push_token_to_handler(**m_cur_token_itr);
+    }
+}
+
 void formula_interpreter::clear_stacks()
 {
     m_stacks.clear();
@@ -906,6 +1766,17 @@ void formula_interpreter::push_stack()
     m_stacks.emplace_back(m_context);
 }
 
+void formula_interpreter::restore_stacks(size_t stack_count, size_t stack_size)
+{
+    assert(m_stacks.size() >= stack_count);
+
+    while (m_stacks.size() > stack_count)
+        m_stacks.pop_back();
+
+    while (get_stack().size() > stack_size)
+        get_stack().release_back();
+}
+
 void formula_interpreter::pop_stack()
 {
     assert(m_stacks.size() >= 2);
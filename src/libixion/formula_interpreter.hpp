@@ -11,17 +11,26 @@
 #include "ixion/global.hpp"
 #include "ixion/formula_tokens.hpp"
 #include "ixion/formula_result.hpp"
+#include "ixion/formula_function_opcode.hpp"
 
+#include "formula_functions.hpp"
 #include "formula_value_stack.hpp"
 
 #include <sstream>
 #include <unordered_set>
-#include <deque>
+#include <vector>
 
 namespace ixion {
 
 class formula_cell;
 
+namespace detail {
+
+class formula_program;
+struct expanded_formula_tokens;
+
+}
+
 namespace iface {
 
 class formula_model_access;
@@ -45,7 +54,36 @@ class session_handler;
 class formula_interpreter
 {
     using name_set = std::unordered_set<std::string>;
-    using fv_stacks_type = std::deque<formula_value_stack>;
+    using fv_stacks_type = std::vector<formula_value_stack>;
+
+    /**
+     * Error handler set by an IFERROR or IFNA call in a compiled program.
+     */
+    struct error_handler
+    {
+        /** Position of the instructions to run when an error gets caught. */
+        size_t target;
+
+        /** Whether to only catch the #N/A error. */
+        bool na_only;
+
+        /** Number of stacks at the time the handler was set. */
+        size_t stack_count;
+
+        /** Size of the current stack at the time the handler was set. */
+        size_t stack_size;
+    };
+
+    using error_handlers_type = std::vector<error_handler>;
+
+    /**
+     * Cell of a formula group being evaluated on its own.
+     */
+    struct group_element
+    {
+        abs_address_t pos;
+        rc_size_t group_size;
+    };
 
 public:
     typedef ::std::vector<const formula_token*> local_tokens_type;
@@ -57,20 +95,131 @@ public:
     formula_interpreter(const formula_cell* cell, iface::formula_model_access& cxt);
     ~formula_interpreter();
 
+    /**
+     * Prepare the interpreter for interpreting another cell in the same
+     * model.  The buffers allocated for the previous cell are kept for
+     * reuse.
+     *
+     * @param cell formula cell to interpret next.
+     */
+    void reset(const formula_cell* cell);
+
+    const iface::formula_model_access& get_context() const;
+
     void set_origin(const abs_address_t& pos);
     bool interpret();
     formula_result transfer_result();
     formula_error_t get_error() const;
 
 private:
+    bool interpret_cell();
+
     /**
      * Expand all named expressions into a flat set of tokens.  This is also
      * where we detect circular referencing of named expressions.
      */
     void init_tokens();
 
+    /**
+     * Get the tokens with all named expressions expanded, either from the
+     * cache in the tokens store, or by expanding them and caching the result
+     * when the model tracks revisions of its named expressions.
+     *
+     * @return expanded tokens, or nullptr if they cannot be cached.
+     */
+    std::shared_ptr<const detail::expanded_formula_tokens> get_expanded_tokens(
+        const formula_tokens_store& ts);
+
     void pop_result();
 
+    /**
+     * Run a pre-compiled program of the formula expression.  This gives the
+     * same result as parsing the tokens but with less overhead.
+     */
+    void run_program(const detail::formula_program& program);
+
+    /**
+     * Run the instructions of a program from a position until either the
+     * end of the program or an error.
+     *
+     * @param program program to run.
+     * @param pc position of the next instruction to run.
+     * @param handlers error handlers that are currently set.
+     */
+    void run_instructions(const detail::formula_program& program, size_t& pc, error_handlers_type& handlers);
+
+    /**
+     * Unwind to the innermost error handler that catches an error.
+     *
+     * @param err error to catch.
+     * @param pc position of the next instruction to run, set to the
+     *           instructions of the handler when caught.
+     * @param handlers error handlers that are currently set.
+     *
+     * @return true if a handler has caught the error, false otherwise.
+     */
+    bool catch_error(formula_error_t err, size_t& pc, error_handlers_type& handlers);
+
+    /**
+     * Pass an error to the innermost error handler that catches it, or end
+     * the program with the error as its result when none does.  This
+     * handles errors without throwing them.
+     */
+    void raise_error(
+        const detail::formula_program& program, formula_error_t err, size_t& pc, error_handlers_type& handlers);
+
+    /**
+     * Run a pre-compiled program element-wise over all the cells of the
+     * formula group in one go, when the parent cell belongs to a group and
+     * the program permits it.  When some of the operands can't be evaluated
+     * element-wise, the program gets run on each cell of the group instead.
+     *
+     * @return true if the program has been run, false if it needs to be run
+     *         normally.
+     */
+    bool run_program_on_group(const detail::formula_program& program);
+
+    /**
+     * Run a pre-compiled program on each cell of the formula group, with
+     * each range reference that maps onto the group referring to the single
+     * cell that corresponds to the cell being evaluated.
+     *
+     * @param program element-wise program to run.
+     * @param group_size size of the formula group.
+     *
+     * @return matrix of the results of all the cells in the group.
+     */
+    matrix run_program_per_element(const detail::formula_program& program, const rc_size_t& group_size);
+
+    /**
+     * Map a range reference onto the cell of the group being evaluated on
+     * its own.
+     *
+     * @param range range to map.
+     * @param addr address of the mapped cell.
+     *
+     * @return true if the range has been mapped, false if it doesn't map
+     *         onto the group.
+     */
+    bool map_range_to_element(const abs_range_t& range, abs_address_t& addr) const;
+
+    /**
+     * Run a pre-compiled program over the whole run of vertically adjacent
+     * cells sharing the same relative range aggregate, when the parent cell
+     * is part of such a run.  The results of the other cells in the run get
+     * stored in the range result cache.
+     *
+     * @return true if the program has been run, false if it needs to be run
+     *         normally.
+     */
+    bool run_program_on_window(const detail::formula_program& program);
+
+    /**
+     * Pass a token to the session handler.  The compiled program doesn't
+     * visit the tokens, so they need to be passed up-front.
+     */
+    void push_token_to_handler(const formula_token& t);
+
     void expand_named_expression(const named_expression_t* expr, name_set& used_names);
 
     void ensure_token_exists() const;
@@ -97,15 +246,45 @@ private:
     void literal();
     void function();
 
+    /**
+     * Handle a call to a function that controls which of its arguments get
+     * evaluated.  The arguments that can't affect the result are skipped.
+     */
+    void control_flow_function(formula_function_t func_oc, size_t arg_count);
+
+    /**
+     * Move past the separator or the closing parenthesis that ends a
+     * function argument.
+     */
+    void argument_end(bool last);
+
+    /**
+     * @return position of the separator or the closing parenthesis that
+     *         ends the current function argument.
+     */
+    local_tokens_type::const_iterator find_argument_end() const;
+
+    void skip_argument();
+    void skip_to(local_tokens_type::const_iterator pos);
+
     void clear_stacks();
     void push_stack();
     void pop_stack();
 
+    /**
+     * Discard all stacks and stack values pushed since an earlier state.
+     *
+     * @param stack_count number of stacks to keep.
+     * @param stack_size number of values to keep in the last stack kept.
+     */
+    void restore_stacks(size_t stack_count, size_t stack_size);
+
     formula_value_stack& get_stack();
 
 private:
     const formula_cell* m_parent_cell;
     iface::formula_model_access& m_context;
+    formula_functions m_funcs;
     std::unique_ptr<iface::session_handler> mp_handler;
     abs_address_t m_pos;
 
@@ -116,6 +295,12 @@ private:
 
     formula_result m_result;
     formula_error_t m_error;
+
+    /**
+     * Cell being evaluated, when a formula group is evaluated one cell at
+     * a time.
+     */
+    const group_element* mp_element;
 };
 
 }
@@ -0,0 +1,715 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "formula_program.hpp"
+#include "formula_functions.hpp"
+
+#include "ixion/formula_tokens.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+/**
+ * Thrown when the tokens don't form an expression the compiler can handle.
+ * Such tokens get interpreted directly, which reports the error.
+ */
+class not_compilable {};
+
+bool valid_expression_op(fopcode_t oc)
+{
+    switch (oc)
+    {
+        case fop_plus:
+        case fop_minus:
+        case fop_equal:
+        case fop_not_equal:
+        case fop_less:
+        case fop_less_equal:
+        case fop_greater:
+        case fop_greater_equal:
+            return true;
+        default:
+            ;
+    }
+    return false;
+}
+
+}
+
+/**
+ * Compiles formula tokens by walking them the same way the interpreter's
+ * recursive descent parser does, emitting instructions in the order in
+ * which the interpreter would evaluate them.
+ *
+ * Operations whose operands are all numeric constants are folded into a
+ * single constant as they get emitted, so that they don't get evaluated
+ * each time the formula is calculated.  The tokens are left as they are.
+ */
+class formula_compiler
+{
+    using iterator_type = std::vector<const formula_token*>::const_iterator;
+
+    formula_program& m_program;
+    iterator_type m_cur;
+    iterator_type m_end;
+
+    /**
+     * Position of the first instruction that may be folded.  Instructions
+     * before the target of a jump can't be folded into the ones after it.
+     */
+    size_t m_fold_start;
+
+    bool has_token() const
+    {
+        return m_cur != m_end;
+    }
+
+    const formula_token& token_or_throw() const
+    {
+        if (!has_token())
+            throw not_compilable();
+
+        return **m_cur;
+    }
+
+    const formula_token& next_token()
+    {
+        ++m_cur;
+        return token_or_throw();
+    }
+
+    formula_instruction& emit(formula_op_t op)
+    {
+        m_program.m_instructions.emplace_back(op);
+        return m_program.m_instructions.back();
+    }
+
+    /**
+     * Check whether the last n instructions all push numeric constants, and
+     * can be folded.
+     */
+    bool last_push_constants(size_t n) const
+    {
+        const formula_program::instructions_type& insts = m_program.m_instructions;
+        if (insts.size() < n || insts.size() - n < m_fold_start)
+            return false;
+
+        return std::all_of(insts.end() - n, insts.end(),
+            [](const formula_instruction& inst) { return inst.op == formula_op_t::push_value; });
+    }
+
+    /**
+     * Replace the instructions from a position onward with a single push of
+     * a numeric constant.
+     */
+    void fold(size_t pos, double value)
+    {
+        formula_program::instructions_type& insts = m_program.m_instructions;
+        insts.erase(insts.begin() + pos, insts.end());
+        emit(formula_op_t::push_value).value = value;
+    }
+
+    void emit_negate()
+    {
+        if (last_push_constants(1))
+            fold(m_program.m_instructions.size() - 1, m_program.m_instructions.back().value * -1.0);
+        else
+            emit(formula_op_t::negate);
+    }
+
+    void emit_expression(fopcode_t oc)
+    {
+        // The left operand is followed by a to_value_or_string instruction,
+        // which leaves a numeric constant as it is.
+        const formula_program::instructions_type& insts = m_program.m_instructions;
+        size_t n = insts.size();
+        if (n >= 3 && n - 3 >= m_fold_start &&
+            insts[n-3].op == formula_op_t::push_value &&
+            insts[n-2].op == formula_op_t::to_value_or_string &&
+            insts[n-1].op == formula_op_t::push_value)
+        {
+            double lhs = insts[n-3].value, rhs = insts[n-1].value;
+
+            switch (oc)
+            {
+                case fop_plus:
+                    fold(n - 3, lhs + rhs);
+                    return;
+                case fop_minus:
+                    fold(n - 3, lhs - rhs);
+                    return;
+                case fop_equal:
+                    fold(n - 3, lhs == rhs);
+                    return;
+                case fop_not_equal:
+                    fold(n - 3, lhs != rhs);
+                    return;
+                case fop_less:
+                    fold(n - 3, lhs < rhs);
+                    return;
+                case fop_less_equal:
+                    fold(n - 3, lhs <= rhs);
+                    return;
+                case fop_greater:
+                    fold(n - 3, lhs > rhs);
+                    return;
+                case fop_greater_equal:
+                    fold(n - 3, lhs >= rhs);
+                    return;
+                default:
+                    ;
+            }
+        }
+
+        emit(formula_op_t::expression).opcode = oc;
+    }
+
+    void emit_arithmetic(formula_op_t op)
+    {
+        if (last_push_constants(2))
+        {
+            const formula_program::instructions_type& insts = m_program.m_instructions;
+            size_t pos = insts.size() - 2;
+            double lhs = insts[pos].value, rhs = insts[pos+1].value;
+
+            switch (op)
+            {
+                case formula_op_t::multiply:
+                    fold(pos, lhs * rhs);
+                    return;
+                case formula_op_t::divide:
+                    // Division by zero is left to raise its error at run time.
+                    if (rhs != 0.0)
+                    {
+                        fold(pos, lhs / rhs);
+                        return;
+                    }
+                    break;
+                case formula_op_t::exponent:
+                    fold(pos, std::pow(lhs, rhs));
+                    return;
+                default:
+                    ;
+            }
+        }
+
+        emit(op);
+    }
+
+    /**
+     * Emit a function call, or fold it into a constant when the function
+     * has no side effects and all of its arguments are constants.
+     *
+     * @param func opcode of the function.
+     * @param begin position of the begin_function instruction of the call.
+     */
+    void emit_call(formula_function_t func, size_t begin)
+    {
+        size_t arg_count = m_program.m_instructions.size() - begin - 1;
+
+        if (begin >= m_fold_start && last_push_constants(arg_count))
+        {
+            switch (func)
+            {
+                case formula_function_t::func_int:
+                    if (arg_count == 1)
+                    {
+                        fold(begin, std::floor(m_program.m_instructions.back().value));
+                        return;
+                    }
+                    break;
+                case formula_function_t::func_pi:
+                    if (!arg_count)
+                    {
+                        fold(begin, M_PI);
+                        return;
+                    }
+                    break;
+                default:
+                    ;
+            }
+        }
+
+        emit(formula_op_t::call_function).func = func;
+    }
+
+    /**
+     * Check whether the last emitted instruction always leaves a numeric
+     * value at the top of the stack.
+     */
+    bool last_pushes_value() const
+    {
+        switch (m_program.m_instructions.back().op)
+        {
+            case formula_op_t::push_value:
+            case formula_op_t::negate:
+            case formula_op_t::to_value:
+            case formula_op_t::expression:
+            case formula_op_t::multiply:
+            case formula_op_t::divide:
+            case formula_op_t::exponent:
+                return true;
+            default:
+                ;
+        }
+        return false;
+    }
+
+    void expression()
+    {
+        term();
+        while (has_token())
+        {
+            fopcode_t oc = (*m_cur)->get_opcode();
+            if (!valid_expression_op(oc))
+                return;
+
+            emit(formula_op_t::to_value_or_string);
+            ++m_cur;
+            term();
+            emit_expression(oc);
+        }
+    }
+
+    void term()
+    {
+        factor();
+        if (!has_token())
+            return;
+
+        formula_op_t op;
+        switch ((*m_cur)->get_opcode())
+        {
+            case fop_multiply:
+                op = formula_op_t::multiply;
+                break;
+            case fop_exponent:
+                op = formula_op_t::exponent;
+                break;
+            case fop_concat:
+                op = formula_op_t::concat;
+                break;
+            case fop_divide:
+                op = formula_op_t::divide;
+                break;
+            default:
+                return;
+        }
+
+        // The left operand gets resolved before the right one is evaluated.
+        if (op == formula_op_t::concat)
+        {
+            if (m_program.m_instructions.back().op != formula_op_t::push_string)
+                emit(formula_op_t::to_string);
+        }
+        else if (!last_pushes_value())
+            emit(formula_op_t::to_value);
+
+        ++m_cur;
+        term();
+
+        if (op == formula_op_t::concat)
+            emit(op);
+        else
+            emit_arithmetic(op);
+    }
+
+    void factor()
+    {
+        bool negative_sign = false;
+
+        switch (token_or_throw().get_opcode())
+        {
+            case fop_minus:
+                negative_sign = true;
+                // fall through
+            case fop_plus:
+                ++m_cur;
+                break;
+            default:
+                ;
+        }
+
+        const formula_token& t = token_or_throw();
+
+        switch (t.get_opcode())
+        {
+            case fop_open:
+            {
+                ++m_cur;
+                expression();
+                if (token_or_throw().get_opcode() != fop_close)
+                    throw not_compilable();
+                ++m_cur;
+                break;
+            }
+            case fop_value:
+                emit(formula_op_t::push_value).value = t.get_value();
+                ++m_cur;
+                break;
+            case fop_string:
+                emit(formula_op_t::push_string).index = t.get_index();
+                ++m_cur;
+                break;
+            case fop_single_ref:
+                emit(formula_op_t::push_single_ref).index = m_program.m_addresses.size();
+                m_program.m_addresses.push_back(t.get_single_ref());
+                ++m_cur;
+                break;
+            case fop_range_ref:
+                emit(formula_op_t::push_range_ref).index = m_program.m_ranges.size();
+                m_program.m_ranges.push_back(t.get_range_ref());
+                ++m_cur;
+                break;
+            case fop_table_ref:
+                emit(formula_op_t::push_table_ref).index = m_program.m_tables.size();
+                m_program.m_tables.push_back(t.get_table_ref());
+                ++m_cur;
+                break;
+            case fop_function:
+                function();
+                break;
+            default:
+                // This includes unexpanded named expressions.
+                throw not_compilable();
+        }
+
+        if (negative_sign)
+            emit_negate();
+    }
+
+    size_t emit_jump(formula_op_t op)
+    {
+        emit(op);
+        return m_program.m_instructions.size() - 1;
+    }
+
+    /**
+     * Point a previously emitted jump to the next instruction to be
+     * emitted.
+     */
+    void set_jump_target(size_t pos)
+    {
+        m_program.m_instructions[pos].index = m_program.m_instructions.size();
+        m_fold_start = m_program.m_instructions.size();
+    }
+
+    /**
+     * Compile one argument of a function call, and move past the separator
+     * or the closing parenthesis that follows it.
+     */
+    void argument(bool last)
+    {
+        expression();
+        if (token_or_throw().get_opcode() != (last ? fop_close : fop_sep))
+            throw not_compilable();
+        ++m_cur;
+    }
+
+    void function()
+    {
+        formula_function_t func_oc = formula_functions::get_function_opcode(**m_cur);
+
+        if (next_token().get_opcode() != fop_open)
+            throw not_compilable();
+
+        size_t arg_count = count_function_arguments(m_cur, m_end);
+        if (is_control_flow_call(func_oc, arg_count))
+        {
+            ++m_cur;
+            control_flow_function(func_oc, arg_count);
+            return;
+        }
+
+        size_t begin = m_program.m_instructions.size();
+        emit(formula_op_t::begin_function);
+
+        fopcode_t oc = next_token().get_opcode();
+        bool expect_sep = false;
+        while (oc != fop_close)
+        {
+            if (expect_sep)
+            {
+                if (oc != fop_sep)
+                    throw not_compilable();
+                ++m_cur;
+                expect_sep = false;
+            }
+            else
+            {
+                expression();
+                expect_sep = true;
+            }
+            oc = token_or_throw().get_opcode();
+        }
+
+        ++m_cur;
+        emit_call(func_oc, begin);
+    }
+
+    void control_flow_function(formula_function_t func_oc, size_t arg_count)
+    {
+        switch (func_oc)
+        {
+            case formula_function_t::func_if:
+            {
+                argument(false);
+                size_t to_else = emit_jump(formula_op_t::jump_if_false);
+                argument(false);
+                size_t to_end = emit_jump(formula_op_t::jump);
+                set_jump_target(to_else);
+                argument(true);
+                set_jump_target(to_end);
+                break;
+            }
+            case formula_function_t::func_choose:
+            {
+                argument(false);
+
+                // Jump table with one jump per choice.
+                size_t choice_count = arg_count - 1;
+                emit(formula_op_t::choose).index = choice_count;
+                size_t table = m_program.m_instructions.size();
+                for (size_t i = 0; i < choice_count; ++i)
+                    emit(formula_op_t::jump);
+
+                std::vector<size_t> to_end;
+                for (size_t i = 0; i < choice_count; ++i)
+                {
+                    set_jump_target(table + i);
+                    bool last = i == choice_count - 1;
+                    argument(last);
+                    if (!last)
+                        to_end.push_back(emit_jump(formula_op_t::jump));
+                }
+
+                for (size_t pos : to_end)
+                    set_jump_target(pos);
+                break;
+            }
+            case formula_function_t::func_iferror:
+            case formula_function_t::func_ifna:
+            {
+                size_t to_fallback = emit_jump(
+                    func_oc == formula_function_t::func_iferror ? formula_op_t::catch_error : formula_op_t::catch_na);
+                argument(false);
+                size_t to_end = emit_jump(formula_op_t::end_catch);
+                set_jump_target(to_fallback);
+                argument(true);
+                set_jump_target(to_end);
+                break;
+            }
+            case formula_function_t::func_and:
+            case formula_function_t::func_or:
+            {
+                formula_op_t op = func_oc == formula_function_t::func_and ?
+                    formula_op_t::end_function_if_false : formula_op_t::end_function_if_true;
+
+                emit(formula_op_t::begin_function);
+
+                std::vector<size_t> to_end;
+                for (size_t i = 0; i < arg_count; ++i)
+                {
+                    expression();
+                    to_end.push_back(emit_jump(op));
+                    if (token_or_throw().get_opcode() != (i == arg_count - 1 ? fop_close : fop_sep))
+                        throw not_compilable();
+                    ++m_cur;
+                }
+
+                emit(formula_op_t::call_function).func = func_oc;
+
+                for (size_t pos : to_end)
+                    set_jump_target(pos);
+                break;
+            }
+            default:
+                throw not_compilable();
+        }
+    }
+
+public:
+    formula_compiler(formula_program& program, const std::vector<const formula_token*>& tokens) :
+        m_program(program), m_cur(tokens.begin()), m_end(tokens.end()), m_fold_start(0) {}
+
+    void compile()
+    {
+        expression();
+
+        if (has_token())
+            throw not_compilable();
+    }
+};
+
+formula_program::formula_program() : m_element_wise(false) {}
+
+formula_program::~formula_program() {}
+
+std::unique_ptr<formula_program> formula_program::compile(const formula_tokens_t& tokens)
+{
+    std::vector<const formula_token*> ptrs;
+    ptrs.reserve(tokens.size());
+    for (const std::unique_ptr<formula_token>& p : tokens)
+        ptrs.push_back(p.get());
+
+    return compile(ptrs);
+}
+
+std::unique_ptr<formula_program> formula_program::compile(const std::vector<const formula_token*>& tokens)
+{
+    if (tokens.empty())
+        return nullptr;
+
+    auto program = std::make_unique<formula_program>();
+
+    try
+    {
+        formula_compiler compiler(*program, tokens);
+        compiler.compile();
+    }
+    catch (const not_compilable&)
+    {
+        return nullptr;
+    }
+
+    program->m_instructions.shrink_to_fit();
+
+    program->m_element_wise = !program->m_ranges.empty() && std::all_of(
+        program->m_instructions.begin(), program->m_instructions.end(),
+        [](const formula_instruction& inst)
+        {
+            switch (inst.op)
+            {
+                case formula_op_t::push_string:
+                case formula_op_t::push_table_ref:
+                case formula_op_t::to_string:
+                case formula_op_t::concat:
+                case formula_op_t::begin_function:
+                case formula_op_t::call_function:
+                case formula_op_t::jump:
+                case formula_op_t::jump_if_false:
+                case formula_op_t::choose:
+                case formula_op_t::catch_error:
+                case formula_op_t::catch_na:
+                case formula_op_t::end_catch:
+                case formula_op_t::end_function_if_false:
+                case formula_op_t::end_function_if_true:
+                    return false;
+                default:
+                    ;
+            }
+            return true;
+        }
+    );
+
+    return program;
+}
+
+const formula_program::instructions_type& formula_program::instructions() const
+{
+    return m_instructions;
+}
+
+bool formula_program::is_element_wise() const
+{
+    return m_element_wise;
+}
+
+bool formula_program::get_range_function(formula_function_t& func, range_t& range) const
+{
+    if (m_instructions.size() != 3)
+        return false;
+
+    if (m_instructions[0].op != formula_op_t::begin_function ||
+        m_instructions[1].op != formula_op_t::push_range_ref ||
+        m_instructions[2].op != formula_op_t::call_function)
+        return false;
+
+    func = m_instructions[2].func;
+    range = m_ranges[m_instructions[1].index];
+    return true;
+}
+
+size_t count_function_arguments(
+    std::vector<const formula_token*>::const_iterator it, std::vector<const formula_token*>::const_iterator end)
+{
+    assert(it != end && (*it)->get_opcode() == fop_open);
+
+    size_t depth = 0;
+    size_t sep_count = 0;
+    bool empty = true;
+
+    for (++it; it != end; ++it)
+    {
+        switch ((*it)->get_opcode())
+        {
+            case fop_open:
+                ++depth;
+                break;
+            case fop_close:
+                if (!depth)
+                    return empty ? 0 : sep_count + 1;
+                --depth;
+                break;
+            case fop_sep:
+                if (!depth)
+                    ++sep_count;
+                break;
+            default:
+                ;
+        }
+
+        empty = false;
+    }
+
+    return empty ? 0 : sep_count + 1;
+}
+
+bool is_control_flow_call(formula_function_t func, size_t arg_count)
+{
+    switch (func)
+    {
+        case formula_function_t::func_if:
+            return arg_count == 3;
+        case formula_function_t::func_choose:
+            return arg_count >= 2;
+        case formula_function_t::func_iferror:
+        case formula_function_t::func_ifna:
+            return arg_count == 2;
+        case formula_function_t::func_and:
+        case formula_function_t::func_or:
+            return arg_count >= 1;
+        default:
+            ;
+    }
+
+    return false;
+}
+
+const address_t& formula_program::get_address(size_t pos) const
+{
+    return m_addresses[pos];
+}
+
+const range_t& formula_program::get_range(size_t pos) const
+{
+    return m_ranges[pos];
+}
+
+const table_t& formula_program::get_table(size_t pos) const
+{
+    return m_tables[pos];
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
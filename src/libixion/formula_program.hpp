@@ -0,0 +1,309 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_FORMULA_PROGRAM_HPP
+#define INCLUDED_IXION_FORMULA_PROGRAM_HPP
+
+#include "ixion/address.hpp"
+#include "ixion/table.hpp"
+#include "ixion/formula_opcode.hpp"
+#include "ixion/formula_function_opcode.hpp"
+#include "ixion/formula_tokens_fwd.hpp"
+
+#include <vector>
+#include <memory>
+
+namespace ixion { namespace detail {
+
+/**
+ * Type of a single instruction in a compiled formula program.
+ */
+enum class formula_op_t : uint8_t
+{
+    /** Push a numeric constant. */
+    push_value,
+    /** Push a string constant by its string ID. */
+    push_string,
+    /** Push a cell reference stored in the address table. */
+    push_single_ref,
+    /** Push a range reference stored in the range table. */
+    push_range_ref,
+    /** Push a table reference stored in the table table. */
+    push_table_ref,
+    /** Negate the value at the top of the stack. */
+    negate,
+    /** Resolve the top of the stack to a numeric value. */
+    to_value,
+    /** Resolve the top of the stack to a string value. */
+    to_string,
+    /** Resolve the top of the stack to either a numeric or a string value. */
+    to_value_or_string,
+    /** Apply an expression operator i.e. one of + - = <> < <= > >=. */
+    expression,
+    multiply,
+    divide,
+    exponent,
+    concat,
+    /** Start a new stack to collect function arguments in. */
+    begin_function,
+    /** Call a function with the arguments on the current stack. */
+    call_function,
+    /** Jump to the target instruction. */
+    jump,
+    /** Pop a numeric value, and jump to the target instruction if it's 0. */
+    jump_if_false,
+    /**
+     * Pop a numeric value n, and skip to the n-th of the jump instructions
+     * that follow.  The operand is the number of those jump instructions.
+     */
+    choose,
+    /**
+     * Catch any formula error raised before the matching end_catch, and
+     * jump to the target instruction when one is raised.
+     */
+    catch_error,
+    /** Same as catch_error, but only catches the #N/A error. */
+    catch_na,
+    /**
+     * Raise the error the value at the top of the stack refers to if any,
+     * then stop catching errors and jump to the target instruction.
+     */
+    end_catch,
+    /**
+     * End the current function call with a false value, and jump to the
+     * target instruction if the value at the top of the stack is false.
+     */
+    end_function_if_false,
+    /**
+     * End the current function call with a true value, and jump to the
+     * target instruction if the value at the top of the stack is true.
+     */
+    end_function_if_true,
+};
+
+/**
+ * Single instruction in a compiled formula program.  Each instruction
+ * stores at most one operand, whose meaning depends on the instruction
+ * type.
+ */
+struct formula_instruction
+{
+    formula_op_t op;
+
+    union
+    {
+        double value;
+        size_t index;
+        fopcode_t opcode;
+        formula_function_t func;
+    };
+
+    formula_instruction(formula_op_t _op) : op(_op), index(0) {}
+};
+
+/**
+ * Flat, postfix representation of a formula expression.  The instructions
+ * evaluate the expression in exactly the same order as the recursive
+ * descent interpretation of the original tokens would, but without the
+ * need to parse the tokens each time the formula gets calculated.
+ *
+ * The arguments of the control-flow functions IF, CHOOSE, IFERROR, IFNA,
+ * AND and OR are only evaluated when they can affect the result, by
+ * jumping over the instructions of the arguments that can't.  The operand
+ * of a jump is the position of its target instruction.
+ *
+ * Reference operands are stored relative to the origin cell, so that a
+ * single program can be shared among all cells sharing the same tokens.
+ */
+class formula_program
+{
+public:
+    using instructions_type = std::vector<formula_instruction>;
+
+    formula_program();
+    ~formula_program();
+
+    /**
+     * Compile formula tokens into a program.
+     *
+     * @param tokens formula tokens to compile.
+     *
+     * @return compiled program, or nullptr in case the tokens cannot be
+     *         compiled.  Tokens containing named expressions are never
+     *         compiled since they must be expanded at interpretation time.
+     */
+    static std::unique_ptr<formula_program> compile(const formula_tokens_t& tokens);
+
+    /**
+     * Compile a sequence of formula tokens into a program.
+     *
+     * @param tokens formula tokens to compile.
+     *
+     * @return compiled program, or nullptr in case the tokens cannot be
+     *         compiled.
+     */
+    static std::unique_ptr<formula_program> compile(const std::vector<const formula_token*>& tokens);
+
+    const instructions_type& instructions() const;
+
+    /**
+     * Check whether this program can be evaluated element-wise over numeric
+     * arrays.  That is the case when it references at least one range, and
+     * only consists of numeric operations applicable to each element.
+     *
+     * @return true if this program can be evaluated element-wise, false
+     *         otherwise.
+     */
+    bool is_element_wise() const;
+
+    /**
+     * Check whether this program consists of a single function call whose
+     * only argument is a range reference, such as SUM(A1:A10).
+     *
+     * @param func opcode of the function, set only when true is returned.
+     * @param range range reference of the argument, set only when true is
+     *              returned.
+     *
+     * @return true if this program is a single function call on a range,
+     *         false otherwise.
+     */
+    bool get_range_function(formula_function_t& func, range_t& range) const;
+
+    const address_t& get_address(size_t pos) const;
+    const range_t& get_range(size_t pos) const;
+    const table_t& get_table(size_t pos) const;
+
+private:
+    friend class formula_compiler;
+
+    instructions_type m_instructions;
+    std::vector<address_t> m_addresses;
+    std::vector<range_t> m_ranges;
+    std::vector<table_t> m_tables;
+    bool m_element_wise;
+};
+
+/**
+ * Count the arguments of a function call without evaluating them.
+ *
+ * @param it position of the opening parenthesis of the call.
+ * @param end end position of the tokens.
+ *
+ * @return number of arguments.
+ */
+size_t count_function_arguments(
+    std::vector<const formula_token*>::const_iterator it, std::vector<const formula_token*>::const_iterator end);
+
+/**
+ * Check whether a function call controls which of its arguments get
+ * evaluated, rather than having all its arguments evaluated up-front.
+ *
+ * @param func opcode of the function.
+ * @param arg_count number of arguments in the call.  Calls with an invalid
+ *                  number of arguments are evaluated normally, which
+ *                  reports the error.
+ *
+ * @return true if the function call controls the evaluation of its
+ *         arguments, false otherwise.
+ */
+bool is_control_flow_call(formula_function_t func, size_t arg_count);
+
+/**
+ * Formula tokens with all their named expressions expanded within a
+ * particular sheet scope, along with the program compiled from them.
+ */
+struct expanded_formula_tokens
+{
+    std::vector<const formula_token*> tokens;
+
+    /** Compiled program, or nullptr if the tokens cannot be compiled. */
+    std::unique_ptr<formula_program> program;
+};
+
+/**
+ * Tokens of a formula tokens store along with the program and the
+ * expansions derived from them, which the stores holding identical tokens
+ * share.
+ */
+struct shared_formula_tokens;
+
+using shared_formula_tokens_ptr_t = std::shared_ptr<shared_formula_tokens>;
+
+/**
+ * Provides access to the compiled program of a formula tokens store, to
+ * the expansions of its named expressions cached during calculation, and
+ * to the tokens it shares with other stores.
+ */
+class formula_tokens_store_access
+{
+public:
+    /**
+     * Compile the stored tokens into a program that can be run repeatedly
+     * without parsing the tokens each time, unless they are already
+     * compiled.  This gets called when the tokens are assigned to a
+     * formula cell.
+     */
+    static void compile(formula_tokens_store& ts);
+
+    /**
+     * Get the program compiled from the stored tokens.
+     *
+     * @return pointer to the compiled program, or nullptr if the tokens
+     *         have not been compiled, have been modified since they were
+     *         last compiled, or cannot be compiled.
+     */
+    static const formula_program* get_program(const formula_tokens_store& ts);
+
+    /**
+     * Get the cached expansion of the named expressions in the stored
+     * tokens.
+     *
+     * @param sheet sheet scope the named expressions were looked up in.
+     * @param revision revision of the named expressions at the time of the
+     *                 expansion.
+     *
+     * @return cached expansion, or nullptr if none is cached for the
+     *         specified sheet scope and revision.
+     */
+    static std::shared_ptr<const expanded_formula_tokens> get_expanded_tokens(
+        const formula_tokens_store& ts, sheet_t sheet, size_t revision);
+
+    /**
+     * Cache the expansion of the named expressions in the stored tokens.
+     * This may be called during calculation, from multiple threads.
+     *
+     * @param sheet sheet scope the named expressions were looked up in.
+     * @param revision revision of the named expressions at the time of the
+     *                 expansion.
+     * @param expanded expanded tokens to cache.  It replaces any expansion
+     *                 previously cached for the same sheet scope.
+     */
+    static void set_expanded_tokens(
+        const formula_tokens_store& ts, sheet_t sheet, size_t revision,
+        std::shared_ptr<const expanded_formula_tokens> expanded);
+
+    /**
+     * Get the tokens of a store to share with other stores.
+     */
+    static shared_formula_tokens_ptr_t get_shared(const formula_tokens_store& ts);
+
+    static const formula_tokens_t& get_tokens(const shared_formula_tokens& shared);
+
+    /**
+     * Create a store that shares the specified tokens with other stores.
+     * Getting the tokens of any of the stores for modification gives that
+     * store its own copy of the tokens first, which leaves the tokens of
+     * the other stores unchanged.
+     */
+    static formula_tokens_store_ptr_t create(shared_formula_tokens_ptr_t shared);
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
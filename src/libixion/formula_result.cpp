@@ -278,32 +278,6 @@ struct formula_result::impl
         }
     }
 
-    void move_from(formula_result&& r)
-    {
-        delete_buffer();
-        m_type = r.mp_impl->m_type;
-
-        switch (m_type)
-        {
-            case result_type::value:
-                m_value = r.mp_impl->m_value;
-                break;
-            case result_type::string:
-                m_str = r.mp_impl->m_str;
-                r.mp_impl->m_str = nullptr;
-                break;
-            case result_type::error:
-                m_error = r.mp_impl->m_error;
-                break;
-            case result_type::matrix:
-                m_matrix = r.mp_impl->m_matrix;
-                r.mp_impl->m_matrix = nullptr;
-                break;
-            default:
-                assert(!"unknown formula result type specified during copy construction.");
-        }
-    }
-
     bool equals(const formula_result& r) const
     {
         if (m_type != r.mp_impl->m_type)
@@ -404,6 +378,14 @@ struct formula_result::impl
                 buf.inc();
         }
 
+        if (buf.equals("N/A"))
+        {
+            delete_buffer();
+            m_error = formula_error_t::no_value_available;
+            m_type = result_type::error;
+            return;
+        }
+
         ostringstream os;
         os << "malformed error string: " << string(p0, n);
         throw general_error(os.str());
@@ -519,7 +501,8 @@ void formula_result::parse(iface::formula_model_access& cxt, const char* p, size
 
 formula_result& formula_result::operator= (formula_result r)
 {
-    mp_impl->move_from(std::move(r));
+    // Swapping also makes a moved-from instance assignable again.
+    mp_impl.swap(r.mp_impl);
     return *this;
 }
 
@@ -6,9 +6,12 @@
  */
 
 #include "ixion/formula_tokens.hpp"
+#include "formula_program.hpp"
 #include "ixion/exceptions.hpp"
 #include "ixion/global.hpp"
 
+#include <mutex>
+
 using ::std::string;
 
 namespace ixion {
@@ -121,6 +124,12 @@ bool formula_token::operator== (const formula_token& r) const
         case fop_multiply:
         case fop_exponent:
         case fop_concat:
+        case fop_equal:
+        case fop_not_equal:
+        case fop_less:
+        case fop_greater:
+        case fop_less_equal:
+        case fop_greater_equal:
         case fop_open:
         case fop_plus:
         case fop_sep:
@@ -182,12 +191,41 @@ void formula_token::write_string(std::ostream& /*os*/) const
 {
 }
 
+namespace detail {
+
+struct shared_formula_tokens
+{
+    formula_tokens_t tokens;
+
+    std::unique_ptr<formula_program> program;
+    bool compiled;
+
+    struct expanded_entry
+    {
+        sheet_t sheet;
+        size_t revision;
+        std::shared_ptr<const expanded_formula_tokens> expanded;
+    };
+
+    std::mutex expanded_mtx;
+    std::vector<expanded_entry> expanded;
+
+    shared_formula_tokens() : compiled(false) {}
+};
+
+}
+
 struct formula_tokens_store::impl
 {
-    formula_tokens_t m_tokens;
     size_t m_refcount;
 
-    impl() : m_refcount(0) {}
+    /**
+     * Tokens that may be shared with other stores holding identical
+     * tokens.  They are never modified while shared.
+     */
+    detail::shared_formula_tokens_ptr_t m_shared;
+
+    impl() : m_refcount(0), m_shared(std::make_shared<detail::shared_formula_tokens>()) {}
 };
 
 formula_tokens_store::formula_tokens_store() :
@@ -220,14 +258,99 @@ size_t formula_tokens_store::get_reference_count() const
     return mp_impl->m_refcount;
 }
 
-formula_tokens_t& formula_tokens_store::get()
+const formula_tokens_t& formula_tokens_store::get() const
 {
-    return mp_impl->m_tokens;
+    return mp_impl->m_shared->tokens;
 }
 
-const formula_tokens_t& formula_tokens_store::get() const
+void formula_tokens_store::set(formula_tokens_t tokens)
+{
+    // The current tokens, along with the program and the expansions derived
+    // from them, may be shared with other stores.  Leave them alone.
+    bool compiled = mp_impl->m_shared->compiled;
+    auto shared = std::make_shared<detail::shared_formula_tokens>();
+    shared->tokens = std::move(tokens);
+    mp_impl->m_shared = std::move(shared);
+
+    if (compiled)
+        detail::formula_tokens_store_access::compile(*this);
+}
+
+namespace detail {
+
+void formula_tokens_store_access::compile(formula_tokens_store& ts)
+{
+    shared_formula_tokens& shared = *ts.mp_impl->m_shared;
+    if (shared.compiled)
+        return;
+
+    shared.program = formula_program::compile(shared.tokens);
+    shared.compiled = true;
+}
+
+const formula_program* formula_tokens_store_access::get_program(const formula_tokens_store& ts)
+{
+    return ts.mp_impl->m_shared->program.get();
+}
+
+std::shared_ptr<const expanded_formula_tokens> formula_tokens_store_access::get_expanded_tokens(
+    const formula_tokens_store& ts, sheet_t sheet, size_t revision)
+{
+    shared_formula_tokens& shared = *ts.mp_impl->m_shared;
+    std::lock_guard<std::mutex> lock(shared.expanded_mtx);
+
+    for (const shared_formula_tokens::expanded_entry& entry : shared.expanded)
+    {
+        if (entry.sheet != sheet)
+            continue;
+
+        if (entry.revision != revision)
+            return nullptr;
+
+        return entry.expanded;
+    }
+
+    return nullptr;
+}
+
+void formula_tokens_store_access::set_expanded_tokens(
+    const formula_tokens_store& ts, sheet_t sheet, size_t revision,
+    std::shared_ptr<const expanded_formula_tokens> expanded)
+{
+    shared_formula_tokens& shared = *ts.mp_impl->m_shared;
+    shared_formula_tokens::expanded_entry entry{ sheet, revision, std::move(expanded) };
+
+    std::lock_guard<std::mutex> lock(shared.expanded_mtx);
+
+    for (shared_formula_tokens::expanded_entry& e : shared.expanded)
+    {
+        if (e.sheet == sheet)
+        {
+            e = std::move(entry);
+            return;
+        }
+    }
+
+    shared.expanded.push_back(std::move(entry));
+}
+
+shared_formula_tokens_ptr_t formula_tokens_store_access::get_shared(const formula_tokens_store& ts)
 {
-    return mp_impl->m_tokens;
+    return ts.mp_impl->m_shared;
+}
+
+const formula_tokens_t& formula_tokens_store_access::get_tokens(const shared_formula_tokens& shared)
+{
+    return shared.tokens;
+}
+
+formula_tokens_store_ptr_t formula_tokens_store_access::create(shared_formula_tokens_ptr_t shared)
+{
+    formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+    ts->mp_impl->m_shared = std::move(shared);
+    return ts;
+}
+
 }
 
 named_expression_t::named_expression_t() {}
@@ -248,7 +371,7 @@ bool operator== (const formula_tokens_t& left, const formula_tokens_t& right)
     formula_tokens_t::const_iterator itr = left.begin(), itr_end = left.end(), itr2 = right.begin();
     for (; itr != itr_end; ++itr, ++itr2)
     {
-        if (*itr != *itr2)
+        if (**itr != **itr2)
             return false;
     }
     return true;
@@ -22,6 +22,19 @@ namespace ixion {
 
 namespace {
 
+/**
+ * Throw the error of an error value, or a stack error for a value of any
+ * other type, when a value is not of the type expected.
+ */
+[[noreturn]] void throw_type_mismatch(const stack_value& v)
+{
+    if (v.get_type() == stack_value_t::error)
+        throw formula_error(v.get_error());
+
+    IXION_DEBUG("value is being popped, but the stack value type is not appropriate.");
+    throw formula_error(formula_error_t::stack_error);
+}
+
 double get_numeric_value(const iface::formula_model_access& cxt, const stack_value& v)
 {
     double ret = 0.0;
@@ -39,109 +52,140 @@ double get_numeric_value(const iface::formula_model_access& cxt, const stack_val
             break;
         }
         default:
-            IXION_DEBUG("value is being popped, but the stack value type is not appropriate.");
-            throw formula_error(formula_error_t::stack_error);
+            throw_type_mismatch(v);
     }
     return ret;
 }
 
+/**
+ * Storage buffers of the destroyed stacks, kept for reuse by the stacks
+ * created later on the same thread.
+ */
+class stack_buffer_pool
+{
+    typedef std::vector<stack_value> buffer_type;
+
+    /** Maximum number of buffers to keep. */
+    static constexpr size_t max_buffers = 64;
+
+    /** Buffers larger than this are released instead of kept. */
+    static constexpr size_t max_capacity = 1024;
+
+    std::vector<buffer_type> m_buffers;
+
+public:
+    buffer_type acquire()
+    {
+        if (m_buffers.empty())
+            return buffer_type();
+
+        buffer_type buf = std::move(m_buffers.back());
+        m_buffers.pop_back();
+        return buf;
+    }
+
+    void release(buffer_type&& buf)
+    {
+        if (!buf.capacity() || buf.capacity() > max_capacity || m_buffers.size() >= max_buffers)
+            return;
+
+        buf.clear();
+        m_buffers.push_back(std::move(buf));
+    }
+};
+
+thread_local stack_buffer_pool buffer_pool;
+
 }
 
 stack_value::stack_value(double val) :
     m_type(stack_value_t::value), m_value(val) {}
 
 stack_value::stack_value(std::string str) :
-    m_type(stack_value_t::string), m_str(new std::string(std::move(str))) {}
+    m_type(stack_value_t::string)
+{
+    new (&m_str) std::string(std::move(str));
+}
 
 stack_value::stack_value(const abs_address_t& val) :
-    m_type(stack_value_t::single_ref), m_address(new abs_address_t(val)) {}
+    m_type(stack_value_t::single_ref)
+{
+    new (&m_address) abs_address_t(val);
+}
 
 stack_value::stack_value(const abs_range_t& val) :
-    m_type(stack_value_t::range_ref), m_range(new abs_range_t(val)) {}
+    m_type(stack_value_t::range_ref)
+{
+    new (&m_range) abs_range_t(val);
+}
 
 stack_value::stack_value(matrix mtx) :
-    m_type(stack_value_t::matrix), m_matrix(new matrix(std::move(mtx))) {}
+    m_type(stack_value_t::matrix)
+{
+    new (&m_matrix) matrix(std::move(mtx));
+}
+
+stack_value::stack_value(formula_error_t err) :
+    m_type(stack_value_t::error), m_error(err) {}
+
+stack_value::stack_value(stack_value&& other)
+{
+    construct_from(std::move(other));
+}
+
+stack_value::~stack_value()
+{
+    destroy();
+}
 
-stack_value::stack_value(stack_value&& other) :
-    m_type(other.m_type)
+void stack_value::construct_from(stack_value&& other)
 {
-    other.m_type = stack_value_t::value;
+    m_type = other.m_type;
 
     switch (m_type)
     {
         case stack_value_t::matrix:
-            m_matrix = other.m_matrix;
-            other.m_matrix = nullptr;
+            new (&m_matrix) matrix(std::move(other.m_matrix));
             break;
         case stack_value_t::range_ref:
-            m_range = other.m_range;
-            other.m_range = nullptr;
+            new (&m_range) abs_range_t(other.m_range);
             break;
         case stack_value_t::single_ref:
-            m_address = other.m_address;
-            other.m_address = nullptr;
+            new (&m_address) abs_address_t(other.m_address);
             break;
         case stack_value_t::string:
-            m_str = other.m_str;
-            other.m_str = nullptr;
+            new (&m_str) std::string(std::move(other.m_str));
             break;
         case stack_value_t::value:
             m_value = other.m_value;
             break;
-        default:
-            ;
+        case stack_value_t::error:
+            m_error = other.m_error;
+            break;
     }
 }
 
-stack_value::~stack_value()
+void stack_value::destroy()
 {
     switch (m_type)
     {
-        case stack_value_t::range_ref:
-            delete m_range;
-            break;
-        case stack_value_t::single_ref:
-            delete m_address;
-            break;
         case stack_value_t::matrix:
-            delete m_matrix;
+            m_matrix.~matrix();
             break;
         case stack_value_t::string:
-            delete m_str;
+            m_str.~basic_string();
             break;
-        case stack_value_t::value:
         default:
-            ; // do nothing
+            ; // trivially destructible.
     }
 }
 
 stack_value& stack_value::operator= (stack_value&& other)
 {
-    other.m_type = stack_value_t::value;
-
-    switch (m_type)
+    if (this != &other)
     {
-        case stack_value_t::matrix:
-            m_matrix = other.m_matrix;
-            other.m_matrix = nullptr;
-            break;
-        case stack_value_t::range_ref:
-            m_range = other.m_range;
-            other.m_range = nullptr;
-            break;
-        case stack_value_t::single_ref:
-            m_address = other.m_address;
-            other.m_address = nullptr;
-            break;
-        case stack_value_t::string:
-            m_str = other.m_str;
-            other.m_str = nullptr;
-            break;
-        case stack_value_t::value:
-            m_value = other.m_value;
-            break;
-        default:
-            ;
+        destroy();
+        construct_from(std::move(other));
     }
 
     return *this;
@@ -159,7 +203,7 @@ double stack_value::get_value() const
         case stack_value_t::value:
             return m_value;
         case stack_value_t::matrix:
-            return m_matrix->get_numeric(0, 0);
+            return m_matrix.get_numeric(0, 0);
         default:
             ;
     }
@@ -169,17 +213,22 @@ double stack_value::get_value() const
 
 const std::string& stack_value::get_string() const
 {
-    return *m_str;
+    return m_str;
 }
 
 const abs_address_t& stack_value::get_address() const
 {
-    return *m_address;
+    return m_address;
 }
 
 const abs_range_t& stack_value::get_range() const
 {
-    return *m_range;
+    return m_range;
+}
+
+formula_error_t stack_value::get_error() const
+{
+    return m_error;
 }
 
 matrix stack_value::pop_matrix()
@@ -195,15 +244,26 @@ matrix stack_value::pop_matrix()
         case stack_value_t::matrix:
         {
             matrix mtx;
-            mtx.swap(*m_matrix);
+            mtx.swap(m_matrix);
             return mtx;
         }
+        case stack_value_t::error:
+            throw formula_error(m_error);
         default:
             throw formula_error(formula_error_t::stack_error);
     }
 }
 
-formula_value_stack::formula_value_stack(const iface::formula_model_access& cxt) : m_context(cxt) {}
+formula_value_stack::formula_value_stack(const iface::formula_model_access& cxt) :
+    m_stack(buffer_pool.acquire()), m_context(cxt) {}
+
+formula_value_stack::formula_value_stack(formula_value_stack&& other) noexcept :
+    m_stack(std::move(other.m_stack)), m_context(other.m_context) {}
+
+formula_value_stack::~formula_value_stack()
+{
+    buffer_pool.release(std::move(m_stack));
+}
 
 formula_value_stack::iterator formula_value_stack::begin()
 {
@@ -281,6 +341,46 @@ double formula_value_stack::get_value(size_t pos) const
     return get_numeric_value(m_context, v);
 }
 
+formula_error_t formula_value_stack::get_error(size_t pos) const
+{
+    const stack_value& v = m_stack[pos];
+    abs_address_t addr;
+
+    switch (v.get_type())
+    {
+        case stack_value_t::error:
+            return v.get_error();
+        case stack_value_t::single_ref:
+            addr = v.get_address();
+            break;
+        case stack_value_t::range_ref:
+            addr = v.get_range().first;
+            break;
+        default:
+            return formula_error_t::no_error;
+    }
+
+    if (m_context.get_celltype(addr) != celltype_t::formula)
+        return formula_error_t::no_error;
+
+    formula_result res = m_context.get_formula_result(addr);
+    if (res.get_type() != formula_result::result_type::error)
+        return formula_error_t::no_error;
+
+    return res.get_error();
+}
+
+formula_error_t formula_value_stack::find_error(size_t pos) const
+{
+    for (; pos < m_stack.size(); ++pos)
+    {
+        if (m_stack[pos].get_type() == stack_value_t::error)
+            return m_stack[pos].get_error();
+    }
+
+    return formula_error_t::no_error;
+}
+
 void formula_value_stack::push_back(value_type&& val)
 {
     IXION_TRACE("push_back");
@@ -318,6 +418,12 @@ void formula_value_stack::push_matrix(matrix mtx)
     m_stack.emplace_back(std::move(mtx));
 }
 
+void formula_value_stack::push_error(formula_error_t err)
+{
+    IXION_TRACE("err=" << get_formula_error_name(err));
+    m_stack.emplace_back(err);
+}
+
 double formula_value_stack::pop_value()
 {
     double ret = 0.0;
@@ -331,6 +437,30 @@ double formula_value_stack::pop_value()
     return ret;
 }
 
+formula_error_t formula_value_stack::pop_value_or_error(double& val)
+{
+    if (m_stack.empty())
+        throw formula_error(formula_error_t::stack_error);
+
+    const stack_value& v = m_stack.back();
+    formula_error_t err = formula_error_t::no_error;
+
+    switch (v.get_type())
+    {
+        case stack_value_t::single_ref:
+            err = m_context.get_numeric_value_or_error(v.get_address(), val);
+            break;
+        case stack_value_t::error:
+            err = v.get_error();
+            break;
+        default:
+            val = get_numeric_value(m_context, v);
+    }
+
+    m_stack.pop_back();
+    return err;
+}
+
 const std::string formula_value_stack::pop_string()
 {
     IXION_TRACE("pop_string");
@@ -409,7 +539,7 @@ const std::string formula_value_stack::pop_string()
         default:
             ;
     }
-    throw formula_error(formula_error_t::stack_error);
+    throw_type_mismatch(v);
 }
 
 abs_address_t formula_value_stack::pop_single_ref()
@@ -420,7 +550,7 @@ abs_address_t formula_value_stack::pop_single_ref()
 
     const stack_value& v = m_stack.back();
     if (v.get_type() != stack_value_t::single_ref)
-        throw formula_error(formula_error_t::stack_error);
+        throw_type_mismatch(v);
 
     abs_address_t addr = v.get_address();
     m_stack.pop_back();
@@ -436,7 +566,7 @@ abs_range_t formula_value_stack::pop_range_ref()
 
     const stack_value& v = m_stack.back();
     if (v.get_type() != stack_value_t::range_ref)
-        throw formula_error(formula_error_t::stack_error);
+        throw_type_mismatch(v);
 
     abs_range_t range = v.get_range();
     m_stack.pop_back();
@@ -452,13 +582,29 @@ matrix formula_value_stack::pop_range_value()
 
     const stack_value& v = m_stack.back();
     if (v.get_type() != stack_value_t::range_ref)
-        throw formula_error(formula_error_t::stack_error);
+        throw_type_mismatch(v);
 
     matrix ret = m_context.get_range_value(v.get_range());
     m_stack.pop_back();
     return ret;
 }
 
+range_view formula_value_stack::pop_range_view()
+{
+    IXION_TRACE("pop_range_view");
+
+    if (m_stack.empty())
+        throw formula_error(formula_error_t::stack_error);
+
+    const stack_value& v = m_stack.back();
+    if (v.get_type() != stack_value_t::range_ref)
+        throw_type_mismatch(v);
+
+    range_view ret(m_context, v.get_range());
+    m_stack.pop_back();
+    return ret;
+}
+
 stack_value_t formula_value_stack::get_type() const
 {
     if (m_stack.empty())
@@ -9,8 +9,12 @@
 #define INCLUDED_IXION_FORMULA_VALUE_STACK_HPP
 
 #include "ixion/global.hpp"
+#include "ixion/address.hpp"
+#include "ixion/matrix.hpp"
+#include "range_view.hpp"
 
-#include <deque>
+#include <string>
+#include <vector>
 
 namespace ixion {
 
@@ -20,10 +24,6 @@ class formula_model_access;
 
 }
 
-struct abs_address_t;
-struct abs_range_t;
-class matrix;
-
 /**
  * Type of stack value which can be used as intermediate value during
  * formula interpretation.
@@ -35,10 +35,16 @@ enum class stack_value_t
     single_ref,
     range_ref,
     matrix,
+    error,
 };
 
 /**
- * Individual stack value storage.
+ * Individual stack value storage.  All value types are stored inline, so
+ * that pushing a value onto a stack doesn't allocate memory on its own.
+ *
+ * An error value carries the error of the expression that produced it, so
+ * that the error can propagate without an exception being thrown.  Popping
+ * an error value as any other type throws its error.
  */
 class stack_value
 {
@@ -47,12 +53,16 @@ class stack_value
     union
     {
         double m_value;
-        abs_address_t* m_address;
-        abs_range_t* m_range;
-        matrix* m_matrix;
-        std::string* m_str;
+        formula_error_t m_error;
+        abs_address_t m_address;
+        abs_range_t m_range;
+        matrix m_matrix;
+        std::string m_str;
     };
 
+    void construct_from(stack_value&& other);
+    void destroy();
+
 public:
     stack_value() = delete;
     stack_value(const stack_value&) = delete;
@@ -63,6 +73,7 @@ public:
     explicit stack_value(const abs_address_t& val);
     explicit stack_value(const abs_range_t& val);
     explicit stack_value(matrix mtx);
+    explicit stack_value(formula_error_t err);
     stack_value(stack_value&& other);
     ~stack_value();
 
@@ -73,6 +84,7 @@ public:
     const std::string& get_string() const;
     const abs_address_t& get_address() const;
     const abs_range_t& get_range() const;
+    formula_error_t get_error() const;
 
     /**
      * Move the matrix value out from storage.  The internal matrix content
@@ -83,10 +95,15 @@ public:
 
 /**
  * FILO stack of values; last pushed value gets popped first.
+ *
+ * The storage buffer of a destroyed stack is kept in a per-thread pool, and
+ * gets handed to the next stack created on the same thread.  Since the
+ * interpreter creates a stack for each function call, this saves most of
+ * the memory allocations during calculation.
  */
 class formula_value_stack
 {
-    typedef std::deque<stack_value> store_type;
+    typedef std::vector<stack_value> store_type;
     store_type m_stack;
     const iface::formula_model_access& m_context;
 
@@ -96,6 +113,8 @@ public:
     formula_value_stack& operator= (const formula_value_stack&) = delete;
 
     explicit formula_value_stack(const iface::formula_model_access& cxt);
+    formula_value_stack(formula_value_stack&& other) noexcept;
+    ~formula_value_stack();
 
     typedef store_type::value_type value_type;
     typedef store_type::iterator iterator;
@@ -117,19 +136,61 @@ public:
 
     double get_value(size_t pos) const;
 
+    /**
+     * Get the error a stack value is or refers to.  A reference refers to an
+     * error when its cell, or the first cell of its range, is a formula cell
+     * whose result is an error.
+     *
+     * @param pos position of the stack value.
+     *
+     * @return error the value is or refers to, or formula_error_t::no_error
+     *         if none.
+     */
+    formula_error_t get_error(size_t pos) const;
+
+    /**
+     * Find the first error value at or after a position.  Unlike get_error(),
+     * this doesn't look into the cells referenced.
+     *
+     * @param pos position of the first stack value to check.
+     *
+     * @return error of the first error value found, or
+     *         formula_error_t::no_error if none.
+     */
+    formula_error_t find_error(size_t pos) const;
+
     void push_back(value_type&& val);
     void push_value(double val);
     void push_string(std::string str);
     void push_single_ref(const abs_address_t& val);
     void push_range_ref(const abs_range_t& val);
     void push_matrix(matrix mtx);
+    void push_error(formula_error_t err);
 
     double pop_value();
+
+    /**
+     * Pop a numeric value the same way pop_value() does, except that an
+     * error value, or a reference to a formula cell with an error result,
+     * gets its error returned instead of thrown.
+     *
+     * @param val numeric value, set only when no error is returned.
+     *
+     * @return error of the value, or formula_error_t::no_error if the value
+     *         has been set.
+     */
+    formula_error_t pop_value_or_error(double& val);
     const std::string pop_string();
     abs_address_t pop_single_ref();
     abs_range_t pop_range_ref();
     matrix pop_range_value();
 
+    /**
+     * Pop a range reference as a view of its values, which reads the values
+     * directly from the model without copying them into a matrix.
+     */
+    range_view pop_range_view();
+
     stack_value_t get_type() const;
 };
 
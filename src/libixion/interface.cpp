@@ -8,16 +8,182 @@
 #include "ixion/interface/table_handler.hpp"
 #include "ixion/interface/session_handler.hpp"
 #include "ixion/interface/formula_model_access.hpp"
+#include "ixion/interface/range_value_handler.hpp"
+#include "ixion/address.hpp"
+#include "ixion/global.hpp"
+#include "ixion/matrix.hpp"
+
+#include "lookup_index.hpp"
 
 namespace ixion { namespace iface {
 
+namespace {
+
+class range_summarizer : public range_value_handler
+{
+    numeric_summary_t& m_summary;
+
+public:
+    range_summarizer(numeric_summary_t& summary) : m_summary(summary) {}
+
+    virtual void numeric(const abs_address_t& /*pos*/, const double* p, size_t n) override
+    {
+        m_summary.add(p, n);
+    }
+
+    virtual void boolean(const abs_address_t& /*pos*/, bool val) override
+    {
+        m_summary.add(val ? 1.0 : 0.0);
+    }
+
+    virtual void error(const abs_address_t& /*pos*/, formula_error_t err) override
+    {
+        throw formula_error(err);
+    }
+};
+
+}
+
 table_handler::~table_handler() {}
 
 session_handler::~session_handler() {}
 
+range_value_handler::~range_value_handler() {}
+
+void range_value_handler::numeric(const abs_address_t& /*pos*/, const double* /*p*/, size_t /*n*/) {}
+void range_value_handler::boolean(const abs_address_t& /*pos*/, bool /*val*/) {}
+void range_value_handler::string(const abs_address_t& /*pos*/, const std::string& /*str*/) {}
+void range_value_handler::error(const abs_address_t& /*pos*/, formula_error_t /*err*/) {}
+void range_value_handler::empty(const abs_address_t& /*pos*/, size_t /*n*/) {}
+
 formula_model_access::formula_model_access() {}
 formula_model_access::~formula_model_access() {}
 
+numeric_summary_t formula_model_access::summarize_range(const abs_range_t& range) const
+{
+    numeric_summary_t ret;
+    range_summarizer handler(ret);
+
+    sheet_t last_sheet = range.last.sheet;
+    size_t sheet_count = get_sheet_count();
+    if (!sheet_count)
+        return ret;
+
+    if (static_cast<size_t>(last_sheet) >= sheet_count)
+        last_sheet = sheet_count - 1;
+
+    for (sheet_t sheet = range.first.sheet; sheet <= last_sheet; ++sheet)
+    {
+        abs_range_t sheet_range = range;
+        sheet_range.first.sheet = sheet_range.last.sheet = sheet;
+        walk_range(sheet_range, handler);
+    }
+
+    return ret;
+}
+
+void formula_model_access::walk_range(const abs_range_t& range, range_value_handler& handler) const
+{
+    matrix mx = get_range_value(range);
+
+    abs_address_t pos = range.first;
+    if (range.all_rows())
+        pos.row = 0;
+    if (range.all_columns())
+        pos.column = 0;
+
+    for (size_t col = 0; col < mx.col_size(); ++col)
+    {
+        for (size_t row = 0; row < mx.row_size(); ++row)
+        {
+            abs_address_t cell_pos(pos.sheet, pos.row + row, pos.column + col);
+            matrix::element e = mx.get(row, col);
+
+            switch (e.type)
+            {
+                case matrix::element_type::numeric:
+                    handler.numeric(cell_pos, &e.numeric, 1);
+                    break;
+                case matrix::element_type::boolean:
+                    handler.boolean(cell_pos, e.boolean);
+                    break;
+                case matrix::element_type::string:
+                    handler.string(cell_pos, *e.str);
+                    break;
+                case matrix::element_type::error:
+                    handler.error(cell_pos, e.error);
+                    break;
+                case matrix::element_type::empty:
+                    handler.empty(cell_pos, 1);
+                    break;
+            }
+        }
+    }
+}
+
+formula_error_t formula_model_access::get_numeric_value_or_error(const abs_address_t& addr, double& value) const
+{
+    try
+    {
+        value = get_numeric_value(addr);
+    }
+    catch (const formula_error& e)
+    {
+        return e.get_error();
+    }
+
+    return formula_error_t::no_error;
+}
+
+bool formula_model_access::get_range_result(
+    formula_function_t /*func*/, const abs_range_t& /*range*/, double& /*value*/) const
+{
+    return false;
+}
+
+void formula_model_access::set_range_result(
+    formula_function_t /*func*/, const abs_range_t& /*range*/, double /*value*/)
+{
+}
+
+bool formula_model_access::is_range_result_unavailable(
+    formula_function_t /*func*/, const abs_range_t& /*range*/) const
+{
+    return false;
+}
+
+void formula_model_access::set_range_result_unavailable(
+    formula_function_t /*func*/, const abs_range_t& /*range*/)
+{
+}
+
+bool formula_model_access::find_in_range(
+    const abs_range_t& range, double value, lookup_match_t match, lookup_search_t search, size_t& pos) const
+{
+    return detail::scan_range(*this, range, value, match, search, pos);
+}
+
+bool formula_model_access::find_in_range(
+    const abs_range_t& range, const std::string& value, lookup_match_t match, lookup_search_t search,
+    size_t& pos) const
+{
+    return detail::scan_range(*this, range, value, match, search, pos);
+}
+
+size_t formula_model_access::get_named_expressions_revision() const
+{
+    return 0;
+}
+
+void formula_model_access::set_calc_thread_count(size_t /*thread_count*/)
+{
+}
+
+size_t formula_model_access::get_calc_thread_count() const
+{
+    return 0;
+}
+
 std::unique_ptr<session_handler> formula_model_access::create_session_handler()
 {
     return std::unique_ptr<session_handler>();
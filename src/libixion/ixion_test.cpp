@@ -14,14 +14,18 @@
 #include "ixion/global.hpp"
 #include "ixion/macros.hpp"
 #include "ixion/interface/table_handler.hpp"
+#include "ixion/interface/range_value_handler.hpp"
 #include "ixion/config.hpp"
 #include "ixion/matrix.hpp"
 #include "ixion/cell.hpp"
 #include "ixion/cell_access.hpp"
 #include "ixion/formula_result.hpp"
 
+#include "formula_program.hpp"
+
 #include <iostream>
 #include <cassert>
+#include <cmath>
 #include <string>
 #include <cstring>
 #include <sstream>
@@ -168,6 +172,57 @@ void test_matrix_non_numeric_values()
     assert(elem.boolean == true);
 }
 
+void test_matrix_multiply()
+{
+    // Pick sizes that aren't multiples of the block sizes, and large enough
+    // to get split across threads.
+    const size_t m = 201, n = 263, p = 130;
+
+    numeric_matrix left(m, n), right(n, p);
+
+    for (size_t row = 0; row < m; ++row)
+        for (size_t col = 0; col < n; ++col)
+            left(row, col) = double((row * 7 + col * 3) % 11) - 5.0;
+
+    for (size_t row = 0; row < n; ++row)
+        for (size_t col = 0; col < p; ++col)
+            right(row, col) = double((row * 5 + col) % 13) * 0.5;
+
+    numeric_matrix expected(m, p);
+    for (size_t row = 0; row < m; ++row)
+    {
+        for (size_t col = 0; col < p; ++col)
+        {
+            double v = 0.0;
+            for (size_t i = 0; i < n; ++i)
+                v += left(row, i) * right(i, col);
+
+            expected(row, col) = v;
+        }
+    }
+
+    for (size_t thread_count : { 0, 4 })
+    {
+        numeric_matrix output = multiply(left, right, thread_count);
+        assert(output.row_size() == m);
+        assert(output.col_size() == p);
+
+        for (size_t row = 0; row < m; ++row)
+            for (size_t col = 0; col < p; ++col)
+                assert(output(row, col) == expected(row, col));
+    }
+
+    try
+    {
+        multiply(left, left);
+        assert(!"exception should have been thrown.");
+    }
+    catch (const std::invalid_argument&)
+    {
+        // expected
+    }
+}
+
 struct ref_name_entry
 {
     const char* name;
@@ -1366,7 +1421,7 @@ formula_cell* insert_formula(
 {
     formula_tokens_t tokens = parse_formula_string(cxt, pos, resolver, exp, strlen(exp));
     auto ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
+    ts->set(std::move(tokens));
     formula_cell* p_inserted = cxt.set_formula_cell(pos, ts);
     assert(p_inserted);
     register_formula_cell(cxt, pos);
@@ -1427,7 +1482,7 @@ void test_model_context_storage()
         const char* exp = "SUM(1,2,3)";
         formula_tokens_t tokens = parse_formula_string(cxt, pos, *resolver, exp, strlen(exp));
         auto ts = formula_tokens_store::create();
-        ts->get() = std::move(tokens);
+        ts->set(std::move(tokens));
         formula_cell* p_inserted = cxt.set_formula_cell(pos, ts);
         assert(p_inserted);
         formula_cell* p = cxt.get_formula_cell(pos);
@@ -2269,6 +2324,605 @@ void test_model_context_error_value()
     assert(ca.get_error_value() == formula_error_t::division_by_zero);
 }
 
+void test_model_context_range_value()
+{
+    cout << "test model context range value" << endl;
+
+    model_context cxt{{100, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    // Column A has a run of numbers followed by a boolean, a string, an
+    // empty cell and formula cells, while column B is entirely empty.
+    for (row_t row = 0; row < 4; ++row)
+        cxt.set_numeric_cell(abs_address_t(0,row,0), row + 1.0);
+
+    cxt.set_boolean_cell(abs_address_t(0,4,0), true);
+    cxt.set_string_cell(abs_address_t(0,5,0), IXION_ASCII("str"));
+
+    auto set_formula = [&](const abs_address_t& pos, const char* exp)
+    {
+        formula_tokens_t tokens = parse_formula_string(cxt, pos, *resolver, exp, strlen(exp));
+        formula_cell* fc = cxt.set_formula_cell(pos, std::move(tokens));
+        fc->interpret(cxt, pos);
+    };
+
+    set_formula(abs_address_t(0,7,0), "A1*10");
+    set_formula(abs_address_t(0,8,0), "1/0");
+
+    // Range starting in the middle of the numeric block.
+    matrix mx = cxt.get_range_value(abs_range_t(0, 1, 0, 9, 2));
+    assert(mx.row_size() == 9);
+    assert(mx.col_size() == 2);
+
+    for (size_t row = 0; row < 3; ++row)
+    {
+        matrix::element e = mx.get(row, 0);
+        assert(e.type == matrix::element_type::numeric);
+        assert(e.numeric == row + 2.0);
+    }
+
+    matrix::element e = mx.get(3, 0);
+    assert(e.type == matrix::element_type::boolean);
+    assert(e.boolean);
+
+    e = mx.get(4, 0);
+    assert(e.type == matrix::element_type::string);
+    assert(*e.str == "str");
+
+    assert(mx.get(5, 0).type == matrix::element_type::empty);
+
+    e = mx.get(6, 0);
+    assert(e.type == matrix::element_type::numeric);
+    assert(e.numeric == 10.0);
+
+    e = mx.get(7, 0);
+    assert(e.type == matrix::element_type::error);
+    assert(e.error == formula_error_t::division_by_zero);
+
+    assert(mx.get(8, 0).type == matrix::element_type::empty);
+
+    for (size_t row = 0; row < mx.row_size(); ++row)
+        assert(mx.get(row, 1).type == matrix::element_type::empty);
+
+    // Whole column range gets clipped to the sheet size.
+    abs_range_t whole_col(0, 0, 0);
+    whole_col.set_all_rows();
+    mx = cxt.get_range_value(whole_col);
+    assert(mx.row_size() == 100);
+    assert(mx.col_size() == 1);
+    assert(mx.get_numeric(0, 0) == 1.0);
+    assert(mx.get(99, 0).type == matrix::element_type::empty);
+}
+
+void test_model_context_walk_range()
+{
+    cout << "test model context walk range" << endl;
+
+    model_context cxt{{100, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    for (row_t row = 0; row < 50; ++row)
+        cxt.set_numeric_cell(abs_address_t(0,row,1), row);
+
+    cxt.set_string_cell(abs_address_t(0,50,1), IXION_ASCII("str"));
+    cxt.set_boolean_cell(abs_address_t(0,51,1), false);
+
+    struct handler : public iface::range_value_handler
+    {
+        std::vector<std::pair<abs_address_t, size_t>> numeric_runs;
+        std::vector<std::pair<abs_address_t, size_t>> empty_runs;
+        std::vector<abs_address_t> strings;
+        std::vector<abs_address_t> booleans;
+        double sum = 0.0;
+
+        virtual void numeric(const abs_address_t& pos, const double* p, size_t n) override
+        {
+            numeric_runs.emplace_back(pos, n);
+            for (size_t i = 0; i < n; ++i)
+                sum += p[i];
+        }
+
+        virtual void boolean(const abs_address_t& pos, bool /*val*/) override
+        {
+            booleans.push_back(pos);
+        }
+
+        virtual void string(const abs_address_t& pos, const std::string& str) override
+        {
+            assert(str == "str");
+            strings.push_back(pos);
+        }
+
+        virtual void empty(const abs_address_t& pos, size_t n) override
+        {
+            empty_runs.emplace_back(pos, n);
+        }
+    };
+
+    // B11:C52 - the numeric run should be passed in one call.
+    handler hdl;
+    cxt.walk_range(abs_range_t(0, 10, 1, 42, 2), hdl);
+
+    assert(hdl.numeric_runs.size() == 1);
+    assert(hdl.numeric_runs[0].first == abs_address_t(0,10,1));
+    assert(hdl.numeric_runs[0].second == 40);
+    assert(hdl.sum == (10 + 49) * 40 / 2);
+
+    assert(hdl.strings.size() == 1);
+    assert(hdl.strings[0] == abs_address_t(0,50,1));
+    assert(hdl.booleans.size() == 1);
+    assert(hdl.booleans[0] == abs_address_t(0,51,1));
+
+    // Column C is entirely empty.
+    assert(hdl.empty_runs.size() == 1);
+    assert(hdl.empty_runs[0].first == abs_address_t(0,10,2));
+    assert(hdl.empty_runs[0].second == 42);
+}
+
+void test_model_context_summary_index()
+{
+    cout << "test model context summary index" << endl;
+
+    const row_t row_size = 10000;
+    model_context cxt{{row_size, 4}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    for (row_t row = 0; row < row_size; ++row)
+        cxt.set_numeric_cell(abs_address_t(0,row,0), row % 100);
+
+    // Aggregate the same rows by visiting every cell.
+    auto summarize_cells = [&](row_t row1, row_t row2)
+    {
+        numeric_summary_t ret;
+        for (row_t row = row1; row <= row2; ++row)
+        {
+            abs_address_t pos(0,row,0);
+            switch (cxt.get_celltype(pos))
+            {
+                case celltype_t::numeric:
+                case celltype_t::boolean:
+                case celltype_t::formula:
+                    ret.add(cxt.get_numeric_value(pos));
+                    break;
+                default:
+                    ;
+            }
+        }
+        return ret;
+    };
+
+    auto check = [&](row_t row1, row_t row2)
+    {
+        numeric_summary_t expected = summarize_cells(row1, row2);
+        numeric_summary_t actual = cxt.summarize_range(abs_range_t(0, row1, 0, row2 - row1 + 1, 1));
+        assert(actual.count == expected.count);
+        assert(actual.sum == expected.sum);
+        assert(actual.min == expected.min);
+        assert(actual.max == expected.max);
+    };
+
+    check(0, row_size - 1);
+    check(1, row_size - 2);
+    check(1000, 7999);
+    check(1024, 3071);
+
+    // Modify individual cells after the index has been built.
+    cxt.set_numeric_cell(abs_address_t(0,3000,0), -50.0);
+    cxt.set_boolean_cell(abs_address_t(0,3001,0), true);
+    cxt.set_string_cell(abs_address_t(0,3002,0), IXION_ASCII("str"));
+    cxt.empty_cell(abs_address_t(0,5000,0));
+    cxt.set_numeric_cell(abs_address_t(0,9999,0), 1000.0);
+
+    const char* exp = "A1*2";
+    abs_address_t pos(0,6000,0);
+    formula_tokens_t tokens = parse_formula_string(cxt, pos, *resolver, exp, strlen(exp));
+    formula_cell* fc = cxt.set_formula_cell(pos, std::move(tokens));
+    fc->interpret(cxt, pos);
+
+    check(0, row_size - 1);
+    check(2999, 6001);
+    check(1024, 3071);
+
+    // Whole column range.
+    abs_range_t whole_col(0, 0, 0);
+    whole_col.set_all_rows();
+    numeric_summary_t summary = cxt.summarize_range(whole_col);
+    assert(summary.count == size_t(row_size - 2));
+    assert(summary.min == -50.0);
+    assert(summary.max == 1000.0);
+}
+
+void test_compiled_formula_tokens()
+{
+    cout << "test compiled formula tokens" << endl;
+
+    model_context cxt{{100, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    auto parse = [&](const abs_address_t& pos, const std::string& formula)
+    {
+        return parse_formula_string(cxt, pos, *resolver, formula.data(), formula.size());
+    };
+
+    cxt.set_numeric_cell(abs_address_t(0,0,0), 2.0); // A1
+    cxt.set_string_cell(abs_address_t(0,1,0), IXION_ASCII("ab")); // A2
+
+    cxt.set_named_expression(IXION_ASCII("MinusOne"), parse(abs_address_t(), "-1"));
+
+    struct test_case
+    {
+        abs_address_t pos;
+        std::string formula;
+        bool compiled;
+        double value;
+        std::string str;
+    };
+
+    std::vector<test_case> cases = {
+        { abs_address_t(0,0,1), "(1+2)*-A1^2", true, 12.0, std::string() },
+        { abs_address_t(0,1,1), "A1*A1/4-A1", true, -1.0, std::string() },
+        { abs_address_t(0,2,1), "A2&\"c\"&A1", true, 0.0, "abc2" },
+        { abs_address_t(0,3,1), "SUM(A1,MAX(1,3),A1:A2)+1", true, 8.0, std::string() },
+        { abs_address_t(0,4,1), "A2<\"b\"", true, 1.0, std::string() },
+        { abs_address_t(0,5,1), "A1*MinusOne", false, -2.0, std::string() },
+    };
+
+    for (const test_case& tc : cases)
+    {
+        formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+        ts->set(parse(tc.pos, tc.formula));
+        assert(!detail::formula_tokens_store_access::get_program(*ts));
+
+        formula_cell* fc = cxt.set_formula_cell(tc.pos, ts);
+        assert(bool(detail::formula_tokens_store_access::get_program(*ts)) == tc.compiled);
+
+        fc->interpret(cxt, tc.pos);
+        formula_result res = fc->get_result_cache(formula_result_wait_policy_t::throw_exception);
+
+        if (tc.str.empty())
+        {
+            assert(res.get_type() == formula_result::result_type::value);
+            assert(res.get_value() == tc.value);
+        }
+        else
+        {
+            assert(res.get_type() == formula_result::result_type::string);
+            assert(res.get_string() == tc.str);
+        }
+    }
+
+    // Replacing the tokens of a store not yet compiled leaves it
+    // uncompiled.
+    formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+    ts->set(parse(abs_address_t(0,6,1), "1+2"));
+    assert(!detail::formula_tokens_store_access::get_program(*ts));
+
+    // Replacing the tokens of a formula cell recompiles them.
+    abs_address_t pos(0,7,1);
+    formula_cell* fc = cxt.set_formula_cell(pos, parse(pos, "1+2"));
+    fc->interpret(cxt, pos);
+    assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == 3.0);
+
+    fc->get_tokens()->set(parse(pos, "5+2"));
+    assert(detail::formula_tokens_store_access::get_program(*fc->get_tokens()));
+    fc->reset();
+    fc->interpret(cxt, pos);
+    assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == 7.0);
+}
+
+void test_compiled_constant_folding()
+{
+    cout << "test compiled constant folding" << endl;
+
+    model_context cxt{{100, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    cxt.set_numeric_cell(abs_address_t(0,0,0), 2.0); // A1
+
+    struct test_case
+    {
+        std::string formula;
+        formula_error_t error;
+        double value;
+    };
+
+    std::vector<test_case> cases = {
+        { "2*PI()/360", formula_error_t::no_error, 2.0 * (M_PI / 360.0) },
+        { "(1+0.05)^12", formula_error_t::no_error, std::pow(1.0 + 0.05, 12.0) },
+        { "-INT(2.5)*3", formula_error_t::no_error, -6.0 },
+        { "(3-1)=2", formula_error_t::no_error, 1.0 },
+        { "A1*(2+3)", formula_error_t::no_error, 10.0 },
+        { "IF(A1>1,2,3)*4", formula_error_t::no_error, 8.0 },
+        { "1/0", formula_error_t::division_by_zero, 0.0 },
+    };
+
+    for (size_t i = 0; i < cases.size(); ++i)
+    {
+        const test_case& tc = cases[i];
+        abs_address_t pos(0, i, 1);
+
+        formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+        ts->set(parse_formula_string(cxt, pos, *resolver, tc.formula.data(), tc.formula.size()));
+
+        formula_cell* fc = cxt.set_formula_cell(pos, ts);
+        assert(detail::formula_tokens_store_access::get_program(*ts));
+
+        // Folding leaves the tokens as they are.
+        assert(print_formula_tokens(cxt, pos, *resolver, ts->get()) == tc.formula);
+
+        fc->interpret(cxt, pos);
+        formula_result res = fc->get_result_cache(formula_result_wait_policy_t::throw_exception);
+
+        if (tc.error != formula_error_t::no_error)
+        {
+            assert(res.get_type() == formula_result::result_type::error);
+            assert(res.get_error() == tc.error);
+        }
+        else
+        {
+            assert(res.get_type() == formula_result::result_type::value);
+            assert(res.get_value() == tc.value);
+        }
+    }
+}
+
+void test_formula_tokens_sharing()
+{
+    cout << "test formula tokens sharing" << endl;
+
+    model_context cxt{{100, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    auto set_formula = [&](const abs_address_t& pos, const std::string& formula)
+    {
+        formula_tokens_t tokens = parse_formula_string(cxt, pos, *resolver, formula.data(), formula.size());
+        return cxt.set_formula_cell(pos, std::move(tokens));
+    };
+
+    // B1:B10 all have the same formula in R1C1 notation.
+    for (row_t row = 0; row < 10; ++row)
+    {
+        cxt.set_numeric_cell(abs_address_t(0,row,0), row);
+        set_formula(abs_address_t(0,row,1), "A" + std::to_string(row+1) + "*2>=10");
+    }
+
+    // C1 refers to the cell to its left like B1 does, but with a different
+    // formula, and C2 refers to a different cell.
+    set_formula(abs_address_t(0,0,2), "A1*3>=10");
+    set_formula(abs_address_t(0,1,2), "A1*2>=10");
+
+    auto get_tokens = [&](const abs_address_t& pos) -> const formula_tokens_t&
+    {
+        return cxt.get_formula_cell(pos)->get_tokens()->get();
+    };
+
+    // Each cell has its own store, but the stores share their tokens.
+    const formula_tokens_t& tokens = get_tokens(abs_address_t(0,0,1));
+    assert(cxt.get_formula_cell(abs_address_t(0,0,1))->get_tokens()->get_reference_count() == 1);
+
+    for (row_t row = 1; row < 10; ++row)
+    {
+        abs_address_t pos(0,row,1);
+        assert(cxt.get_formula_cell(pos)->get_tokens() != cxt.get_formula_cell(abs_address_t(0,0,1))->get_tokens());
+        assert(&get_tokens(pos) == &tokens);
+    }
+
+    assert(&get_tokens(abs_address_t(0,0,2)) != &tokens);
+    assert(&get_tokens(abs_address_t(0,1,2)) != &tokens);
+
+    formula_tokens_sharing_t sharing = cxt.get_formula_tokens_sharing();
+    assert(sharing.stores == 3);
+    assert(sharing.reused == 9);
+    assert(sharing.tokens_saved == 9 * tokens.size());
+
+    for (row_t row = 0; row < 10; ++row)
+    {
+        abs_address_t pos(0,row,1);
+        formula_cell* fc = cxt.get_formula_cell(pos);
+        fc->interpret(cxt, pos);
+        assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == (row >= 5 ? 1.0 : 0.0));
+    }
+
+    // Modifying the tokens of one cell leaves the other cells unchanged.
+    abs_address_t pos(0,9,1);
+    formula_cell* fc = cxt.get_formula_cell(pos);
+    std::string formula = "A10*0>=10";
+    fc->get_tokens()->set(parse_formula_string(cxt, pos, *resolver, formula.data(), formula.size()));
+    assert(&get_tokens(pos) != &tokens);
+    assert(print_formula_tokens(cxt, abs_address_t(0,0,1), *resolver, tokens) == "A1*2>=10");
+
+    for (row_t row = 8; row < 10; ++row)
+    {
+        abs_address_t pos(0,row,1);
+        formula_cell* fc = cxt.get_formula_cell(pos);
+        fc->reset();
+        fc->interpret(cxt, pos);
+        assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == (row == 8 ? 1.0 : 0.0));
+    }
+
+    // The shared tokens get destroyed along with the last cell sharing
+    // them.
+    for (row_t row = 0; row < 9; ++row)
+        cxt.empty_cell(abs_address_t(0,row,1));
+
+    sharing = cxt.get_formula_tokens_sharing();
+    assert(sharing.stores == 2);
+}
+
+void test_compact_formula_groups()
+{
+    cout << "test compact formula groups" << endl;
+
+    // Two identical models, only one of which gets its formula cells
+    // grouped.
+    model_context cxt1{{100, 10}}, cxt2{{100, 10}};
+    abs_range_set_t formula_cells;
+
+    for (model_context* cxt : { &cxt1, &cxt2 })
+    {
+        cxt->append_sheet(IXION_ASCII("test"));
+
+        auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, cxt);
+        assert(resolver);
+
+        auto set_formula = [&](const abs_address_t& pos, const std::string& formula)
+        {
+            formula_tokens_t tokens = parse_formula_string(*cxt, pos, *resolver, formula.data(), formula.size());
+            cxt->set_formula_cell(pos, std::move(tokens));
+            register_formula_cell(*cxt, pos);
+            formula_cells.insert(pos);
+        };
+
+        for (row_t row = 0; row < 6; ++row)
+            cxt->set_numeric_cell(abs_address_t(0,row,0), row + 1);
+
+        cxt->set_string_cell(abs_address_t(0,2,0), IXION_ASCII("x")); // A3
+        cxt->set_numeric_cell(abs_address_t(0,0,2), 10.0); // C1
+        cxt->set_numeric_cell(abs_address_t(0,0,3), 0.0); // D1
+
+        for (row_t row = 0; row < 6; ++row)
+        {
+            std::string r = std::to_string(row + 1);
+            set_formula(abs_address_t(0,row,1), "(A" + r + "-1)/(A" + r + "-2)+$C$1"); // B1:B6
+            set_formula(abs_address_t(0,row,4), "A" + r + "=\"x\""); // E1:E6
+            set_formula(abs_address_t(0,row,5), "$C$1*2"); // F1:F6
+
+            if (row)
+                set_formula(abs_address_t(0,row,3), "D" + std::to_string(row) + "+1"); // D2:D6
+        }
+    }
+
+    abs_range_set_t groups = cxt1.compact_formula_groups();
+
+    // The running total in column D refers to its own cells, and the
+    // strings in column E can't be evaluated element-wise.
+    abs_range_set_t expected;
+    expected.insert(abs_range_t(0,0,1,6,1)); // B1:B6
+    expected.insert(abs_range_t(0,0,5,6,1)); // F1:F6
+    assert(groups == expected);
+
+    formula_group_t fg = cxt1.get_formula_cell(abs_address_t(0,5,1))->get_group_properties();
+    assert(fg.grouped);
+    assert(fg.size.row == 6 && fg.size.column == 1);
+    assert(!cxt1.get_formula_cell(abs_address_t(0,5,3))->get_group_properties().grouped);
+
+    auto check = [&]()
+    {
+        for (const abs_range_t& r : formula_cells)
+        {
+            formula_result res1 = cxt1.get_formula_result(r.first);
+            formula_result res2 = cxt2.get_formula_result(r.first);
+            assert(res1 == res2);
+        }
+    };
+
+    abs_range_set_t dirty1 = formula_cells;
+    for (const abs_range_t& r : groups)
+    {
+        for (abs_address_t pos = r.first; pos.row <= r.last.row; ++pos.row)
+            dirty1.erase(pos);
+
+        dirty1.insert(r.first);
+    }
+
+    calculate_sorted_cells(cxt1, query_and_sort_dirty_cells(cxt1, abs_range_set_t(), &dirty1), 0);
+    calculate_sorted_cells(cxt2, query_and_sort_dirty_cells(cxt2, abs_range_set_t(), &formula_cells), 0);
+    check();
+
+    // A3 contains a string, and A2 divides by zero.
+    assert(cxt1.get_formula_result(abs_address_t(0,2,1)).get_type() == formula_result::result_type::error);
+    assert(cxt1.get_formula_result(abs_address_t(0,1,1)).get_error() == formula_error_t::division_by_zero);
+    assert(cxt1.get_formula_result(abs_address_t(0,3,1)).get_value() == 3.0 / 2.0 + 10.0);
+
+    // The group gets recalculated when one of its precedents is modified.
+    abs_range_set_t modified;
+    modified.insert(abs_address_t(0,2,0)); // A3
+
+    for (model_context* cxt : { &cxt1, &cxt2 })
+    {
+        cxt->set_numeric_cell(abs_address_t(0,2,0), 5.0);
+        calculate_sorted_cells(*cxt, query_and_sort_dirty_cells(*cxt, modified, nullptr), 0);
+    }
+
+    check();
+    assert(cxt1.get_formula_result(abs_address_t(0,2,1)).get_value() == 4.0 / 3.0 + 10.0);
+}
+
+void test_named_expression_expansion_cache()
+{
+    cout << "test named expression expansion cache" << endl;
+
+    model_context cxt{{100, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    auto parse = [&](const abs_address_t& pos, const std::string& formula)
+    {
+        return parse_formula_string(cxt, pos, *resolver, formula.data(), formula.size());
+    };
+
+    cxt.set_named_expression(IXION_ASCII("Ten"), parse(abs_address_t(), "10"));
+    cxt.set_named_expression(IXION_ASCII("TenPlusOne"), parse(abs_address_t(), "Ten+1"));
+
+    abs_address_t pos(0,0,0);
+    formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+    ts->set(parse(pos, "TenPlusOne*2"));
+    formula_cell* fc = cxt.set_formula_cell(pos, ts);
+    assert(!detail::formula_tokens_store_access::get_program(*ts));
+
+    size_t revision = cxt.get_named_expressions_revision();
+    assert(revision);
+    assert(!detail::formula_tokens_store_access::get_expanded_tokens(*ts, pos.sheet, revision));
+
+    fc->interpret(cxt, pos);
+    assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == 22.0);
+
+    auto expanded = detail::formula_tokens_store_access::get_expanded_tokens(*ts, pos.sheet, revision);
+    assert(expanded);
+
+    // Second run re-uses the cached expansion.
+    fc->reset();
+    fc->interpret(cxt, pos);
+    assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == 22.0);
+    assert(detail::formula_tokens_store_access::get_expanded_tokens(*ts, pos.sheet, revision) == expanded);
+
+    // A sheet-local name shadowing the global one invalidates the cache.
+    cxt.set_named_expression(0, IXION_ASCII("Ten"), parse(abs_address_t(), "20"));
+    assert(cxt.get_named_expressions_revision() != revision);
+    revision = cxt.get_named_expressions_revision();
+    assert(!detail::formula_tokens_store_access::get_expanded_tokens(*ts, pos.sheet, revision));
+
+    fc->reset();
+    fc->interpret(cxt, pos);
+    assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == 42.0);
+    assert(detail::formula_tokens_store_access::get_expanded_tokens(*ts, pos.sheet, revision));
+
+    // Modifying the tokens discards the cached expansion.
+    ts->set(parse(pos, "TenPlusOne*3"));
+    assert(!detail::formula_tokens_store_access::get_expanded_tokens(*ts, pos.sheet, revision));
+
+    fc->reset();
+    fc->interpret(cxt, pos);
+    assert(fc->get_value(formula_result_wait_policy_t::throw_exception) == 63.0);
+}
+
 void test_volatile_function()
 {
     cout << "test volatile function" << endl;
@@ -2347,6 +3001,382 @@ void test_volatile_function()
     assert(0.2 <= delta && delta <= 0.3);
 }
 
+void test_threaded_calc_priority()
+{
+    cout << "test threaded calc priority" << endl;
+
+    for (calc_priority_t priority : { calc_priority_t::sorted_order, calc_priority_t::critical_path })
+    {
+        model_context cxt{{400, 10}};
+        auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+        assert(resolver);
+
+        config cfg = cxt.get_config();
+        cfg.calc_priority = priority;
+        cxt.set_config(cfg);
+
+        cxt.append_sheet(IXION_ASCII("test"));
+
+        abs_range_set_t modified_cells;
+        abs_range_set_t dirty_cells;
+
+        // A long chain of formula cells in column A, and many independent
+        // formula cells in column B that only depend on A1.
+        cxt.set_numeric_cell(abs_address_t(0,0,0), 1.0);
+
+        for (row_t row = 1; row < 300; ++row)
+        {
+            std::ostringstream os;
+            os << 'A' << row << "+1";
+            insert_formula(cxt, abs_address_t(0,row,0), os.str().c_str(), *resolver);
+            dirty_cells.insert(abs_address_t(0,row,0));
+
+            insert_formula(cxt, abs_address_t(0,row,1), "A1*2", *resolver);
+            dirty_cells.insert(abs_address_t(0,row,1));
+        }
+
+        auto sorted = ixion::query_and_sort_dirty_cells(cxt, modified_cells, &dirty_cells);
+        ixion::calculate_sorted_cells(cxt, sorted, 4);
+
+        for (row_t row = 0; row < 300; ++row)
+            assert(cxt.get_numeric_value(abs_address_t(0,row,0)) == row + 1);
+
+        for (row_t row = 1; row < 300; ++row)
+            assert(cxt.get_numeric_value(abs_address_t(0,row,1)) == 2.0);
+
+        // Modify A1 and recalculate.
+        cxt.set_numeric_cell(abs_address_t(0,0,0), 11.0);
+        modified_cells.insert(abs_address_t(0,0,0));
+        dirty_cells.clear();
+        sorted = ixion::query_and_sort_dirty_cells(cxt, modified_cells, &dirty_cells);
+        assert(sorted.size() == 299*2);
+        ixion::calculate_sorted_cells(cxt, sorted, 4);
+
+        assert(cxt.get_numeric_value(abs_address_t(0,299,0)) == 310.0);
+        assert(cxt.get_numeric_value(abs_address_t(0,299,1)) == 22.0);
+    }
+}
+
+void test_threaded_calc_ranges_lookups()
+{
+    cout << "test threaded calc ranges lookups" << endl;
+
+    // Two identical models, calculated with and without threads.
+    model_context cxt1{{400, 10}}, cxt2{{400, 10}};
+    std::vector<abs_range_t> sorted1, sorted2;
+    const row_t n_rows = 200;
+
+    for (model_context* cxt : { &cxt1, &cxt2 })
+    {
+        cxt->append_sheet(IXION_ASCII("test"));
+
+        auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, cxt);
+        assert(resolver);
+
+        abs_range_set_t modified_cells;
+        abs_range_set_t dirty_cells;
+
+        for (row_t row = 0; row < n_rows; ++row)
+        {
+            cxt->set_numeric_cell(abs_address_t(0,row,0), row % 7);
+            std::string key = "k" + std::to_string(row % 5);
+            cxt->set_string_cell(abs_address_t(0,row,1), key.data(), key.size());
+        }
+
+        // Column C mixes range aggregates, lookups and criteria, and column
+        // D is a formula group over column C.
+        for (row_t row = 0; row < n_rows; ++row)
+        {
+            std::string r = std::to_string(row + 1);
+            std::string formula;
+
+            switch (row % 4)
+            {
+                case 0:
+                    formula = "SUM(A$1:A" + r + ")";
+                    break;
+                case 1:
+                    formula = "MATCH(A" + r + ",A$1:A$200,0)";
+                    break;
+                case 2:
+                    formula = "SUMIF(B$1:B$200,B" + r + ",A$1:A$200)";
+                    break;
+                case 3:
+                    formula = "COUNTIF(A$1:A$200,\">3\")+C" + std::to_string(row);
+                    break;
+            }
+
+            abs_address_t pos(0,row,2);
+            insert_formula(*cxt, pos, formula.c_str(), *resolver);
+            dirty_cells.insert(pos);
+        }
+
+        abs_range_t group_range(0,0,3,n_rows,1);
+        const char* group_formula = "C1:C200*2";
+        formula_tokens_t tokens = parse_formula_string(
+            *cxt, group_range.first, *resolver, group_formula, strlen(group_formula));
+        cxt->set_grouped_formula_cells(group_range, std::move(tokens));
+        register_formula_cell(*cxt, group_range.first);
+        dirty_cells.insert(group_range);
+
+        std::vector<abs_range_t>& sorted = cxt == &cxt1 ? sorted1 : sorted2;
+        sorted = ixion::query_and_sort_dirty_cells(*cxt, modified_cells, &dirty_cells);
+    }
+
+    // Enough formula cells to calculate with threads by default.
+    assert(sorted1.size() >= cxt1.get_config().min_cells_for_threads);
+
+    ixion::calculate_sorted_cells(cxt1, sorted1, 4);
+    ixion::calculate_sorted_cells(cxt2, sorted2, 0);
+
+    // The thread count is only set for the duration of the calculation.
+    assert(cxt1.get_calc_thread_count() == 0);
+
+    for (row_t row = 0; row < n_rows; ++row)
+    {
+        for (col_t col = 2; col <= 3; ++col)
+        {
+            abs_address_t pos(0,row,col);
+            formula_result res1 = cxt1.get_formula_result(pos);
+            formula_result res2 = cxt2.get_formula_result(pos);
+            assert(res1.get_type() == formula_result::result_type::value);
+            assert(res1 == res2);
+        }
+    }
+
+    assert(cxt1.get_numeric_value(abs_address_t(0,0,2)) == 0.0); // SUM(A$1:A1)
+    assert(cxt1.get_numeric_value(abs_address_t(0,9,2)) == 3.0); // MATCH(A10,...)
+    assert(cxt1.get_numeric_value(abs_address_t(0,9,3)) == 6.0); // C10*2
+}
+
+void test_sliding_window_formula_inputs()
+{
+    cout << "test sliding window formula inputs" << endl;
+
+    // Sliding windows over a column of formula cells, which can't be
+    // evaluated as a run, plus averages over empty windows.
+    const row_t n_rows = 2000;
+    model_context cxt{{n_rows + 10, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    abs_range_set_t modified_cells;
+    abs_range_set_t dirty_cells;
+
+    for (row_t row = 0; row < n_rows; ++row)
+        cxt.set_numeric_cell(abs_address_t(0,row,0), row % 10);
+
+    // Only the first few rows of column E have values.
+    for (row_t row = 0; row < 5; ++row)
+        cxt.set_numeric_cell(abs_address_t(0,row,4), row);
+
+    for (row_t row = 0; row < n_rows; ++row)
+    {
+        std::string r = std::to_string(row + 1);
+        std::string r2 = std::to_string(row + 2);
+        std::string r3 = std::to_string(row + 3);
+
+        const std::pair<col_t, std::string> formulas[] = {
+            { 1, "A" + r + "+1" },
+            { 2, "SUM(B" + r + ":B" + r3 + ")" },
+            { 3, "AVERAGE(E" + r + ":E" + r2 + ")" },
+        };
+
+        for (const auto& f : formulas)
+        {
+            abs_address_t pos(0,row,f.first);
+            insert_formula(cxt, pos, f.second.c_str(), *resolver);
+            dirty_cells.insert(pos);
+        }
+    }
+
+    std::vector<abs_range_t> sorted = ixion::query_and_sort_dirty_cells(cxt, modified_cells, &dirty_cells);
+    ixion::calculate_sorted_cells(cxt, sorted, 4);
+
+    for (row_t row = 0; row < n_rows; ++row)
+    {
+        double window = 0.0;
+        for (row_t i = row; i < row + 3 && i < n_rows; ++i)
+            window += i % 10 + 1;
+
+        assert(cxt.get_numeric_value(abs_address_t(0,row,2)) == window);
+
+        formula_result res = cxt.get_formula_result(abs_address_t(0,row,3));
+        if (row < 5)
+        {
+            assert(res.get_type() == formula_result::result_type::value);
+            assert(res.get_value() == (row < 4 ? row + 0.5 : 4.0));
+        }
+        else
+        {
+            assert(res.get_type() == formula_result::result_type::error);
+            assert(res.get_error() == formula_error_t::division_by_zero);
+        }
+    }
+}
+
+void test_running_total_formula_inputs()
+{
+    cout << "test running total formula inputs" << endl;
+
+    // Running totals anchored at either end of a column whose first cell is
+    // a constant and the rest are formula cells.  Only the first window is
+    // free of formula cells, so the run falls back to normal evaluation.
+    const row_t n_rows = 1000;
+    model_context cxt{{n_rows + 10, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    auto resolver = formula_name_resolver::get(formula_name_resolver_t::excel_a1, &cxt);
+    assert(resolver);
+
+    abs_range_set_t modified_cells;
+    abs_range_set_t dirty_cells;
+
+    for (row_t row = 0; row < n_rows; ++row)
+        cxt.set_numeric_cell(abs_address_t(0,row,0), row % 10);
+
+    cxt.set_numeric_cell(abs_address_t(0,0,1), 100.0);
+
+    std::string last = std::to_string(n_rows);
+
+    for (row_t row = 0; row < n_rows; ++row)
+    {
+        std::string r = std::to_string(row + 1);
+        std::vector<std::pair<col_t, std::string>> formulas = {
+            { 2, "SUM($B$1:B" + r + ")" },
+            { 3, "SUM(B" + r + ":$B$" + last + ")" },
+        };
+
+        if (row)
+            formulas.emplace_back(1, "A" + r + "+1");
+
+        for (const auto& f : formulas)
+        {
+            abs_address_t pos(0,row,f.first);
+            insert_formula(cxt, pos, f.second.c_str(), *resolver);
+            dirty_cells.insert(pos);
+        }
+    }
+
+    std::vector<abs_range_t> sorted = ixion::query_and_sort_dirty_cells(cxt, modified_cells, &dirty_cells);
+    ixion::calculate_sorted_cells(cxt, sorted, 4);
+
+    std::vector<double> values(n_rows, 100.0);
+    double grand_total = values[0];
+    for (row_t row = 1; row < n_rows; ++row)
+    {
+        values[row] = row % 10 + 1;
+        grand_total += values[row];
+    }
+
+    double total = 0.0;
+
+    for (row_t row = 0; row < n_rows; ++row)
+    {
+        total += values[row];
+        assert(cxt.get_numeric_value(abs_address_t(0,row,2)) == total);
+        assert(cxt.get_numeric_value(abs_address_t(0,row,3)) == grand_total - total + values[row]);
+    }
+}
+
+void test_find_in_range()
+{
+    cout << "test find in range" << endl;
+
+    model_context cxt{{100, 10}};
+    cxt.append_sheet(IXION_ASCII("test"));
+
+    // A1:A8 and A1:H1 hold the same values.
+    const double values[] = { 3, 1, 4, 1, 5, 9, 2, 6 };
+    for (row_t i = 0; i < 8; ++i)
+    {
+        cxt.set_numeric_cell(abs_address_t(0,i,0), values[i]);
+        if (i)
+            cxt.set_numeric_cell(abs_address_t(0,0,i), values[i]);
+    }
+
+    cxt.set_string_cell(abs_address_t(0,8,0), IXION_ASCII("Apple")); // A9
+    cxt.set_string_cell(abs_address_t(0,9,0), IXION_ASCII("apple")); // A10
+
+    struct test_case
+    {
+        double value;
+        lookup_match_t match;
+        lookup_search_t search;
+        bool found;
+        size_t pos;
+    };
+
+    const test_case cases[] = {
+        { 1.0, lookup_match_t::exact, lookup_search_t::first, true, 1 },
+        { 1.0, lookup_match_t::exact, lookup_search_t::last, true, 3 },
+        { 7.0, lookup_match_t::exact, lookup_search_t::first, false, 0 },
+        { 7.0, lookup_match_t::exact_or_smaller, lookup_search_t::first, true, 7 },
+        { 1.5, lookup_match_t::exact_or_smaller, lookup_search_t::last, true, 3 },
+        { 0.5, lookup_match_t::exact_or_smaller, lookup_search_t::first, false, 0 },
+        { 4.5, lookup_match_t::exact_or_larger, lookup_search_t::first, true, 4 },
+        { 10.0, lookup_match_t::exact_or_larger, lookup_search_t::first, false, 0 },
+    };
+
+    const abs_range_t ranges[] = {
+        abs_range_t(0,0,0,10,1), // A1:A10
+        abs_range_t(0,0,0,1,8), // A1:H1
+    };
+
+    // The first lookup of a range scans it, and the later ones use its
+    // index.  Both must find the same cells.
+    for (int i = 0; i < 3; ++i)
+    {
+        for (const abs_range_t& range : ranges)
+        {
+            for (const test_case& tc : cases)
+            {
+                size_t pos = 0;
+                assert(cxt.find_in_range(range, tc.value, tc.match, tc.search, pos) == tc.found);
+                if (tc.found)
+                    assert(pos == tc.pos);
+            }
+        }
+
+        size_t pos = 0;
+        assert(cxt.find_in_range(ranges[0], std::string("APPLE"), lookup_match_t::exact, lookup_search_t::first, pos));
+        assert(pos == 8);
+        assert(cxt.find_in_range(ranges[0], std::string("APPLE"), lookup_match_t::exact, lookup_search_t::last, pos));
+        assert(pos == 9);
+        assert(!cxt.find_in_range(ranges[0], 0.0, lookup_match_t::exact, lookup_search_t::first, pos));
+    }
+
+    // Editing a cell in a range discards its index.
+    cxt.set_numeric_cell(abs_address_t(0,2,0), 1.0); // A3
+    cxt.set_numeric_cell(abs_address_t(0,0,2), 1.0); // C1
+
+    for (const abs_range_t& range : ranges)
+    {
+        size_t pos = 0;
+        assert(cxt.find_in_range(range, 1.0, lookup_match_t::exact, lookup_search_t::last, pos));
+        assert(pos == 3);
+        assert(!cxt.find_in_range(range, 4.0, lookup_match_t::exact, lookup_search_t::first, pos));
+    }
+
+    // Looking up more ranges than the indices stored discards the least
+    // recently looked up ones.
+    for (row_t row = 0; row < 50; ++row)
+    {
+        for (row_t len = 1; len <= 8; ++len)
+        {
+            abs_range_t range(0,row,0,len,1);
+            size_t pos = 0;
+            for (int i = 0; i < 2; ++i)
+            {
+                bool found = cxt.find_in_range(range, 9.0, lookup_match_t::exact, lookup_search_t::first, pos);
+                assert(found == (row <= 5 && 5 < row + len));
+            }
+        }
+    }
+}
+
 void test_invalid_formula_tokens()
 {
     model_context cxt;
@@ -2404,6 +3434,7 @@ int main()
     test_formula_tokens_store();
     test_matrix();
     test_matrix_non_numeric_values();
+    test_matrix_multiply();
 
     test_name_resolver_calc_a1();
     test_name_resolver_excel_a1();
@@ -2425,7 +3456,20 @@ int main()
     test_model_context_iterator_named_exps();
     test_model_context_fill_down();
     test_model_context_error_value();
+    test_model_context_range_value();
+    test_model_context_walk_range();
+    test_model_context_summary_index();
+    test_compiled_formula_tokens();
+    test_compiled_constant_folding();
+    test_formula_tokens_sharing();
+    test_compact_formula_groups();
+    test_named_expression_expansion_cache();
     test_volatile_function();
+    test_threaded_calc_priority();
+    test_threaded_calc_ranges_lookups();
+    test_sliding_window_formula_inputs();
+    test_running_total_formula_inputs();
+    test_find_in_range();
     test_invalid_formula_tokens();
     test_grouped_formula_string_results();
 
@@ -29,7 +29,7 @@ void test_single_cell_dependency()
     abs_address_t pos(0,1,0);
     formula_tokens_t tokens = parse_formula_string(cxt, pos, *resolver, IXION_ASCII("A1*2"));
     formula_tokens_store_ptr_t store = formula_tokens_store::create();
-    store->get() = std::move(tokens);
+    store->set(std::move(tokens));
     cxt.set_formula_cell(pos, store);
     register_formula_cell(cxt, pos);
 
@@ -37,7 +37,7 @@ void test_single_cell_dependency()
     pos.row = 2;
     tokens = parse_formula_string(cxt, pos, *resolver, IXION_ASCII("A2*2"));
     store = formula_tokens_store::create();
-    store->get() = std::move(tokens);
+    store->set(std::move(tokens));
     cxt.set_formula_cell(pos, store);
     register_formula_cell(cxt, pos);
 
@@ -72,7 +72,7 @@ void test_range_dependency()
     abs_address_t pos(0,4,2);
     formula_tokens_t tokens = parse_formula_string(cxt, pos, *resolver, IXION_ASCII("SUM(A1:A3,C1:E1)"));
     auto ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
+    ts->set(std::move(tokens));
     cxt.set_formula_cell(pos, ts);
     register_formula_cell(cxt, pos);
 
@@ -81,7 +81,7 @@ void test_range_dependency()
     pos.column = 0;
     tokens = parse_formula_string(cxt, pos, *resolver, IXION_ASCII("C5*2"));
     ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
+    ts->set(std::move(tokens));
     cxt.set_formula_cell(pos, ts);
     register_formula_cell(cxt, pos);
 
@@ -123,7 +123,7 @@ void test_matrix_dependency()
     abs_address_t pos(0,9,0);
     tokens = parse_formula_string(cxt, pos, *resolver, IXION_ASCII("C5*2"));
     auto ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
+    ts->set(std::move(tokens));
     cxt.set_formula_cell(pos, ts);
     register_formula_cell(cxt, pos);
 
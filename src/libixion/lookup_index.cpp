@@ -0,0 +1,243 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "lookup_index.hpp"
+
+#include "ixion/interface/formula_model_access.hpp"
+#include "ixion/interface/range_value_handler.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+std::string to_lower(const std::string& str)
+{
+    std::string ret = str;
+    std::transform(ret.begin(), ret.end(), ret.begin(),
+        [](char c) { return std::tolower(static_cast<unsigned char>(c)); });
+    return ret;
+}
+
+template<typename Key>
+bool key_less(const std::pair<Key, size_t>& entry, const Key& key)
+{
+    return entry.first < key;
+}
+
+template<typename Key>
+bool key_greater(const Key& key, const std::pair<Key, size_t>& entry)
+{
+    return key < entry.first;
+}
+
+template<typename ValueIndex, typename StringIndex>
+class index_builder : public iface::range_value_handler
+{
+    ValueIndex& m_values;
+    StringIndex& m_strings;
+    abs_address_t m_origin;
+
+    size_t get_pos(const abs_address_t& pos) const
+    {
+        // Either the row or the column offset is always 0.
+        return (pos.row - m_origin.row) + (pos.column - m_origin.column);
+    }
+
+public:
+    index_builder(ValueIndex& values, StringIndex& strings, const abs_address_t& origin) :
+        m_values(values), m_strings(strings), m_origin(origin) {}
+
+    virtual void numeric(const abs_address_t& pos, const double* p, size_t n) override
+    {
+        size_t first = get_pos(pos);
+        for (size_t i = 0; i < n; ++i)
+            m_values.add(p[i], first + i);
+    }
+
+    virtual void string(const abs_address_t& pos, const std::string& str) override
+    {
+        m_strings.add(to_lower(str), get_pos(pos));
+    }
+};
+
+/**
+ * Keeps the best match for a key among the values it gets passed, in the
+ * order of their positions.
+ */
+template<typename Key>
+class key_scanner
+{
+    const Key& m_key;
+    lookup_match_t m_match;
+    lookup_search_t m_search;
+
+    bool m_found;
+    Key m_best;
+    size_t m_pos;
+
+public:
+    key_scanner(const Key& key, lookup_match_t match, lookup_search_t search) :
+        m_key(key), m_match(match), m_search(search), m_found(false), m_best(), m_pos(0) {}
+
+    void add(const Key& key, size_t pos)
+    {
+        switch (m_match)
+        {
+            case lookup_match_t::exact:
+                if (key != m_key)
+                    return;
+                break;
+            case lookup_match_t::exact_or_smaller:
+                if (m_key < key || (m_found && key < m_best))
+                    return;
+                break;
+            case lookup_match_t::exact_or_larger:
+                if (key < m_key || (m_found && m_best < key))
+                    return;
+                break;
+        }
+
+        bool tie = m_found && !(key < m_best) && !(m_best < key);
+        if (tie && m_search == lookup_search_t::first)
+            return;
+
+        m_found = true;
+        m_best = key;
+        m_pos = pos;
+    }
+
+    bool get(size_t& pos) const
+    {
+        if (m_found)
+            pos = m_pos;
+
+        return m_found;
+    }
+};
+
+template<typename Key>
+struct key_ignorer
+{
+    void add(const Key&, size_t) {}
+};
+
+}
+
+template<typename Key>
+void lookup_index::key_index<Key>::add(const Key& key, size_t pos)
+{
+    auto r = positions.emplace(key, std::make_pair(pos, pos));
+    if (!r.second)
+        r.first->second.second = pos;
+
+    sorted.emplace_back(key, pos);
+}
+
+template<typename Key>
+void lookup_index::key_index<Key>::sort()
+{
+    std::sort(sorted.begin(), sorted.end());
+}
+
+template<typename Key>
+bool lookup_index::key_index<Key>::find(
+    const Key& key, lookup_match_t match, lookup_search_t search, size_t& pos) const
+{
+    switch (match)
+    {
+        case lookup_match_t::exact:
+        {
+            auto it = positions.find(key);
+            if (it == positions.end())
+                return false;
+
+            pos = search == lookup_search_t::first ? it->second.first : it->second.second;
+            return true;
+        }
+        case lookup_match_t::exact_or_smaller:
+        {
+            // Last entry whose key is not greater than the lookup key.
+            auto it = std::upper_bound(sorted.begin(), sorted.end(), key, key_greater<Key>);
+            if (it == sorted.begin())
+                return false;
+
+            --it;
+            if (search == lookup_search_t::first)
+                it = std::lower_bound(sorted.begin(), it, it->first, key_less<Key>);
+
+            pos = it->second;
+            return true;
+        }
+        case lookup_match_t::exact_or_larger:
+        {
+            // First entry whose key is not less than the lookup key.
+            auto it = std::lower_bound(sorted.begin(), sorted.end(), key, key_less<Key>);
+            if (it == sorted.end())
+                return false;
+
+            if (search == lookup_search_t::last)
+                it = std::prev(std::upper_bound(it, sorted.end(), it->first, key_greater<Key>));
+
+            pos = it->second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+lookup_index::lookup_index(const iface::formula_model_access& cxt, const abs_range_t& range)
+{
+    index_builder<key_index<double>, key_index<std::string>> builder(m_values, m_strings, range.first);
+    cxt.walk_range(range, builder);
+
+    m_values.sort();
+    m_strings.sort();
+}
+
+bool lookup_index::find(double value, lookup_match_t match, lookup_search_t search, size_t& pos) const
+{
+    return m_values.find(value, match, search, pos);
+}
+
+bool lookup_index::find(
+    const std::string& value, lookup_match_t match, lookup_search_t search, size_t& pos) const
+{
+    return m_strings.find(to_lower(value), match, search, pos);
+}
+
+bool scan_range(
+    const iface::formula_model_access& cxt, const abs_range_t& range,
+    double value, lookup_match_t match, lookup_search_t search, size_t& pos)
+{
+    key_scanner<double> values(value, match, search);
+    key_ignorer<std::string> strings;
+    index_builder<key_scanner<double>, key_ignorer<std::string>> builder(values, strings, range.first);
+    cxt.walk_range(range, builder);
+
+    return values.get(pos);
+}
+
+bool scan_range(
+    const iface::formula_model_access& cxt, const abs_range_t& range,
+    const std::string& value, lookup_match_t match, lookup_search_t search, size_t& pos)
+{
+    std::string key = to_lower(value);
+    key_ignorer<double> values;
+    key_scanner<std::string> strings(key, match, search);
+    index_builder<key_ignorer<double>, key_scanner<std::string>> builder(values, strings, range.first);
+    cxt.walk_range(range, builder);
+
+    return strings.get(pos);
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,132 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_LOOKUP_INDEX_HPP
+#define INCLUDED_IXION_LOOKUP_INDEX_HPP
+
+#include "ixion/address.hpp"
+#include "ixion/types.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ixion {
+
+namespace iface {
+
+class formula_model_access;
+
+}
+
+namespace detail {
+
+/**
+ * Index of the values in a single-row or single-column range, for looking
+ * up the position of a value in it without scanning the range each time.
+ * Numeric and string values are indexed separately, as a numeric lookup
+ * value never matches a string value and vice versa.  String values are
+ * matched case-insensitively.  Boolean, error and empty cells are not
+ * indexed.  Each value is stored both in a hash table for exact matches and
+ * in a sorted array for approximate matches.
+ *
+ * A position is the offset of a cell from the first cell of the range.
+ */
+class lookup_index
+{
+    template<typename Key>
+    struct key_index
+    {
+        /** First and last positions of each key. */
+        std::unordered_map<Key, std::pair<size_t, size_t>> positions;
+
+        /** Keys paired with their positions, sorted by key then position. */
+        std::vector<std::pair<Key, size_t>> sorted;
+
+        void add(const Key& key, size_t pos);
+        void sort();
+        bool find(const Key& key, lookup_match_t match, lookup_search_t search, size_t& pos) const;
+    };
+
+    key_index<double> m_values;
+    key_index<std::string> m_strings;
+
+public:
+    /**
+     * Build an index from the current values of a range.
+     *
+     * @param cxt model that stores the values.
+     * @param range single-row or single-column range to index.
+     */
+    lookup_index(const iface::formula_model_access& cxt, const abs_range_t& range);
+
+    /**
+     * Find the position of a numeric value.
+     *
+     * @param value value to look up.
+     * @param match type of match to look for.
+     * @param search which position to pick when multiple cells match.
+     * @param pos position of the matching cell, set only when found.
+     *
+     * @return true if a matching cell has been found, false otherwise.
+     */
+    bool find(double value, lookup_match_t match, lookup_search_t search, size_t& pos) const;
+
+    /**
+     * Find the position of a string value.
+     *
+     * @param value value to look up.
+     * @param match type of match to look for.
+     * @param search which position to pick when multiple cells match.
+     * @param pos position of the matching cell, set only when found.
+     *
+     * @return true if a matching cell has been found, false otherwise.
+     */
+    bool find(const std::string& value, lookup_match_t match, lookup_search_t search, size_t& pos) const;
+};
+
+/**
+ * Find the position of a numeric value in a single-row or single-column
+ * range by scanning its current values, without building an index.  It
+ * matches the values the same way lookup_index does.
+ *
+ * @param cxt model that stores the values.
+ * @param range single-row or single-column range to scan.
+ * @param value value to look up.
+ * @param match type of match to look for.
+ * @param search which position to pick when multiple cells match.
+ * @param pos position of the matching cell, set only when found.
+ *
+ * @return true if a matching cell has been found, false otherwise.
+ */
+bool scan_range(
+    const iface::formula_model_access& cxt, const abs_range_t& range,
+    double value, lookup_match_t match, lookup_search_t search, size_t& pos);
+
+/**
+ * Find the position of a string value in a single-row or single-column
+ * range by scanning its current values, without building an index.  It
+ * matches the values the same way lookup_index does.
+ *
+ * @param cxt model that stores the values.
+ * @param range single-row or single-column range to scan.
+ * @param value value to look up.
+ * @param match type of match to look for.
+ * @param search which position to pick when multiple cells match.
+ * @param pos position of the matching cell, set only when found.
+ *
+ * @return true if a matching cell has been found, false otherwise.
+ */
+bool scan_range(
+    const iface::formula_model_access& cxt, const abs_range_t& range,
+    const std::string& value, lookup_match_t match, lookup_search_t search, size_t& pos);
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
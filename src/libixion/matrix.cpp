@@ -9,14 +9,113 @@
 #include "ixion/global.hpp"
 #include "column_store_type.hpp"
 
+#if IXION_THREADS
+#include "thread_pool.hpp"
+#endif
+
 #include <limits>
 #include <cstring>
 #include <functional>
+#include <algorithm>
+#include <stdexcept>
 
 namespace ixion {
 
 const double nan = std::numeric_limits<double>::quiet_NaN();
 
+namespace {
+
+/**
+ * Number of rows and columns of the block of the left matrix that the
+ * inner loops of the multiplication work on.  A block of 128 x 128 values
+ * takes 128 KB, which fits in the L2 cache.
+ */
+constexpr size_t block_rows = 128;
+constexpr size_t block_depth = 128;
+
+/**
+ * Matrix multiplications with fewer multiply-adds than this get done on
+ * the calling thread, as splitting them would cost more than it saves.
+ */
+constexpr size_t min_ops_for_threads = 1 << 22;
+
+/**
+ * Compute a range of columns of the product of two column-major matrices.
+ * The output columns must be initialized to 0.
+ *
+ * Each output column is accumulated as a linear combination of the columns
+ * of the left matrix, so that the innermost loop runs over contiguous
+ * memory and gets vectorized.  Four output columns are updated at once so
+ * that each value loaded from the left matrix gets used four times.  The
+ * values are summed in the same order as in the textbook algorithm.
+ *
+ * @param a left matrix of m x n values.
+ * @param b right matrix of n x p values.
+ * @param c output matrix of m x p values.
+ * @param m row size of the left and the output matrices.
+ * @param n column size of the left matrix.
+ * @param col_begin first output column to compute.
+ * @param col_end position past the last output column to compute.
+ */
+void multiply_columns(
+    const double* a, const double* b, double* c, size_t m, size_t n, size_t col_begin, size_t col_end)
+{
+    for (size_t k0 = 0; k0 < n; k0 += block_depth)
+    {
+        size_t k1 = std::min(k0 + block_depth, n);
+
+        for (size_t i0 = 0; i0 < m; i0 += block_rows)
+        {
+            size_t i1 = std::min(i0 + block_rows, m);
+            size_t j = col_begin;
+
+            for (; j + 4 <= col_end; j += 4)
+            {
+                double* c0 = c + m * j;
+                double* c1 = c0 + m;
+                double* c2 = c1 + m;
+                double* c3 = c2 + m;
+                const double* b0 = b + n * j;
+                const double* b1 = b0 + n;
+                const double* b2 = b1 + n;
+                const double* b3 = b2 + n;
+
+                for (size_t k = k0; k < k1; ++k)
+                {
+                    const double* ak = a + m * k;
+                    double v0 = b0[k], v1 = b1[k], v2 = b2[k], v3 = b3[k];
+
+                    for (size_t i = i0; i < i1; ++i)
+                    {
+                        double x = ak[i];
+                        c0[i] += x * v0;
+                        c1[i] += x * v1;
+                        c2[i] += x * v2;
+                        c3[i] += x * v3;
+                    }
+                }
+            }
+
+            for (; j < col_end; ++j)
+            {
+                double* cj = c + m * j;
+                const double* bj = b + n * j;
+
+                for (size_t k = k0; k < k1; ++k)
+                {
+                    const double* ak = a + m * k;
+                    double v = bj[k];
+
+                    for (size_t i = i0; i < i1; ++i)
+                        cj[i] += ak[i] * v;
+                }
+            }
+        }
+    }
+}
+
+}
+
 struct matrix::impl
 {
     matrix_store_t m_data;
@@ -151,6 +250,15 @@ void matrix::set(size_t row, size_t col, formula_error_t val)
     mp_impl->m_data.set(row, col, encoded);
 }
 
+void matrix::set(size_t row, size_t col, const double* p, size_t n)
+{
+    if (!n)
+        return;
+
+    assert(row + n <= row_size());
+    mp_impl->m_data.set(row, col, p, p + n);
+}
+
 matrix::element matrix::get(size_t row, size_t col) const
 {
     element me;
@@ -219,8 +327,10 @@ numeric_matrix matrix::as_numeric() const
             switch (node.type)
             {
                 case mdds::mtm::element_integer:
+                case mdds::mtm::element_string:
+                case mdds::mtm::element_empty:
                 {
-                    // String and error values will be handled as numeric values of 0.0.
+                    // String, error and empty values will be handled as numeric values of 0.0.
 #ifndef __STDC_IEC_559__
                     throw std::runtime_error("IEEE 754 is not fully supported.");
 #endif
@@ -246,12 +356,6 @@ numeric_matrix matrix::as_numeric() const
                     std::advance(dest, node.size);
                     break;
                 }
-                case mdds::mtm::element_string:
-                {
-                    // Skip string blocks.
-                    std::advance(dest, node.size);
-                    break;
-                }
                 default:
                     ;
             }
@@ -317,6 +421,62 @@ size_t numeric_matrix::col_size() const
     return mp_impl->m_cols;
 }
 
+double* numeric_matrix::data()
+{
+    return mp_impl->m_array.data();
+}
+
+const double* numeric_matrix::data() const
+{
+    return mp_impl->m_array.data();
+}
+
+numeric_matrix multiply(const numeric_matrix& left, const numeric_matrix& right, size_t thread_count)
+{
+    size_t m = left.row_size();
+    size_t n = left.col_size();
+    size_t p = right.col_size();
+
+    if (n != right.row_size())
+        throw std::invalid_argument("column size of the left matrix must equal row size of the right matrix.");
+
+    numeric_matrix output(m, p);
+    if (!m || !n || !p)
+        return output;
+
+    const double* a = left.data();
+    const double* b = right.data();
+    double* c = output.data();
+
+#if IXION_THREADS
+    if (thread_count > 1 && m * n * p >= min_ops_for_threads && !thread_pool::in_worker())
+    {
+        // Split the output columns into panels, a few per thread so that the
+        // threads stay busy when some finish early.  Keep the panel width a
+        // multiple of 4 to match the inner loop.
+        size_t panel = (p + thread_count * 4 - 1) / (thread_count * 4);
+        panel = std::max<size_t>((panel + 3) / 4 * 4, 4);
+        size_t task_count = (p + panel - 1) / panel;
+
+        thread_pool::get(thread_count).run(task_count,
+            [=](size_t i)
+            {
+                size_t col_begin = i * panel;
+                size_t col_end = std::min(col_begin + panel, p);
+                multiply_columns(a, b, c, m, n, col_begin, col_end);
+            }
+        );
+
+        return output;
+    }
+#else
+    (void)thread_count;
+#endif
+
+    multiply_columns(a, b, c, m, n, 0, p);
+    return output;
+}
+
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
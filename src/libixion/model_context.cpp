@@ -144,10 +144,7 @@ void model_context::set_string_cell(const abs_address_t& addr, string_id_t ident
 
 formula_cell* model_context::set_formula_cell(const abs_address_t& addr, formula_tokens_t tokens)
 {
-    formula_tokens_store_ptr_t ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
-
-    return mp_impl->set_formula_cell(addr, ts);
+    return mp_impl->set_formula_cell(addr, std::move(tokens));
 }
 
 formula_cell*  model_context::set_formula_cell(
@@ -174,6 +171,16 @@ void model_context::set_grouped_formula_cells(
     mp_impl->set_grouped_formula_cells(group_range, std::move(tokens), std::move(result));
 }
 
+abs_range_set_t model_context::compact_formula_groups()
+{
+    return mp_impl->compact_formula_groups();
+}
+
+formula_tokens_sharing_t model_context::get_formula_tokens_sharing() const
+{
+    return mp_impl->get_formula_tokens_sharing();
+}
+
 abs_range_t model_context::get_data_range(sheet_t sheet) const
 {
     return mp_impl->get_data_range(sheet);
@@ -194,6 +201,11 @@ double model_context::get_numeric_value(const abs_address_t& addr) const
     return mp_impl->get_numeric_value(addr);
 }
 
+formula_error_t model_context::get_numeric_value_or_error(const abs_address_t& addr, double& value) const
+{
+    return mp_impl->get_numeric_value_or_error(addr, value);
+}
+
 bool model_context::get_boolean_value(const abs_address_t& addr) const
 {
     return mp_impl->get_boolean_value(addr);
@@ -239,48 +251,52 @@ double model_context::count_range(const abs_range_t& range, const values_t& valu
     return mp_impl->count_range(range, values_type);
 }
 
+numeric_summary_t model_context::summarize_range(const abs_range_t& range) const
+{
+    return mp_impl->summarize_range(range);
+}
+
 matrix model_context::get_range_value(const abs_range_t& range) const
 {
-    if (range.first.sheet != range.last.sheet)
-        throw general_error("multi-sheet range is not allowed.");
+    return mp_impl->get_range_value(range);
+}
 
-    if (!range.valid())
-    {
-        std::ostringstream os;
-        os << "invalid range: " << range;
-        throw std::invalid_argument(os.str());
-    }
+void model_context::walk_range(const abs_range_t& range, iface::range_value_handler& handler) const
+{
+    mp_impl->walk_range(range, handler);
+}
 
-    rc_size_t sheet_size = get_sheet_size();
-    abs_range_t range_clipped = range;
-    if (range_clipped.all_rows())
-    {
-        range_clipped.first.row = 0;
-        range_clipped.last.row = sheet_size.row - 1;
-    }
-    if (range_clipped.all_columns())
-    {
-        range_clipped.first.column = 0;
-        range_clipped.last.column = sheet_size.column - 1;
-    }
+bool model_context::get_range_result(formula_function_t func, const abs_range_t& range, double& value) const
+{
+    return mp_impl->get_range_result(func, range, value);
+}
 
-    row_t rows = range_clipped.last.row - range_clipped.first.row + 1;
-    col_t cols = range_clipped.last.column - range_clipped.first.column + 1;
+void model_context::set_range_result(formula_function_t func, const abs_range_t& range, double value)
+{
+    mp_impl->set_range_result(func, range, value);
+}
 
-    matrix ret(rows, cols);
-    for (row_t i = 0; i < rows; ++i)
-    {
-        for (col_t j = 0; j < cols; ++j)
-        {
-            row_t row = i + range_clipped.first.row;
-            col_t col = j + range_clipped.first.column;
-            double val = get_numeric_value(abs_address_t(range_clipped.first.sheet, row, col));
-
-            // TODO: we need to handle string types when that becomes available.
-            ret.set(i, j, val);
-        }
-    }
-    return ret;
+bool model_context::is_range_result_unavailable(formula_function_t func, const abs_range_t& range) const
+{
+    return mp_impl->is_range_result_unavailable(func, range);
+}
+
+void model_context::set_range_result_unavailable(formula_function_t func, const abs_range_t& range)
+{
+    mp_impl->set_range_result_unavailable(func, range);
+}
+
+bool model_context::find_in_range(
+    const abs_range_t& range, double value, lookup_match_t match, lookup_search_t search, size_t& pos) const
+{
+    return mp_impl->find_in_range(range, value, match, search, pos);
+}
+
+bool model_context::find_in_range(
+    const abs_range_t& range, const std::string& value, lookup_match_t match, lookup_search_t search,
+    size_t& pos) const
+{
+    return mp_impl->find_in_range(range, value, match, search, pos);
 }
 
 std::unique_ptr<iface::session_handler> model_context::create_session_handler()
@@ -362,6 +378,21 @@ const named_expression_t* model_context::get_named_expression(sheet_t sheet, con
     return mp_impl->get_named_expression(sheet, name);
 }
 
+size_t model_context::get_named_expressions_revision() const
+{
+    return mp_impl->get_named_expressions_revision();
+}
+
+void model_context::set_calc_thread_count(size_t thread_count)
+{
+    mp_impl->set_calc_thread_count(thread_count);
+}
+
+size_t model_context::get_calc_thread_count() const
+{
+    return mp_impl->get_calc_thread_count();
+}
+
 sheet_t model_context::append_sheet(const char* p, size_t n)
 {
     return mp_impl->append_sheet(std::string(p, n));
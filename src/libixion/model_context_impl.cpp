@@ -9,12 +9,16 @@
 
 #include "ixion/address.hpp"
 #include "ixion/cell.hpp"
+#include "ixion/formula.hpp"
 #include "ixion/formula_result.hpp"
 #include "ixion/matrix.hpp"
 #include "ixion/interface/session_handler.hpp"
+#include "ixion/interface/range_value_handler.hpp"
 #include "ixion/model_iterator.hpp"
 
 #include "calc_status.hpp"
+#include "concrete_formula_tokens.hpp"
+#include "formula_program.hpp"
 #include "model_types.hpp"
 #include "utils.hpp"
 #include "debug.hpp"
@@ -22,6 +26,7 @@
 #include <sstream>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
 using std::cout;
 using std::endl;
@@ -139,6 +144,8 @@ void set_grouped_formula_cells_to_workbook(
             row_t row = top_left.row + row_offset;
             pos_hint = col_store.set(pos_hint, row, new formula_cell(row_offset, col_offset, cs, ts));
         }
+
+        sheet.reset_summary_index(col);
     }
 }
 
@@ -183,15 +190,256 @@ void check_named_exp_name_or_throw(const char* p, size_t n)
     }
 }
 
+void hash_combine(size_t& seed, size_t v)
+{
+    seed ^= v + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+void hash_address(size_t& seed, const address_t& addr)
+{
+    hash_combine(seed, addr.sheet);
+    hash_combine(seed, addr.row);
+    hash_combine(seed, addr.column);
+    hash_combine(seed, addr.abs_sheet | addr.abs_row << 1 | addr.abs_column << 2);
+}
+
+/**
+ * Hash formula tokens consistently with their equality operator.
+ */
+size_t hash_tokens(const formula_tokens_t& tokens)
+{
+    size_t seed = tokens.size();
+
+    for (const std::unique_ptr<formula_token>& t : tokens)
+    {
+        fopcode_t oc = t->get_opcode();
+        hash_combine(seed, oc);
+
+        switch (oc)
+        {
+            case fop_single_ref:
+                hash_address(seed, t->get_single_ref());
+                break;
+            case fop_range_ref:
+            {
+                range_t range = t->get_range_ref();
+                hash_address(seed, range.first);
+                hash_address(seed, range.last);
+                break;
+            }
+            case fop_named_expression:
+                hash_combine(seed, std::hash<std::string>{}(t->get_name()));
+                break;
+            case fop_string:
+            case fop_function:
+                hash_combine(seed, t->get_index());
+                break;
+            case fop_value:
+                hash_combine(seed, std::hash<double>{}(t->get_value()));
+                break;
+            default:
+                ;
+        }
+    }
+
+    return seed;
+}
+
+bool is_same_formula(const formula_tokens_store& ts1, const formula_tokens_store& ts2)
+{
+    const formula_tokens_t& tokens1 = ts1.get();
+    const formula_tokens_t& tokens2 = ts2.get();
+
+    // Stores that share their tokens hold the same instance.
+    return &tokens1 == &tokens2 || tokens1 == tokens2;
+}
+
+/**
+ * Build the tokens of a formula group that evaluates a vertical run of
+ * formula cells with identical tokens in one go.  Each reference whose row
+ * is relative becomes a range reference that spans the rows of the run,
+ * which the group evaluates element-wise.
+ *
+ * @param tokens tokens of each formula cell in the run.
+ * @param run range of the run.
+ * @param group_tokens tokens of the formula group.
+ *
+ * @return true if the tokens have been built, false if the run can't be
+ *         evaluated as a group.
+ */
+bool build_group_tokens(const formula_tokens_t& tokens, const abs_range_t& run, formula_tokens_t& group_tokens)
+{
+    row_t row_span = run.last.row - run.first.row;
+    bool has_range = false;
+
+    auto overlaps_run = [&run](const abs_range_t& r)
+    {
+        return r.first.sheet <= run.last.sheet && run.first.sheet <= r.last.sheet &&
+            r.first.row <= run.last.row && run.first.row <= r.last.row &&
+            r.first.column <= run.last.column && run.first.column <= r.last.column;
+    };
+
+    for (const std::unique_ptr<formula_token>& t : tokens)
+    {
+        fopcode_t oc = t->get_opcode();
+
+        switch (oc)
+        {
+            case fop_single_ref:
+            {
+                address_t addr = t->get_single_ref();
+
+                if (addr.abs_row)
+                {
+                    // The same cell for the whole run.
+                    if (overlaps_run(addr.to_abs(run.first)))
+                        return false;
+
+                    group_tokens.push_back(std::make_unique<single_ref_token>(addr));
+                    break;
+                }
+
+                range_t range(addr, addr);
+                range.last.row += row_span;
+
+                // A reference to another cell of the run would make the
+                // group depend on itself.
+                if (overlaps_run(range.to_abs(run.first)))
+                    return false;
+
+                group_tokens.push_back(std::make_unique<range_ref_token>(range));
+                has_range = true;
+                break;
+            }
+            case fop_value:
+                group_tokens.push_back(std::make_unique<value_token>(t->get_value()));
+                break;
+            case fop_plus:
+            case fop_minus:
+            case fop_divide:
+            case fop_multiply:
+            case fop_exponent:
+            case fop_equal:
+            case fop_not_equal:
+            case fop_less:
+            case fop_greater:
+            case fop_less_equal:
+            case fop_greater_equal:
+            case fop_open:
+            case fop_close:
+                group_tokens.push_back(std::make_unique<opcode_token>(oc));
+                break;
+            default:
+                // Functions, strings and the rest can't be evaluated
+                // element-wise.
+                return false;
+        }
+    }
+
+    std::unique_ptr<formula_program> program = formula_program::compile(group_tokens);
+    // Without any range reference, all cells of the run share one value.
+    return program && (!has_range || program->is_element_wise());
+}
+
+/**
+ * Maximum number of lookup indices to store.  Each index holds a copy of
+ * the values of its range.
+ */
+constexpr size_t max_lookup_indexes = 256;
+
+abs_address_t get_lookup_index_key(const abs_range_t& range)
+{
+    col_t col = range.first.column == range.last.column ? range.first.column : column_unset;
+    return abs_address_t(range.first.sheet, 0, col);
+}
+
+template<typename Pred>
+size_t erase_lookup_index_entries(std::vector<lookup_index_entry>& entries, Pred pred)
+{
+    auto it = std::remove_if(entries.begin(), entries.end(), pred);
+    size_t n = std::distance(it, entries.end());
+    entries.erase(it, entries.end());
+    return n;
+}
+
 } // anonymous namespace
 
+formula_tokens_pool::formula_tokens_pool() : m_purged_size(0) {}
+
+void formula_tokens_pool::purge_unused_stores()
+{
+    // The tokens of an expired entry are no longer used by any store.
+    for (auto it = m_stores.begin(); it != m_stores.end(); )
+    {
+        if (it->second.expired())
+            it = m_stores.erase(it);
+        else
+            ++it;
+    }
+
+    m_purged_size = m_stores.size();
+}
+
+formula_tokens_store_ptr_t formula_tokens_pool::intern(formula_tokens_t tokens)
+{
+    size_t hash = hash_tokens(tokens);
+
+    auto range = m_stores.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        shared_formula_tokens_ptr_t shared = it->second.lock();
+        if (shared && formula_tokens_store_access::get_tokens(*shared) == tokens)
+        {
+            ++m_sharing.reused;
+            m_sharing.tokens_saved += tokens.size();
+            return formula_tokens_store_access::create(std::move(shared));
+        }
+    }
+
+    // Purge the unused entries each time the table doubles in size, to keep
+    // the cost of purging proportional to the number of insertions.
+    if (m_stores.size() >= std::max<size_t>(m_purged_size * 2, 1024))
+        purge_unused_stores();
+
+    formula_tokens_store_ptr_t ts = formula_tokens_store::create();
+    ts->set(std::move(tokens));
+    m_stores.emplace(hash, formula_tokens_store_access::get_shared(*ts));
+    return ts;
+}
+
+formula_tokens_sharing_t formula_tokens_pool::get_sharing() const
+{
+    formula_tokens_sharing_t ret = m_sharing;
+    ret.stores = std::count_if(m_stores.begin(), m_stores.end(),
+        [](const stores_type::value_type& v) { return !v.second.expired(); });
+    return ret;
+}
+
+range_result_key::range_result_key(formula_function_t _func, const abs_range_t& _range) :
+    func(_func), range(_range) {}
+
+bool range_result_key::operator== (const range_result_key& r) const
+{
+    return func == r.func && range == r.range;
+}
+
+size_t range_result_key::hash::operator() (const range_result_key& key) const
+{
+    abs_range_t::hash range_hash;
+    return range_hash(key.range) ^ static_cast<size_t>(key.func);
+}
+
 model_context_impl::model_context_impl(model_context& parent, const rc_size_t& sheet_size) :
     m_parent(parent),
     m_sheet_size(sheet_size),
     m_tracker(),
     mp_table_handler(nullptr),
+    m_named_exps_revision(1),
+    m_calc_thread_count(0),
     mp_session_factory(&dummy_session_handler_factory),
-    m_formula_res_wait_policy(formula_result_wait_policy_t::throw_exception)
+    m_formula_res_wait_policy(formula_result_wait_policy_t::throw_exception),
+    m_lookup_index_count(0),
+    m_lookup_counter(0)
 {
 }
 
@@ -203,13 +451,33 @@ void model_context_impl::notify(formula_event_t event)
     {
         case formula_event_t::calculation_begins:
             m_formula_res_wait_policy = formula_result_wait_policy_t::block_until_done;
+            m_range_results.clear();
+            m_unavailable_range_results.clear();
+            discard_formula_lookup_indexes();
             break;
         case formula_event_t::calculation_ends:
             m_formula_res_wait_policy = formula_result_wait_policy_t::throw_exception;
+            m_range_results.clear();
+            m_unavailable_range_results.clear();
+            discard_formula_lookup_indexes();
             break;
     }
 }
 
+void model_context_impl::discard_formula_lookup_indexes()
+{
+    for (auto it = m_lookup_indexes.begin(); it != m_lookup_indexes.end();)
+    {
+        m_lookup_index_count -= erase_lookup_index_entries(
+            it->second, [](const lookup_index_entry& e) { return e.has_formula; });
+
+        if (it->second.empty())
+            it = m_lookup_indexes.erase(it);
+        else
+            ++it;
+    }
+}
+
 void model_context_impl::set_named_expression(
     const char* p, size_t n, const abs_address_t& origin, formula_tokens_t&& expr)
 {
@@ -223,6 +491,7 @@ void model_context_impl::set_named_expression(
             named_expression_t(origin, std::move(expr))
         )
     );
+    ++m_named_exps_revision;
 }
 
 void model_context_impl::set_named_expression(
@@ -239,6 +508,7 @@ void model_context_impl::set_named_expression(
             named_expression_t(origin, std::move(expr))
         )
     );
+    ++m_named_exps_revision;
 }
 
 const named_expression_t* model_context_impl::get_named_expression(const std::string& name) const
@@ -525,6 +795,489 @@ double model_context_impl::count_range(const abs_range_t& range, const values_t&
     return ret;
 }
 
+namespace {
+
+/**
+ * Copies the values passed from the model into a matrix whose top-left
+ * element corresponds with the specified origin.
+ */
+class matrix_builder : public iface::range_value_handler
+{
+    matrix& m_mx;
+    abs_address_t m_origin;
+
+public:
+    matrix_builder(matrix& mx, const abs_address_t& origin) : m_mx(mx), m_origin(origin) {}
+
+    virtual void numeric(const abs_address_t& pos, const double* p, size_t n) override
+    {
+        m_mx.set(pos.row - m_origin.row, pos.column - m_origin.column, p, n);
+    }
+
+    virtual void boolean(const abs_address_t& pos, bool val) override
+    {
+        m_mx.set(pos.row - m_origin.row, pos.column - m_origin.column, val);
+    }
+
+    virtual void string(const abs_address_t& pos, const std::string& str) override
+    {
+        m_mx.set(pos.row - m_origin.row, pos.column - m_origin.column, str);
+    }
+
+    virtual void error(const abs_address_t& pos, formula_error_t err) override
+    {
+        m_mx.set(pos.row - m_origin.row, pos.column - m_origin.column, err);
+    }
+};
+
+}
+
+abs_range_t model_context_impl::clip_range(const abs_range_t& range) const
+{
+    if (range.first.sheet != range.last.sheet)
+        throw general_error("multi-sheet range is not allowed.");
+
+    if (!range.valid())
+    {
+        std::ostringstream os;
+        os << "invalid range: " << range;
+        throw std::invalid_argument(os.str());
+    }
+
+    abs_range_t clipped = range;
+    if (clipped.all_rows())
+    {
+        clipped.first.row = 0;
+        clipped.last.row = m_sheet_size.row - 1;
+    }
+    if (clipped.all_columns())
+    {
+        clipped.first.column = 0;
+        clipped.last.column = m_sheet_size.column - 1;
+    }
+    return clipped;
+}
+
+void model_context_impl::summarize_column(
+    const column_store_t& cs, row_t row1, row_t row2, bool formula_only, numeric_summary_t& summary) const
+{
+    column_store_t::const_position_type pos = cs.position(row1);
+    column_store_t::const_iterator itb = pos.first; // block iterator
+    column_store_t::const_iterator itb_end = cs.end();
+    size_t offset = pos.second;
+    row_t row = row1;
+
+    for (; itb != itb_end && row <= row2; ++itb, offset = 0)
+    {
+        // Length of the current block that is within the range.
+        size_t len = std::min<size_t>(itb->size - offset, row2 - row + 1);
+        row += len;
+
+        switch (itb->type)
+        {
+            case element_type_numeric:
+                if (!formula_only)
+                    summary.add(&numeric_element_block::at(*itb->data, offset), len);
+                break;
+            case element_type_boolean:
+            {
+                if (formula_only)
+                    break;
+
+                auto it = boolean_element_block::cbegin(*itb->data);
+                std::advance(it, offset);
+                for (auto it_end = it + len; it != it_end; ++it)
+                    summary.add(*it ? 1.0 : 0.0);
+                break;
+            }
+            case element_type_formula:
+            {
+                const formula_cell* const* pp = &formula_element_block::at(*itb->data, offset);
+                for (const formula_cell* const* pp_end = pp + len; pp != pp_end; ++pp)
+                {
+                    formula_result res = (*pp)->get_result_cache(m_formula_res_wait_policy);
+                    switch (res.get_type())
+                    {
+                        case formula_result::result_type::value:
+                            summary.add(res.get_value());
+                            break;
+                        case formula_result::result_type::error:
+                            throw formula_error(res.get_error());
+                        default:
+                            ;
+                    }
+                }
+                break;
+            }
+            default:
+                // Nothing to aggregate.
+                ;
+        }
+    }
+}
+
+numeric_summary_t model_context_impl::summarize_range(const abs_range_t& range) const
+{
+    numeric_summary_t ret;
+
+    if (m_sheets.empty())
+        return ret;
+
+    sheet_t last_sheet = range.last.sheet;
+    if (static_cast<size_t>(last_sheet) >= m_sheets.size())
+        last_sheet = m_sheets.size() - 1;
+
+    for (sheet_t sheet = range.first.sheet; sheet <= last_sheet; ++sheet)
+    {
+        abs_range_t sheet_range = range;
+        sheet_range.first.sheet = sheet_range.last.sheet = sheet;
+        abs_range_t clipped = clip_range(sheet_range);
+        row_t row1 = clipped.first.row;
+        row_t row2 = clipped.last.row;
+
+        const worksheet& ws = m_sheets.at(sheet);
+
+        for (col_t col = clipped.first.column; col <= clipped.last.column; ++col)
+        {
+            const column_store_t& cs = ws.at(col);
+
+            if (size_t(row2 - row1 + 1) < column_summary_index::chunk_size * 2)
+            {
+                // Short enough to scan all cells.
+                summarize_column(cs, row1, row2, false, ret);
+                continue;
+            }
+
+            // Use the index for the numeric and boolean cells, and only
+            // visit the formula cells.
+            const column_summary_index* index = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_summary_index_mtx);
+                index = &ws.get_summary_index(col);
+            }
+
+            ret.add(index->query(row1, row2));
+            summarize_column(cs, row1, row2, true, ret);
+        }
+    }
+
+    return ret;
+}
+
+matrix model_context_impl::get_range_value(const abs_range_t& range) const
+{
+    abs_range_t clipped = clip_range(range);
+
+    row_t rows = clipped.last.row - clipped.first.row + 1;
+    col_t cols = clipped.last.column - clipped.first.column + 1;
+
+    matrix ret(rows, cols);
+    matrix_builder builder(ret, clipped.first);
+    walk_range(clipped, builder);
+    return ret;
+}
+
+void model_context_impl::walk_range(const abs_range_t& range, iface::range_value_handler& handler) const
+{
+    abs_range_t clipped = clip_range(range);
+    const worksheet& ws = m_sheets.at(clipped.first.sheet);
+
+    for (col_t col = clipped.first.column; col <= clipped.last.column; ++col)
+    {
+        const column_store_t& cs = ws.at(col);
+        abs_address_t pos(clipped.first.sheet, clipped.first.row, col);
+
+        // Walk the blocks overlapping with the range, starting from the
+        // block that contains the first row.
+        column_store_t::const_position_type blk_pos = cs.position(pos.row);
+        column_store_t::const_iterator itb = blk_pos.first;
+        column_store_t::const_iterator itb_end = cs.end();
+        size_t offset = blk_pos.second;
+
+        for (; itb != itb_end && pos.row <= clipped.last.row; ++itb, offset = 0)
+        {
+            // Length of the current block that is within the range.
+            size_t len = std::min<size_t>(itb->size - offset, clipped.last.row - pos.row + 1);
+            abs_address_t cell_pos = pos;
+
+            switch (itb->type)
+            {
+                case element_type_numeric:
+                    handler.numeric(pos, &numeric_element_block::at(*itb->data, offset), len);
+                    break;
+                case element_type_boolean:
+                {
+                    auto it = boolean_element_block::cbegin(*itb->data);
+                    std::advance(it, offset);
+                    for (size_t i = 0; i < len; ++i, ++it, ++cell_pos.row)
+                        handler.boolean(cell_pos, *it);
+                    break;
+                }
+                case element_type_string:
+                {
+                    const string_id_t* p = &string_element_block::at(*itb->data, offset);
+                    for (size_t i = 0; i < len; ++i, ++p, ++cell_pos.row)
+                    {
+                        const std::string* str = m_str_pool.get_string(*p);
+                        if (str)
+                            handler.string(cell_pos, *str);
+                    }
+                    break;
+                }
+                case element_type_formula:
+                {
+                    const formula_cell* const* pp = &formula_element_block::at(*itb->data, offset);
+                    for (size_t i = 0; i < len; ++i, ++pp, ++cell_pos.row)
+                    {
+                        formula_result res = (*pp)->get_result_cache(m_formula_res_wait_policy);
+                        switch (res.get_type())
+                        {
+                            case formula_result::result_type::value:
+                            {
+                                double v = res.get_value();
+                                handler.numeric(cell_pos, &v, 1);
+                                break;
+                            }
+                            case formula_result::result_type::string:
+                                handler.string(cell_pos, res.get_string());
+                                break;
+                            case formula_result::result_type::error:
+                                handler.error(cell_pos, res.get_error());
+                                break;
+                            default:
+                                ;
+                        }
+                    }
+                    break;
+                }
+                case element_type_empty:
+                    handler.empty(pos, len);
+                    break;
+                default:
+                {
+                    std::ostringstream os;
+                    os << __FUNCTION__ << ": unhandled block type (" << itb->type << ")";
+                    throw general_error(os.str());
+                }
+            }
+
+            pos.row += len;
+        }
+    }
+}
+
+bool model_context_impl::get_range_result(formula_function_t func, const abs_range_t& range, double& value) const
+{
+    if (m_formula_res_wait_policy != formula_result_wait_policy_t::block_until_done)
+        // Not in the middle of a calculation.  The cell values may change
+        // at any time.
+        return false;
+
+    std::shared_lock<std::shared_mutex> lock(m_range_results_mtx);
+    auto it = m_range_results.find(range_result_key(func, range));
+    if (it == m_range_results.end())
+        return false;
+
+    value = it->second;
+    return true;
+}
+
+void model_context_impl::set_range_result(formula_function_t func, const abs_range_t& range, double value)
+{
+    if (m_formula_res_wait_policy != formula_result_wait_policy_t::block_until_done)
+        return;
+
+    std::unique_lock<std::shared_mutex> lock(m_range_results_mtx);
+    m_range_results.emplace(range_result_key(func, range), value);
+}
+
+bool model_context_impl::is_range_result_unavailable(formula_function_t func, const abs_range_t& range) const
+{
+    if (m_formula_res_wait_policy != formula_result_wait_policy_t::block_until_done)
+        return false;
+
+    std::shared_lock<std::shared_mutex> lock(m_range_results_mtx);
+    return m_unavailable_range_results.count(range_result_key(func, range)) > 0;
+}
+
+void model_context_impl::set_range_result_unavailable(formula_function_t func, const abs_range_t& range)
+{
+    if (m_formula_res_wait_policy != formula_result_wait_policy_t::block_until_done)
+        return;
+
+    std::unique_lock<std::shared_mutex> lock(m_range_results_mtx);
+    m_unavailable_range_results.insert(range_result_key(func, range));
+}
+
+lookup_index_entry* model_context_impl::find_lookup_index_entry(const abs_range_t& range) const
+{
+    auto it = m_lookup_indexes.find(get_lookup_index_key(range));
+    if (it == m_lookup_indexes.end())
+        return nullptr;
+
+    for (lookup_index_entry& entry : it->second)
+    {
+        if (entry.range == range)
+            return &entry;
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<const lookup_index> model_context_impl::get_lookup_index(const abs_range_t& range) const
+{
+    bool found = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lookup_indexes_mtx);
+        lookup_index_entry* entry = find_lookup_index_entry(range);
+        if (entry)
+        {
+            entry->last_lookup = ++m_lookup_counter;
+            if (entry->index)
+                return entry->index;
+
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        // First lookup of the range.
+        bool has_formula = false;
+        const worksheet& ws = m_sheets.at(range.first.sheet);
+
+        for (col_t col = range.first.column; col <= range.last.column && !has_formula; ++col)
+        {
+            const column_store_t& cs = ws.at(col);
+            column_store_t::const_position_type pos = cs.position(range.first.row);
+            row_t row = range.first.row - pos.second;
+
+            for (auto it = pos.first; it != cs.end() && row <= range.last.row; row += it->size, ++it)
+            {
+                if (it->type == element_type_formula)
+                {
+                    has_formula = true;
+                    break;
+                }
+            }
+        }
+
+        if (has_formula && m_formula_res_wait_policy != formula_result_wait_policy_t::block_until_done)
+            // Not in the middle of a calculation.  The formula results may
+            // change at any time.
+            return nullptr;
+
+        add_lookup_index_entry(range, has_formula);
+        return nullptr;
+    }
+
+    // The range has been looked up before.  Index it.
+    auto index = std::make_shared<const lookup_index>(m_parent, range);
+
+    std::lock_guard<std::mutex> lock(m_lookup_indexes_mtx);
+    lookup_index_entry* entry = find_lookup_index_entry(range);
+    if (!entry)
+        // The entry has been discarded to make room for another.
+        return index;
+
+    if (!entry->index)
+        entry->index = std::move(index);
+
+    return entry->index;
+}
+
+void model_context_impl::add_lookup_index_entry(const abs_range_t& range, bool has_formula) const
+{
+    std::lock_guard<std::mutex> lock(m_lookup_indexes_mtx);
+    if (find_lookup_index_entry(range))
+        // Another thread has added it.
+        return;
+
+    if (m_lookup_index_count >= max_lookup_indexes)
+    {
+        auto oldest = m_lookup_indexes.end();
+        size_t oldest_pos = 0;
+
+        for (auto it = m_lookup_indexes.begin(); it != m_lookup_indexes.end(); ++it)
+        {
+            for (size_t i = 0; i < it->second.size(); ++i)
+            {
+                if (oldest == m_lookup_indexes.end() ||
+                    it->second[i].last_lookup < oldest->second[oldest_pos].last_lookup)
+                {
+                    oldest = it;
+                    oldest_pos = i;
+                }
+            }
+        }
+
+        oldest->second.erase(oldest->second.begin() + oldest_pos);
+        if (oldest->second.empty())
+            m_lookup_indexes.erase(oldest);
+
+        --m_lookup_index_count;
+    }
+
+    lookup_index_entry entry{range, nullptr, has_formula, ++m_lookup_counter};
+    m_lookup_indexes[get_lookup_index_key(range)].push_back(std::move(entry));
+    ++m_lookup_index_count;
+}
+
+void model_context_impl::invalidate_lookup_indexes(const abs_range_t& range)
+{
+    // Cells only get edited outside calculation, hence no locking.
+    if (!m_lookup_index_count)
+        return;
+
+    auto overlaps = [&range](const lookup_index_entry& entry)
+    {
+        const abs_range_t& r = entry.range;
+        return r.first.row <= range.last.row && range.first.row <= r.last.row &&
+            r.first.column <= range.last.column && range.first.column <= r.last.column;
+    };
+
+    auto invalidate = [&](const abs_address_t& key)
+    {
+        auto it = m_lookup_indexes.find(key);
+        if (it == m_lookup_indexes.end())
+            return;
+
+        m_lookup_index_count -= erase_lookup_index_entries(it->second, overlaps);
+        if (it->second.empty())
+            m_lookup_indexes.erase(it);
+    };
+
+    for (sheet_t sheet = range.first.sheet; sheet <= range.last.sheet; ++sheet)
+    {
+        invalidate(abs_address_t(sheet, 0, column_unset));
+
+        for (col_t col = range.first.column; col <= range.last.column; ++col)
+            invalidate(abs_address_t(sheet, 0, col));
+    }
+}
+
+bool model_context_impl::find_in_range(
+    const abs_range_t& range, double value, lookup_match_t match, lookup_search_t search, size_t& pos) const
+{
+    abs_range_t clipped = clip_range(range);
+    std::shared_ptr<const lookup_index> index = get_lookup_index(clipped);
+
+    return index ?
+        index->find(value, match, search, pos) : scan_range(m_parent, clipped, value, match, search, pos);
+}
+
+bool model_context_impl::find_in_range(
+    const abs_range_t& range, const std::string& value, lookup_match_t match, lookup_search_t search,
+    size_t& pos) const
+{
+    abs_range_t clipped = clip_range(range);
+    std::shared_ptr<const lookup_index> index = get_lookup_index(clipped);
+
+    return index ?
+        index->find(value, match, search, pos) : scan_range(m_parent, clipped, value, match, search, pos);
+}
+
 abs_address_set_t model_context_impl::get_all_formula_cells() const
 {
     abs_address_set_t cells;
@@ -610,6 +1363,8 @@ void model_context_impl::empty_cell(const abs_address_t& addr)
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set_empty(addr.row, addr.row);
+    sheet.update_summary_index(addr.column, addr.row);
+    invalidate_lookup_indexes(abs_range_t(addr));
 }
 
 void model_context_impl::set_numeric_cell(const abs_address_t& addr, double val)
@@ -618,6 +1373,8 @@ void model_context_impl::set_numeric_cell(const abs_address_t& addr, double val)
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, val);
+    sheet.update_summary_index(addr.column, addr.row);
+    invalidate_lookup_indexes(abs_range_t(addr));
 }
 
 void model_context_impl::set_boolean_cell(const abs_address_t& addr, bool val)
@@ -626,6 +1383,8 @@ void model_context_impl::set_boolean_cell(const abs_address_t& addr, bool val)
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, val);
+    sheet.update_summary_index(addr.column, addr.row);
+    invalidate_lookup_indexes(abs_range_t(addr));
 }
 
 void model_context_impl::set_string_cell(const abs_address_t& addr, const char* p, size_t n)
@@ -635,6 +1394,8 @@ void model_context_impl::set_string_cell(const abs_address_t& addr, const char*
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, str_id);
+    sheet.update_summary_index(addr.column, addr.row);
+    invalidate_lookup_indexes(abs_range_t(addr));
 }
 
 void model_context_impl::fill_down_cells(const abs_address_t& src, size_t n_dst)
@@ -690,6 +1451,9 @@ void model_context_impl::fill_down_cells(const abs_address_t& src, size_t n_dst)
             throw general_error(os.str());
         }
     }
+
+    sheet.reset_summary_index(src.column);
+    invalidate_lookup_indexes(abs_range_t(src.sheet, src.row + 1, src.column, n_dst, 1));
 }
 
 void model_context_impl::set_string_cell(const abs_address_t& addr, string_id_t identifier)
@@ -698,11 +1462,19 @@ void model_context_impl::set_string_cell(const abs_address_t& addr, string_id_t
     column_store_t& col_store = sheet.at(addr.column);
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     pos_hint = col_store.set(pos_hint, addr.row, identifier);
+    sheet.update_summary_index(addr.column, addr.row);
+    invalidate_lookup_indexes(abs_range_t(addr));
+}
+
+formula_cell* model_context_impl::set_formula_cell(const abs_address_t& addr, formula_tokens_t tokens)
+{
+    return set_formula_cell(addr, m_tokens_pool.intern(std::move(tokens)));
 }
 
 formula_cell* model_context_impl::set_formula_cell(
     const abs_address_t& addr, const formula_tokens_store_ptr_t& tokens)
 {
+    formula_tokens_store_access::compile(*tokens);
     std::unique_ptr<formula_cell> fcell = std::make_unique<formula_cell>(tokens);
 
     worksheet& sheet = m_sheets.at(addr.sheet);
@@ -710,12 +1482,15 @@ formula_cell* model_context_impl::set_formula_cell(
     column_store_t::iterator& pos_hint = sheet.get_pos_hint(addr.column);
     formula_cell* p = fcell.release();
     pos_hint = col_store.set(pos_hint, addr.row, p);
+    sheet.update_summary_index(addr.column, addr.row);
+    invalidate_lookup_indexes(abs_range_t(addr));
     return p;
 }
 
 formula_cell* model_context_impl::set_formula_cell(
     const abs_address_t& addr, const formula_tokens_store_ptr_t& tokens, formula_result result)
 {
+    formula_tokens_store_access::compile(*tokens);
     std::unique_ptr<formula_cell> fcell = std::make_unique<formula_cell>(tokens);
 
     worksheet& sheet = m_sheets.at(addr.sheet);
@@ -724,6 +1499,8 @@ formula_cell* model_context_impl::set_formula_cell(
     formula_cell* p = fcell.release();
     p->set_result_cache(std::move(result));
     pos_hint = col_store.set(pos_hint, addr.row, p);
+    sheet.update_summary_index(addr.column, addr.row);
+    invalidate_lookup_indexes(abs_range_t(addr));
     return p;
 }
 
@@ -731,18 +1508,21 @@ void model_context_impl::set_grouped_formula_cells(
     const abs_range_t& group_range, formula_tokens_t tokens)
 {
     formula_tokens_store_ptr_t ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
+    ts->set(std::move(tokens));
+    formula_tokens_store_access::compile(*ts);
 
     rc_size_t group_size = to_group_size(group_range);
     calc_status_ptr_t cs(new calc_status(group_size));
     set_grouped_formula_cells_to_workbook(m_sheets, group_range.first, group_size, cs, ts);
+    invalidate_lookup_indexes(group_range);
 }
 
 void model_context_impl::set_grouped_formula_cells(
     const abs_range_t& group_range, formula_tokens_t tokens, formula_result result)
 {
     formula_tokens_store_ptr_t ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
+    ts->set(std::move(tokens));
+    formula_tokens_store_access::compile(*ts);
 
     rc_size_t group_size = to_group_size(group_range);
 
@@ -753,8 +1533,75 @@ void model_context_impl::set_grouped_formula_cells(
         throw std::invalid_argument("dimension of the cached result differs from the size of the group.");
 
     calc_status_ptr_t cs(new calc_status(group_size));
-    cs->result = std::make_unique<formula_result>(std::move(result));
+    cs->set_result(std::make_unique<formula_result>(std::move(result)));
     set_grouped_formula_cells_to_workbook(m_sheets, group_range.first, group_size, cs, ts);
+    invalidate_lookup_indexes(group_range);
+}
+
+abs_range_set_t model_context_impl::compact_formula_groups()
+{
+    struct run_type
+    {
+        abs_range_t range;
+        formula_tokens_store_ptr_t tokens;
+    };
+
+    std::vector<run_type> runs;
+
+    for (size_t sid = 0; sid < m_sheets.size(); ++sid)
+    {
+        const worksheet& sh = m_sheets[sid];
+        for (size_t cid = 0; cid < sh.size(); ++cid)
+        {
+            const column_store_t& col = sh[cid];
+            for (const auto& blk : col)
+            {
+                if (blk.type != element_type_formula)
+                    continue;
+
+                abs_address_t pos(sid, blk.position, cid);
+                run_type run{abs_range_t(), nullptr};
+
+                for (size_t i = 0; i <= blk.size; ++i, ++pos.row)
+                {
+                    const formula_cell* fc = i < blk.size ? formula_element_block::at(*blk.data, i) : nullptr;
+                    const formula_tokens_store_ptr_t* ts =
+                        fc && !fc->get_group_properties().grouped ? &fc->get_tokens() : nullptr;
+
+                    if (run.tokens && ts && is_same_formula(**ts, *run.tokens))
+                    {
+                        run.range.last = pos;
+                        continue;
+                    }
+
+                    // The current run ends here.
+                    if (run.tokens && run.range.last.row > run.range.first.row)
+                        runs.push_back(run);
+
+                    run.range = abs_range_t(pos);
+                    run.tokens = ts ? *ts : nullptr;
+                }
+            }
+        }
+    }
+
+    abs_range_set_t groups;
+
+    for (const run_type& run : runs)
+    {
+        formula_tokens_t group_tokens;
+        if (!build_group_tokens(run.tokens->get(), run.range, group_tokens))
+            continue;
+
+        for (abs_address_t pos = run.range.first; pos.row <= run.range.last.row; ++pos.row)
+            unregister_formula_cell(m_parent, pos);
+
+        set_grouped_formula_cells(run.range, std::move(group_tokens));
+        register_formula_cell(m_parent, run.range.first);
+        groups.insert(run.range);
+    }
+
+    return groups;
 }
 
 abs_range_t model_context_impl::get_data_range(sheet_t sheet) const
@@ -894,6 +1741,35 @@ double model_context_impl::get_numeric_value(const abs_address_t& addr) const
     return 0.0;
 }
 
+formula_error_t model_context_impl::get_numeric_value_or_error(const abs_address_t& addr, double& value) const
+{
+    const column_store_t& col_store = m_sheets.at(addr.sheet).at(addr.column);
+    auto pos = col_store.position(addr.row);
+
+    switch (pos.first->type)
+    {
+        case element_type_numeric:
+            value = numeric_element_block::at(*pos.first->data, pos.second);
+            break;
+        case element_type_boolean:
+        {
+            auto it = boolean_element_block::cbegin(*pos.first->data);
+            std::advance(it, pos.second);
+            value = *it ? 1.0 : 0.0;
+            break;
+        }
+        case element_type_formula:
+        {
+            const formula_cell* p = formula_element_block::at(*pos.first->data, pos.second);
+            return p->get_value_or_error(m_formula_res_wait_policy, value);
+        }
+        default:
+            value = 0.0;
+    }
+
+    return formula_error_t::no_error;
+}
+
 bool model_context_impl::get_boolean_value(const abs_address_t& addr) const
 {
     const column_store_t& col_store = m_sheets.at(addr.sheet).at(addr.column);
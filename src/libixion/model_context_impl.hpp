@@ -9,6 +9,7 @@
 #define INCLUDED_MODEL_CONTEXT_IMPL_HPP
 
 #include "ixion/model_context.hpp"
+#include "ixion/formula_tokens.hpp"
 #include "ixion/mem_str_buf.hpp"
 #include "ixion/types.hpp"
 #include "ixion/config.hpp"
@@ -16,11 +17,15 @@
 
 #include "workbook.hpp"
 #include "column_store_type.hpp"
+#include "lookup_index.hpp"
+#include "formula_program.hpp"
 
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
+#include <shared_mutex>
 
 namespace ixion { namespace detail {
 
@@ -46,9 +51,101 @@ public:
     string_id_t get_identifier_from_string(const char* p, size_t n) const;
 };
 
+/**
+ * Table of formula tokens shared between the formula cells whose tokens
+ * are identical.  Since the references in the tokens are stored relative
+ * to the cell position, the formula cells that share the same formula in
+ * R1C1 notation share the same tokens.  Each formula cell still gets its
+ * own store, whose tokens get copied before they are modified.
+ */
+class formula_tokens_pool
+{
+    /**
+     * The table does not keep the tokens alive; they get destroyed along
+     * with the last store sharing them.
+     */
+    using stores_type = std::unordered_multimap<size_t, std::weak_ptr<shared_formula_tokens>>;
+
+    stores_type m_stores;
+
+    /** Number of entries after the last purge of the unused entries. */
+    size_t m_purged_size;
+
+    formula_tokens_sharing_t m_sharing;
+
+    void purge_unused_stores();
+
+public:
+    formula_tokens_pool();
+
+    /**
+     * Create a store that shares the tokens of an existing store when
+     * they are identical to the specified tokens.
+     *
+     * @param tokens tokens to store.  They get discarded when an existing
+     *               store holds identical tokens.
+     *
+     * @return new store holding the tokens.
+     */
+    formula_tokens_store_ptr_t intern(formula_tokens_t tokens);
+
+    formula_tokens_sharing_t get_sharing() const;
+};
+
+/**
+ * Key to look up the result of a function called with a single range
+ * argument.
+ */
+struct range_result_key
+{
+    formula_function_t func;
+    abs_range_t range;
+
+    range_result_key(formula_function_t _func, const abs_range_t& _range);
+
+    bool operator== (const range_result_key& r) const;
+
+    struct hash
+    {
+        size_t operator() (const range_result_key& key) const;
+    };
+};
+
+/**
+ * Lookup index stored for a range.
+ */
+struct lookup_index_entry
+{
+    abs_range_t range;
+
+    /**
+     * Index of the range, or nullptr while the range has only been looked
+     * up once.
+     */
+    std::shared_ptr<const lookup_index> index;
+
+    /**
+     * Whether the range contains formula cells, whose results may change
+     * without the range being edited.
+     */
+    bool has_formula;
+
+    /** Value of the lookup counter at the latest lookup of the range. */
+    size_t last_lookup;
+};
+
 class model_context_impl
 {
     typedef std::vector<std::string> strings_type;
+    typedef std::unordered_map<range_result_key, double, range_result_key::hash> range_results_type;
+    typedef std::unordered_set<range_result_key, range_result_key::hash> range_result_keys_type;
+
+    /**
+     * Lookup indices by the sheet and column of their ranges, with the row
+     * always 0.  The column of a range that spans multiple columns is
+     * column_unset.
+     */
+    typedef std::unordered_map<abs_address_t, std::vector<lookup_index_entry>, abs_address_t::hash> lookup_indexes_type;
 
 public:
     model_context_impl() = delete;
@@ -115,16 +212,25 @@ public:
     void set_string_cell(const abs_address_t& addr, const char* p, size_t n);
     void set_string_cell(const abs_address_t& addr, string_id_t identifier);
     void fill_down_cells(const abs_address_t& src, size_t n_dst);
+    formula_cell* set_formula_cell(const abs_address_t& addr, formula_tokens_t tokens);
     formula_cell* set_formula_cell(const abs_address_t& addr, const formula_tokens_store_ptr_t& tokens);
     formula_cell* set_formula_cell(const abs_address_t& addr, const formula_tokens_store_ptr_t& tokens, formula_result result);
     void set_grouped_formula_cells(const abs_range_t& group_range, formula_tokens_t tokens);
     void set_grouped_formula_cells(const abs_range_t& group_range, formula_tokens_t tokens, formula_result result);
 
+    abs_range_set_t compact_formula_groups();
+
+    formula_tokens_sharing_t get_formula_tokens_sharing() const
+    {
+        return m_tokens_pool.get_sharing();
+    }
+
     abs_range_t get_data_range(sheet_t sheet) const;
 
     bool is_empty(const abs_address_t& addr) const;
     celltype_t get_celltype(const abs_address_t& addr) const;
     double get_numeric_value(const abs_address_t& addr) const;
+    formula_error_t get_numeric_value_or_error(const abs_address_t& addr, double& value) const;
     bool get_boolean_value(const abs_address_t& addr) const;
     string_id_t get_string_identifier(const abs_address_t& addr) const;
     const std::string* get_string_value(const abs_address_t& addr) const;
@@ -140,6 +246,21 @@ public:
     const named_expression_t* get_named_expression(const std::string& name) const;
     const named_expression_t* get_named_expression(sheet_t sheet, const std::string& name) const;
 
+    size_t get_named_expressions_revision() const
+    {
+        return m_named_exps_revision;
+    }
+
+    void set_calc_thread_count(size_t thread_count)
+    {
+        m_calc_thread_count = thread_count;
+    }
+
+    size_t get_calc_thread_count() const
+    {
+        return m_calc_thread_count;
+    }
+
     sheet_t get_sheet_index(const char* p, size_t n) const;
     std::string get_sheet_name(sheet_t sheet) const;
     rc_size_t get_sheet_size() const;
@@ -158,6 +279,18 @@ public:
     const column_stores_t* get_columns(sheet_t sheet) const;
 
     double count_range(const abs_range_t& range, const values_t& values_type) const;
+    numeric_summary_t summarize_range(const abs_range_t& range) const;
+    matrix get_range_value(const abs_range_t& range) const;
+    void walk_range(const abs_range_t& range, iface::range_value_handler& handler) const;
+    bool get_range_result(formula_function_t func, const abs_range_t& range, double& value) const;
+    void set_range_result(formula_function_t func, const abs_range_t& range, double value);
+    bool is_range_result_unavailable(formula_function_t func, const abs_range_t& range) const;
+    void set_range_result_unavailable(formula_function_t func, const abs_range_t& range);
+    bool find_in_range(
+        const abs_range_t& range, double value, lookup_match_t match, lookup_search_t search, size_t& pos) const;
+    bool find_in_range(
+        const abs_range_t& range, const std::string& value, lookup_match_t match, lookup_search_t search,
+        size_t& pos) const;
 
     abs_address_set_t get_all_formula_cells() const;
 
@@ -174,6 +307,58 @@ public:
         sheet_t sheet, rc_direction_t dir, const abs_rc_range_t& range) const;
 
 private:
+    /**
+     * Expand whole-column and whole-row ranges to the sheet boundaries.
+     *
+     * @exception general_error if the range spans multiple sheets.
+     * @exception std::invalid_argument if the range is not valid.
+     */
+    abs_range_t clip_range(const abs_range_t& range) const;
+
+    /**
+     * Aggregate the values of the cells in a row interval of a column.
+     *
+     * @param cs column to aggregate.
+     * @param row1 first row of the interval.
+     * @param row2 last row of the interval.
+     * @param formula_only when true, only the formula cells get aggregated.
+     * @param summary summary to add the values to.
+     */
+    void summarize_column(
+        const column_store_t& cs, row_t row1, row_t row2, bool formula_only, numeric_summary_t& summary) const;
+
+    /**
+     * Get the lookup index of a single-row or single-column range.  A range
+     * only gets indexed when it gets looked up again, since building an
+     * index costs more than scanning the range once.  An index of a range
+     * that contains formula cells is only stored during calculation.
+     *
+     * @return index of the range, or nullptr if the range is to be scanned
+     *         instead.
+     */
+    std::shared_ptr<const lookup_index> get_lookup_index(const abs_range_t& range) const;
+
+    /**
+     * Store an entry for a range that has been looked up for the first
+     * time, discarding the least recently looked up entry when the number
+     * of entries has reached its limit.
+     */
+    void add_lookup_index_entry(const abs_range_t& range, bool has_formula) const;
+
+    lookup_index_entry* find_lookup_index_entry(const abs_range_t& range) const;
+
+    /**
+     * Discard the stored lookup indices of all ranges that overlap with an
+     * edited range.
+     */
+    void invalidate_lookup_indexes(const abs_range_t& range);
+
+    /**
+     * Discard the stored lookup indices of all ranges that contain formula
+     * cells.
+     */
+    void discard_formula_lookup_indexes();
+
     model_context& m_parent;
 
     rc_size_t m_sheet_size;
@@ -183,6 +368,8 @@ private:
     dirty_cell_tracker m_tracker;
     iface::table_handler* mp_table_handler;
     detail::named_expressions_t m_named_expressions;
+    size_t m_named_exps_revision; ///< incremented on each named expression update.
+    size_t m_calc_thread_count; ///< number of threads requested for the current calculation.
 
     model_context::session_handler_factory* mp_session_factory;
 
@@ -190,7 +377,25 @@ private:
 
     safe_string_pool m_str_pool;
 
+    /** Tokens of the formula cells that have been set individually. */
+    formula_tokens_pool m_tokens_pool;
+
     formula_result_wait_policy_t m_formula_res_wait_policy;
+
+    /** Function results on ranges stored during the current calculation. */
+    range_results_type m_range_results;
+    /** Function results on ranges known to be unavailable from the cache. */
+    range_result_keys_type m_unavailable_range_results;
+    mutable std::shared_mutex m_range_results_mtx;
+
+    /** Serializes building of the column summary indices. */
+    mutable std::mutex m_summary_index_mtx;
+
+    /** Lookup indices of ranges, kept until the ranges get edited. */
+    mutable lookup_indexes_type m_lookup_indexes;
+    mutable size_t m_lookup_index_count;
+    mutable size_t m_lookup_counter;
+    mutable std::mutex m_lookup_indexes_mtx;
 };
 
 }}
@@ -0,0 +1,120 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "range_view.hpp"
+
+#include "ixion/global.hpp"
+#include "ixion/interface/formula_model_access.hpp"
+#include "ixion/interface/range_value_handler.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace ixion {
+
+namespace {
+
+class numeric_array_builder : public iface::range_value_handler
+{
+    double* mp_values;
+    abs_address_t m_origin;
+    size_t m_rows;
+    bool m_valid;
+
+    double* get_dest(const abs_address_t& pos) const
+    {
+        return mp_values + m_rows * (pos.column - m_origin.column) + pos.row - m_origin.row;
+    }
+
+public:
+    numeric_array_builder(double* values, const abs_address_t& origin, size_t rows) :
+        mp_values(values), m_origin(origin), m_rows(rows), m_valid(true) {}
+
+    virtual void numeric(const abs_address_t& pos, const double* p, size_t n) override
+    {
+        std::copy_n(p, n, get_dest(pos));
+    }
+
+    virtual void boolean(const abs_address_t& pos, bool val) override
+    {
+        *get_dest(pos) = val ? 1.0 : 0.0;
+    }
+
+    virtual void string(const abs_address_t& /*pos*/, const std::string& /*str*/) override
+    {
+        m_valid = false;
+    }
+
+    virtual void error(const abs_address_t& /*pos*/, formula_error_t /*err*/) override
+    {
+        m_valid = false;
+    }
+
+    bool valid() const { return m_valid; }
+};
+
+}
+
+range_view::range_view(const iface::formula_model_access& cxt, const abs_range_t& range) :
+    m_context(cxt), m_range(range)
+{
+    if (m_range.first.sheet != m_range.last.sheet)
+        throw general_error("multi-sheet range is not allowed.");
+
+    if (!m_range.valid())
+    {
+        std::ostringstream os;
+        os << "invalid range: " << m_range;
+        throw std::invalid_argument(os.str());
+    }
+
+    rc_size_t sheet_size = m_context.get_sheet_size();
+
+    if (m_range.all_rows())
+    {
+        m_range.first.row = 0;
+        m_range.last.row = sheet_size.row - 1;
+    }
+    if (m_range.all_columns())
+    {
+        m_range.first.column = 0;
+        m_range.last.column = sheet_size.column - 1;
+    }
+}
+
+const abs_range_t& range_view::get_range() const
+{
+    return m_range;
+}
+
+size_t range_view::row_size() const
+{
+    return m_range.last.row - m_range.first.row + 1;
+}
+
+size_t range_view::col_size() const
+{
+    return m_range.last.column - m_range.first.column + 1;
+}
+
+void range_view::walk(iface::range_value_handler& handler) const
+{
+    m_context.walk_range(m_range, handler);
+}
+
+bool range_view::get_numeric_array(std::vector<double>& values) const
+{
+    // Empty cells are left untouched, hence the zero-initialization.
+    values.assign(row_size() * col_size(), 0.0);
+    numeric_array_builder builder(values.data(), m_range.first, row_size());
+    walk(builder);
+    return builder.valid();
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
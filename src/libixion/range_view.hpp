@@ -0,0 +1,70 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_RANGE_VIEW_HPP
+#define INCLUDED_IXION_RANGE_VIEW_HPP
+
+#include "ixion/address.hpp"
+
+#include <vector>
+
+namespace ixion {
+
+namespace iface {
+
+class formula_model_access;
+class range_value_handler;
+
+}
+
+/**
+ * Non-owning view of the values of a single-sheet range in the model.  The
+ * values are read directly from the model storage each time the view gets
+ * walked, rather than being copied into a matrix up front.
+ */
+class range_view
+{
+    const iface::formula_model_access& m_context;
+    abs_range_t m_range;
+
+public:
+    /**
+     * @param cxt model that stores the values.
+     * @param range single-sheet range.  Whole-column and whole-row ranges
+     *              get clipped to the sheet size.
+     */
+    range_view(const iface::formula_model_access& cxt, const abs_range_t& range);
+
+    const abs_range_t& get_range() const;
+    size_t row_size() const;
+    size_t col_size() const;
+
+    /**
+     * Pass all values in the range to a handler.
+     *
+     * @param handler handler to receive the values.
+     */
+    void walk(iface::range_value_handler& handler) const;
+
+    /**
+     * Read all values in the range as numeric values into a column-major
+     * array.  Boolean values are read as 1 or 0, and empty cells as 0.
+     *
+     * @param values array to store the values in.  Its original content
+     *               gets replaced.
+     *
+     * @return true if all values have been read, or false if the range
+     *         contains a string or an error value.
+     */
+    bool get_numeric_array(std::vector<double>& values) const;
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
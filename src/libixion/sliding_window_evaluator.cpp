@@ -0,0 +1,393 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "sliding_window_evaluator.hpp"
+#include "formula_program.hpp"
+
+#include "ixion/cell.hpp"
+#include "ixion/formula_tokens.hpp"
+#include "ixion/interface/formula_model_access.hpp"
+
+#include <cassert>
+
+namespace ixion { namespace detail {
+
+namespace {
+
+bool is_window_function(formula_function_t func)
+{
+    switch (func)
+    {
+        case formula_function_t::func_average:
+        case formula_function_t::func_count:
+        case formula_function_t::func_max:
+        case formula_function_t::func_min:
+        case formula_function_t::func_sum:
+            return true;
+        default:
+            ;
+    }
+
+    return false;
+}
+
+enum class window_t
+{
+    /** Both ends of the window move down with the cell. */
+    sliding,
+    /** Only the last row of the window moves down with the cell. */
+    anchored_first,
+    /** Only the first row of the window moves down with the cell. */
+    anchored_last
+};
+
+/**
+ * Get the window of a cell in the run.
+ *
+ * @param window window of the current cell.
+ * @param type type of the window.
+ * @param offset row offset of the cell from the current cell.
+ */
+abs_range_t get_window(abs_range_t window, window_t type, row_t offset)
+{
+    if (type != window_t::anchored_first)
+        window.first.row += offset;
+    if (type != window_t::anchored_last)
+        window.last.row += offset;
+    return window;
+}
+
+/**
+ * Summarize sliding windows of a fixed height, where the first window
+ * starts at the first row and each subsequent window starts one row below
+ * the previous one.
+ *
+ * The rows are divided into blocks of the window height.  Every window
+ * either matches a block exactly, or covers the tail of one block and the
+ * head of the next, so it is the merge of one suffix summary and one prefix
+ * summary.
+ */
+void summarize_sliding_windows(
+    const std::vector<numeric_summary_t>& rows, size_t height, size_t count,
+    std::vector<numeric_summary_t>& summaries)
+{
+    size_t n = rows.size();
+    std::vector<numeric_summary_t> prefix(n), suffix(n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i % height)
+            prefix[i] = prefix[i-1];
+        prefix[i].add(rows[i]);
+    }
+
+    for (size_t i = n; i-- > 0;)
+    {
+        if ((i + 1) % height && i + 1 < n)
+            suffix[i] = suffix[i+1];
+        suffix[i].add(rows[i]);
+    }
+
+    summaries.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t last = i + height - 1;
+        assert(last < n);
+
+        if (i % height)
+        {
+            summaries[i] = suffix[i];
+            summaries[i].add(prefix[last]);
+        }
+        else
+            summaries[i] = prefix[last];
+    }
+}
+
+/**
+ * Get the result of a function from the summary of its range.
+ *
+ * @return true if the result is available, or false if the function would
+ *         fail with the range.
+ */
+bool get_result(formula_function_t func, const numeric_summary_t& summary, double& value)
+{
+    switch (func)
+    {
+        case formula_function_t::func_average:
+            if (!summary.count)
+                return false;
+            value = summary.sum / summary.count;
+            return true;
+        case formula_function_t::func_count:
+            value = summary.count;
+            return true;
+        case formula_function_t::func_max:
+            value = summary.max;
+            return true;
+        case formula_function_t::func_min:
+            value = summary.min;
+            return true;
+        case formula_function_t::func_sum:
+            value = summary.sum;
+            return true;
+        default:
+            ;
+    }
+
+    return false;
+}
+
+}
+
+sliding_window_evaluator::sliding_window_evaluator(iface::formula_model_access& cxt, const abs_address_t& pos) :
+    m_context(cxt), m_pos(pos)
+{
+}
+
+bool sliding_window_evaluator::is_same_formula(
+    const abs_address_t& pos, formula_function_t func, const range_t& range) const
+{
+    const formula_cell* cell = m_context.get_formula_cell(pos);
+    if (!cell || cell->get_group_properties().grouped)
+        return false;
+
+    const formula_tokens_store_ptr_t& ts = cell->get_tokens();
+    const formula_program* program = ts ? formula_tokens_store_access::get_program(*ts) : nullptr;
+    if (!program)
+        return false;
+
+    formula_function_t func2;
+    range_t range2;
+    if (!program->get_range_function(func2, range2))
+        return false;
+
+    return func == func2 && range == range2;
+}
+
+bool sliding_window_evaluator::has_formula_cells(const abs_range_t& range) const
+{
+    // Scan from the top so that a column of formula cells is detected on
+    // its first row.
+    abs_address_t pos = range.first;
+    for (pos.row = range.first.row; pos.row <= range.last.row; ++pos.row)
+    {
+        for (pos.column = range.first.column; pos.column <= range.last.column; ++pos.column)
+        {
+            if (m_context.get_celltype(pos) == celltype_t::formula)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+bool sliding_window_evaluator::read_row_summaries(
+    const abs_range_t& range, formula_function_t func, std::vector<numeric_summary_t>& rows) const
+{
+    rows.assign(range.last.row - range.first.row + 1, numeric_summary_t());
+
+    abs_address_t pos = range.first;
+    for (pos.column = range.first.column; pos.column <= range.last.column; ++pos.column)
+    {
+        for (pos.row = range.first.row; pos.row <= range.last.row; ++pos.row)
+        {
+            numeric_summary_t& row = rows[pos.row - range.first.row];
+
+            switch (m_context.get_celltype(pos))
+            {
+                case celltype_t::numeric:
+                    row.add(m_context.get_numeric_value(pos));
+                    break;
+                case celltype_t::boolean:
+                    // COUNT only counts numeric cells.
+                    if (func != formula_function_t::func_count)
+                        row.add(m_context.get_boolean_value(pos) ? 1.0 : 0.0);
+                    break;
+                case celltype_t::formula:
+                    // Formula results may not be available yet, and waiting
+                    // on them may deadlock when they depend on the current
+                    // cell.
+                    return false;
+                default:
+                    ;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool sliding_window_evaluator::run(const formula_program& program, double& value)
+{
+    formula_function_t func;
+    range_t range;
+    if (!program.get_range_function(func, range) || !is_window_function(func))
+        return false;
+
+    if (range.all_rows() || range.all_columns())
+        return false;
+
+    window_t type;
+    if (!range.first.abs_row && !range.last.abs_row)
+        type = window_t::sliding;
+    else if (range.first.abs_row && !range.last.abs_row)
+        type = window_t::anchored_first;
+    else if (!range.first.abs_row && range.last.abs_row)
+        type = window_t::anchored_last;
+    else
+        // The range is the same for all cells.
+        return false;
+
+    abs_range_t window = range.to_abs(m_pos);
+    if (type == window_t::sliding)
+        window.reorder();
+
+    if (!window.valid() || window.first.sheet != window.last.sheet || window.contains(m_pos))
+        return false;
+
+    if (window.first.row > window.last.row || window.first.column > window.last.column)
+        return false;
+
+    if (m_context.get_range_result(func, window, value))
+        return true;
+
+    if (m_context.is_range_result_unavailable(func, window))
+        return false;
+
+    // The values of formula cells can't be read without waiting on them,
+    // which rules out the whole run.  Check the window of the current cell
+    // first, so that a run over formula cells gets rejected without being
+    // detected for each cell.
+    if (has_formula_cells(window))
+        return false;
+
+    // Find the run of cells with the same formula above and below the
+    // current cell, such that their windows stay within the sheet and don't
+    // flip over.
+    rc_size_t sheet_size = m_context.get_sheet_size();
+
+    auto is_in_run = [&](row_t offset)
+    {
+        abs_address_t pos = m_pos;
+        pos.row += offset;
+        abs_range_t w = get_window(window, type, offset);
+
+        if (pos.row < 0 || pos.row >= sheet_size.row)
+            return false;
+
+        if (w.first.row < 0 || w.last.row >= sheet_size.row || w.first.row > w.last.row)
+            return false;
+
+        return !w.contains(pos) && is_same_formula(pos, func, range);
+    };
+
+    row_t above = 0;
+    while (is_in_run(-(above + 1)))
+        ++above;
+
+    row_t below = 0;
+    while (is_in_run(below + 1))
+        ++below;
+
+    if (!above && !below)
+        return false;
+
+    // Summarize each row of the range spanned by all the windows.
+    abs_range_t span = window;
+    span.first.row = get_window(window, type, -above).first.row;
+    span.last.row = get_window(window, type, below).last.row;
+
+    size_t run_size = above + below + 1;
+
+    // Mark the other cells in the run when their results can't be derived
+    // here, so that they don't detect the same run again.
+    auto mark_unavailable = [&](size_t i)
+    {
+        row_t offset = row_t(i) - above;
+        if (offset)
+            m_context.set_range_result_unavailable(func, get_window(window, type, offset));
+    };
+
+    std::vector<numeric_summary_t> rows;
+    if (!read_row_summaries(span, func, rows))
+    {
+        for (size_t i = 0; i < run_size; ++i)
+            mark_unavailable(i);
+        return false;
+    }
+
+    std::vector<numeric_summary_t> summaries;
+
+    switch (type)
+    {
+        case window_t::sliding:
+            summarize_sliding_windows(rows, window.last.row - window.first.row + 1, run_size, summaries);
+            break;
+        case window_t::anchored_first:
+        {
+            // Each window ends one row further down than the previous one,
+            // so the windows are the prefixes of the span.
+            size_t offset = window.last.row - above - span.first.row;
+            numeric_summary_t summary;
+            for (size_t i = 0; i < offset; ++i)
+                summary.add(rows[i]);
+
+            for (size_t i = 0; i < run_size; ++i)
+            {
+                summary.add(rows[offset + i]);
+                summaries.push_back(summary);
+            }
+            break;
+        }
+        case window_t::anchored_last:
+        {
+            // Each window starts one row further down than the previous
+            // one, so the windows are the suffixes of the span.
+            summaries.resize(run_size);
+            numeric_summary_t summary;
+            for (size_t i = rows.size(); i-- > run_size - 1;)
+                summary.add(rows[i]);
+
+            for (size_t i = run_size; i-- > 0;)
+            {
+                if (i < run_size - 1)
+                    summary.add(rows[i]);
+                summaries[i] = summary;
+            }
+            break;
+        }
+    }
+
+    bool has_result = false;
+
+    for (size_t i = 0; i < run_size; ++i)
+    {
+        double v;
+        if (!get_result(func, summaries[i], v))
+        {
+            mark_unavailable(i);
+            continue;
+        }
+
+        row_t offset = row_t(i) - above;
+        if (!offset)
+        {
+            value = v;
+            has_result = true;
+        }
+        else
+            m_context.set_range_result(func, get_window(window, type, offset), v);
+    }
+
+    return has_result;
+}
+
+}}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,89 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_SLIDING_WINDOW_EVALUATOR_HPP
+#define INCLUDED_IXION_SLIDING_WINDOW_EVALUATOR_HPP
+
+#include "ixion/address.hpp"
+#include "ixion/types.hpp"
+#include "ixion/formula_function_opcode.hpp"
+
+#include <vector>
+
+namespace ixion {
+
+namespace iface {
+
+class formula_model_access;
+
+}
+
+namespace detail {
+
+class formula_program;
+
+/**
+ * Evaluates an aggregate function over a relative range, such as
+ * SUM(A1:A30), for a whole run of vertically adjacent formula cells that
+ * share the same relative formula.  The range of each cell in the run is the
+ * range of its neighbour moved down by one row, so the ranges of the run
+ * form a window over the same column span.  The window either slides when
+ * both of its ends are relative, or grows or shrinks by one row per cell
+ * when one of its ends is anchored, as in the running total
+ * SUM($A$1:A1).  Rather than scanning each window separately, the values
+ * spanned by all windows are read once, and the result of every window is
+ * derived from prefix and suffix summaries in time linear to the number of
+ * rows spanned.
+ *
+ * Only runs whose windows span constant values are evaluated this way.  A
+ * run whose windows span a formula cell falls back to normal evaluation,
+ * since formula results can't be read without waiting on them.  That gets
+ * detected once per run, and the other cells of the run skip straight to
+ * normal evaluation.
+ *
+ * The results of all the other cells in the run are stored in the range
+ * result cache of the model, from which they get picked up when those
+ * cells are interpreted.
+ */
+class sliding_window_evaluator
+{
+    iface::formula_model_access& m_context;
+    abs_address_t m_pos;
+
+    bool is_same_formula(const abs_address_t& pos, formula_function_t func, const range_t& range) const;
+    bool has_formula_cells(const abs_range_t& range) const;
+    bool read_row_summaries(
+        const abs_range_t& range, formula_function_t func, std::vector<numeric_summary_t>& rows) const;
+
+public:
+    /**
+     * @param cxt model to fetch the cell values from, and to store the
+     *            results of the other cells in the run.
+     * @param pos position of the formula cell being interpreted.
+     */
+    sliding_window_evaluator(iface::formula_model_access& cxt, const abs_address_t& pos);
+
+    /**
+     * Evaluate a compiled formula over the run of cells that contains the
+     * current cell.
+     *
+     * @param program program of the current cell.
+     * @param value result of the current cell, set only when true is
+     *              returned.
+     *
+     * @return true if the program has been evaluated, or false if it is not
+     *         suitable for sliding-window evaluation, in which case the
+     *         program should be evaluated normally.
+     */
+    bool run(const formula_program& program, double& value);
+};
+
+}}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
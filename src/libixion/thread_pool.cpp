@@ -0,0 +1,340 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "thread_pool.hpp"
+
+#include <cassert>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+
+#if !IXION_THREADS
+#error "This file is not to be compiled when the threads are disabled."
+#endif
+
+namespace ixion {
+
+namespace {
+
+/**
+ * Task queue owned by a single worker.  The owner pops from the front
+ * while other workers steal from the back.
+ */
+class task_queue
+{
+    std::deque<size_t> m_tasks;
+    std::mutex m_mtx;
+
+public:
+    void push_back(size_t task)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_tasks.push_back(task);
+    }
+
+    void push_front(size_t task)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_tasks.push_front(task);
+    }
+
+    bool pop(size_t& task)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_tasks.empty())
+            return false;
+
+        task = m_tasks.front();
+        m_tasks.pop_front();
+        return true;
+    }
+
+    bool steal(size_t& task)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_tasks.empty())
+            return false;
+
+        task = m_tasks.back();
+        m_tasks.pop_back();
+        return true;
+    }
+};
+
+/** Pool the current thread works for, if any. */
+thread_local const void* tl_pool = nullptr;
+
+/** Position of the current thread within its pool. */
+thread_local size_t tl_worker = 0;
+
+}
+
+struct thread_pool::impl
+{
+    std::vector<task_queue> m_queues;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_run_mtx; // serializes batches
+
+    std::mutex m_mtx;
+    std::condition_variable m_cond_start;
+    std::condition_variable m_cond_work;
+    std::condition_variable m_cond_done;
+    size_t m_batch_id;
+    bool m_stop;
+
+    /** Set only while the current batch is fully queued. */
+    std::atomic<bool> m_ready;
+
+    /** Number of tasks yet to finish in the current batch. */
+    std::atomic<size_t> m_remaining;
+
+    /** Number of tasks sitting in the queues.  It may briefly go negative. */
+    std::atomic<std::ptrdiff_t> m_queued;
+
+    /** Number of workers waiting for more tasks to get queued. */
+    std::atomic<size_t> m_idle;
+
+    const task_type* mp_task;
+    std::exception_ptr m_exception;
+
+    impl(size_t thread_count) :
+        m_queues(thread_count),
+        m_batch_id(0),
+        m_stop(false),
+        m_ready(false),
+        m_remaining(0),
+        m_queued(0),
+        m_idle(0),
+        mp_task(nullptr)
+    {
+        if (!thread_count)
+            throw std::invalid_argument("thread pool requires at least one thread.");
+
+        m_workers.reserve(thread_count);
+        for (size_t i = 0; i < thread_count; ++i)
+            m_workers.emplace_back(&impl::worker_main, this, i);
+    }
+
+    ~impl()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_stop = true;
+        }
+
+        m_cond_start.notify_all();
+        m_cond_work.notify_all();
+
+        for (std::thread& t : m_workers)
+            t.join();
+    }
+
+    bool next_task(size_t worker, size_t& task)
+    {
+        if (!m_ready.load(std::memory_order_acquire))
+            return false;
+
+        bool found = m_queues[worker].pop(task);
+
+        // Our own queue is empty.  Try to steal from others.
+        for (size_t i = 1, n = m_queues.size(); !found && i < n; ++i)
+            found = m_queues[(worker + i) % n].steal(task);
+
+        if (found)
+            m_queued.fetch_sub(1);
+
+        return found;
+    }
+
+    void execute(size_t task)
+    {
+        try
+        {
+            (*mp_task)(task);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_exception)
+                m_exception = std::current_exception();
+        }
+
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            // This was the last task in the batch.
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_cond_done.notify_all();
+            m_cond_work.notify_all();
+        }
+    }
+
+    void process_batch(size_t worker)
+    {
+        while (true)
+        {
+            size_t task;
+            if (next_task(worker, task))
+            {
+                execute(task);
+                continue;
+            }
+
+            // Nothing to pick up at the moment.  Wait until either more tasks
+            // get queued or the batch ends.
+            std::unique_lock<std::mutex> lock(m_mtx);
+            ++m_idle;
+            m_cond_work.wait(lock,
+                [this]
+                {
+                    return m_stop || m_queued.load() > 0 || m_remaining.load() == 0;
+                }
+            );
+            --m_idle;
+
+            if (m_stop || !m_remaining.load())
+                return;
+        }
+    }
+
+    void worker_main(size_t worker)
+    {
+        tl_pool = this;
+        tl_worker = worker;
+
+        size_t batch_seen = 0;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cond_start.wait(lock, [&] { return m_stop || m_batch_id != batch_seen; });
+
+                if (m_stop)
+                    return;
+
+                batch_seen = m_batch_id;
+            }
+
+            process_batch(worker);
+        }
+    }
+
+    void queue(size_t task)
+    {
+        size_t worker = tl_pool == this ? tl_worker : 0;
+        m_queues[worker].push_front(task);
+        m_queued.fetch_add(1);
+
+        if (m_idle.load())
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_cond_work.notify_one();
+        }
+    }
+
+    void run(size_t task_count, const std::vector<size_t>& initial_tasks, const task_type& task)
+    {
+        if (!task_count)
+            return;
+
+        if (initial_tasks.empty())
+            throw std::invalid_argument("a batch must have at least one initial task.");
+
+        std::lock_guard<std::mutex> run_lock(m_run_mtx);
+
+        mp_task = &task;
+        m_exception = nullptr;
+        m_remaining.store(task_count);
+
+        // Distribute all initial tasks before letting the workers pick them up.
+        for (size_t i = 0; i < initial_tasks.size(); ++i)
+            m_queues[i % m_queues.size()].push_back(initial_tasks[i]);
+
+        m_queued.store(initial_tasks.size());
+        m_ready.store(true, std::memory_order_release);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            ++m_batch_id;
+        }
+
+        m_cond_start.notify_all();
+
+        std::exception_ptr ex;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cond_done.wait(lock, [this] { return m_remaining.load() == 0; });
+            m_ready.store(false, std::memory_order_release);
+            ex = m_exception;
+            m_exception = nullptr;
+        }
+
+        mp_task = nullptr;
+
+        if (ex)
+            std::rethrow_exception(ex);
+    }
+};
+
+thread_pool::thread_pool(size_t thread_count) :
+    mp_impl(std::make_unique<impl>(thread_count)) {}
+
+thread_pool::~thread_pool() {}
+
+size_t thread_pool::size() const
+{
+    return mp_impl->m_workers.size();
+}
+
+void thread_pool::run(size_t task_count, const task_type& task)
+{
+    std::vector<size_t> tasks;
+    tasks.reserve(task_count);
+    for (size_t i = 0; i < task_count; ++i)
+        tasks.push_back(i);
+
+    mp_impl->run(task_count, tasks, task);
+}
+
+void thread_pool::run(size_t task_count, const std::vector<size_t>& initial_tasks, const task_type& task)
+{
+    mp_impl->run(task_count, initial_tasks, task);
+}
+
+void thread_pool::queue(size_t task)
+{
+    mp_impl->queue(task);
+}
+
+thread_pool& thread_pool::get(size_t thread_count)
+{
+    static std::mutex mtx;
+    static std::unordered_map<size_t, std::unique_ptr<thread_pool>> pools;
+
+    std::lock_guard<std::mutex> lock(mtx);
+
+    auto it = pools.find(thread_count);
+    if (it == pools.end())
+        it = pools.emplace(thread_count, std::make_unique<thread_pool>(thread_count)).first;
+
+    return *it->second;
+}
+
+bool thread_pool::in_worker()
+{
+    return tl_pool != nullptr;
+}
+
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
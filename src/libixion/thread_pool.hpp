@@ -0,0 +1,115 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_IXION_THREAD_POOL_HPP
+#define INCLUDED_IXION_THREAD_POOL_HPP
+
+#include <memory>
+#include <functional>
+#include <vector>
+
+namespace ixion {
+
+/**
+ * Pool of persistent worker threads.  Each worker owns its own task
+ * queue, and a worker whose queue has run dry steals tasks from the back
+ * of the other workers' queues.
+ *
+ * The initial tasks of a batch are distributed to the worker queues in a
+ * round-robin fashion before any of the workers start picking them up,
+ * and each worker processes its own queue in the order the tasks were
+ * given.  This guarantees that, when a task only ever waits for tasks
+ * that precede it in the batch, the batch will always run to completion.
+ *
+ * A running task may queue additional tasks of the same batch.  Those get
+ * pushed to the front of the queue of the calling worker, so that they
+ * run next on the same thread unless other workers steal them first.
+ */
+class thread_pool
+{
+    struct impl;
+    std::unique_ptr<impl> mp_impl;
+
+public:
+    using task_type = std::function<void(size_t)>;
+
+    thread_pool() = delete;
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /**
+     * @param thread_count number of worker threads to launch.  It must be
+     *                     greater than 0.
+     */
+    thread_pool(size_t thread_count);
+    ~thread_pool();
+
+    /**
+     * @return number of worker threads in this pool.
+     */
+    size_t size() const;
+
+    /**
+     * Run a batch of tasks, and block until all of them finish.  Only one
+     * batch may run at a time per pool; concurrent calls get serialized.
+     *
+     * @param task_count number of tasks in the batch.
+     * @param task function to call for each task.  It receives the
+     *             position of the task within the batch.
+     *
+     * @exception the first exception thrown by any of the tasks gets
+     *            re-thrown after all the tasks have finished.
+     */
+    void run(size_t task_count, const task_type& task);
+
+    /**
+     * Run a batch of tasks of which only some are initially ready, and
+     * block until all of them finish.  The remaining tasks must be queued
+     * via queue() by the running tasks.
+     *
+     * @param task_count total number of tasks to run in this batch.
+     * @param initial_tasks tasks that are ready to run from the start.
+     * @param task function to call for each task.  It receives the
+     *             identifier of the task.
+     *
+     * @exception the first exception thrown by any of the tasks gets
+     *            re-thrown after all the tasks have finished.
+     */
+    void run(size_t task_count, const std::vector<size_t>& initial_tasks, const task_type& task);
+
+    /**
+     * Queue a task that has become ready to run.  This must be called from
+     * within a task running in this pool.
+     *
+     * @param task identifier of the task to queue.
+     */
+    void queue(size_t task);
+
+    /**
+     * Get the shared pool instance for the specified number of threads.
+     * The instance gets created on the first request, and stays alive
+     * until the process terminates.
+     *
+     * @param thread_count number of worker threads.
+     *
+     * @return shared pool instance.
+     */
+    static thread_pool& get(size_t thread_count);
+
+    /**
+     * @return true if the calling thread is a worker thread of any pool,
+     *         false otherwise.  A task must not start another batch on the
+     *         pool it runs in.
+     */
+    static bool in_worker();
+};
+
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
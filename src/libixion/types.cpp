@@ -7,6 +7,7 @@
 
 #include "ixion/types.hpp"
 
+#include <algorithm>
 #include <limits>
 #include <vector>
 
@@ -48,6 +49,67 @@ formula_group_t& formula_group_t::operator= (const formula_group_t& other)
     return *this;
 }
 
+formula_tokens_sharing_t::formula_tokens_sharing_t() : stores(0), reused(0), tokens_saved(0) {}
+
+numeric_summary_t::numeric_summary_t() : sum(0.0), min(0.0), max(0.0), count(0) {}
+
+void numeric_summary_t::add(const double* p, size_t n)
+{
+    if (!n)
+        return;
+
+    // Use independent accumulators so that the loops have no dependency
+    // between consecutive iterations, which lets the compiler vectorize
+    // them.
+    double s[4] = { 0.0, 0.0, 0.0, 0.0 };
+    double lo[4] = { p[0], p[0], p[0], p[0] };
+    double hi[4] = { p[0], p[0], p[0], p[0] };
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        for (size_t j = 0; j < 4; ++j)
+        {
+            double v = p[i+j];
+            s[j] += v;
+            lo[j] = v < lo[j] ? v : lo[j];
+            hi[j] = v > hi[j] ? v : hi[j];
+        }
+    }
+
+    for (; i < n; ++i)
+    {
+        double v = p[i];
+        s[0] += v;
+        lo[0] = v < lo[0] ? v : lo[0];
+        hi[0] = v > hi[0] ? v : hi[0];
+    }
+
+    double block_min = std::min(std::min(lo[0], lo[1]), std::min(lo[2], lo[3]));
+    double block_max = std::max(std::max(hi[0], hi[1]), std::max(hi[2], hi[3]));
+
+    sum += (s[0] + s[1]) + (s[2] + s[3]);
+    min = count ? std::min(min, block_min) : block_min;
+    max = count ? std::max(max, block_max) : block_max;
+    count += n;
+}
+
+void numeric_summary_t::add(double v)
+{
+    add(&v, 1);
+}
+
+void numeric_summary_t::add(const numeric_summary_t& other)
+{
+    if (!other.count)
+        return;
+
+    sum += other.sum;
+    min = count ? std::min(min, other.min) : other.min;
+    max = count ? std::max(max, other.max) : other.max;
+    count += other.count;
+}
+
 const char* get_formula_error_name(formula_error_t fe)
 {
     static const char* default_err_name = "#ERR!";
@@ -60,6 +122,7 @@ const char* get_formula_error_name(formula_error_t fe)
         "#NAME?",  // 4: name not found
         "#NULL!",  // 5: no range intersection
         "#VALUE!", // 6: invalid value type
+        "#N/A",    // 7: no value available
     };
 
     if (static_cast<size_t>(fe) < names.size())
@@ -13,7 +13,8 @@ namespace ixion {
 
 worksheet::worksheet() {}
 
-worksheet::worksheet(size_t row_size, size_t col_size)
+worksheet::worksheet(size_t row_size, size_t col_size) :
+    m_summary_indices(col_size)
 {
     m_pos_hints.reserve(col_size);
     for (size_t i = 0; i < col_size; ++i)
@@ -25,6 +26,27 @@ worksheet::worksheet(size_t row_size, size_t col_size)
 
 worksheet::~worksheet() {}
 
+const detail::column_summary_index& worksheet::get_summary_index(size_type n) const
+{
+    std::unique_ptr<detail::column_summary_index>& p = m_summary_indices.at(n);
+    if (!p)
+        p = std::make_unique<detail::column_summary_index>(m_columns[n]);
+
+    return *p;
+}
+
+void worksheet::update_summary_index(size_type n, size_type row)
+{
+    std::unique_ptr<detail::column_summary_index>& p = m_summary_indices.at(n);
+    if (p)
+        p->update(row);
+}
+
+void worksheet::reset_summary_index(size_type n)
+{
+    m_summary_indices.at(n).reset();
+}
+
 workbook::workbook() {}
 
 workbook::workbook(size_t sheet_size, size_t row_size, size_t col_size)
@@ -9,9 +9,11 @@
 #define INCLUDED_IXION_WORKBOOK_HPP
 
 #include "column_store_type.hpp"
+#include "column_summary_index.hpp"
 #include "model_types.hpp"
 
 #include <vector>
+#include <memory>
 
 namespace ixion {
 
@@ -32,6 +34,31 @@ public:
 
     column_store_t::iterator& get_pos_hint(size_type n) { return m_pos_hints.at(n); }
 
+    /**
+     * Get the summary index of a column, building it first when it doesn't
+     * exist yet.  Concurrent calls must be serialized by the caller.
+     *
+     * @param n column position.
+     */
+    const detail::column_summary_index& get_summary_index(size_type n) const;
+
+    /**
+     * Update the summary index of a column, if one exists, after a single
+     * cell has been modified.
+     *
+     * @param n column position.
+     * @param row row position of the modified cell.
+     */
+    void update_summary_index(size_type n, size_type row);
+
+    /**
+     * Discard the summary index of a column, if one exists, after multiple
+     * cells have been modified.  It will be rebuilt on next request.
+     *
+     * @param n column position.
+     */
+    void reset_summary_index(size_type n);
+
     /**
      * Return the number of columns.
      *
@@ -47,6 +74,7 @@ public:
 private:
     column_stores_t m_columns;
     std::vector<column_store_t::iterator> m_pos_hints;
+    mutable std::vector<std::unique_ptr<detail::column_summary_index>> m_summary_indices;
     detail::named_expressions_t m_named_expressions;
 };
 
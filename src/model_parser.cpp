@@ -201,6 +201,12 @@ model_parser::model_parser(const string& filepath, size_t thread_count) :
     m_context.set_session_handler_factory(&m_session_handler_factory);
     m_context.set_table_handler(&m_table_handler);
 
+    // Use the requested threads however few the formula cells are, so that
+    // the threaded calculation gets exercised by the small test models.
+    config cfg = m_context.get_config();
+    cfg.min_cells_for_threads = 0;
+    m_context.set_config(cfg);
+
     global::load_file_content(m_filepath, m_strm);
 
     mp_head = m_strm.data();
@@ -502,9 +508,7 @@ void model_parser::parse_init()
                     parse_formula_string(
                         m_context, pos, *mp_name_resolver, cell_def.value.get(), cell_def.value.size());
 
-                auto ts = formula_tokens_store::create();
-                ts->get() = std::move(tokens);
-                m_context.set_formula_cell(pos, ts);
+                m_context.set_formula_cell(pos, std::move(tokens));
                 m_dirty_formula_cells.insert(pos);
 
                 cout << get_display_cell_string(pos) << ": (f) " << cell_def.value.str() << endl;
@@ -586,9 +590,7 @@ void model_parser::parse_edit()
                     parse_formula_string(
                         m_context, pos, *mp_name_resolver, cell_def.value.get(), cell_def.value.size());
 
-                auto ts = formula_tokens_store::create();
-                ts->get() = std::move(tokens);
-                m_context.set_formula_cell(pos, ts);
+                m_context.set_formula_cell(pos, std::move(tokens));
                 m_dirty_formula_cells.insert(pos);
                 register_formula_cell(m_context, pos);
                 cout << get_display_cell_string(pos) << ": (f) " << cell_def.value.str() << endl;
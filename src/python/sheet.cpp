@@ -158,7 +158,7 @@ PyObject* sheet_set_formula_cell(sheet* self, PyObject* args, PyObject* kwargs)
             cxt, pos, *sd->m_global->m_resolver, formula, strlen(formula));
 
     auto ts = formula_tokens_store::create();
-    ts->get() = std::move(tokens);
+    ts->set(std::move(tokens));
     cxt.set_formula_cell(pos, ts);
 
     // Put this formula cell in a dependency chain.